@@ -0,0 +1,1208 @@
+//(C) benyuan 2024
+//all rights reserved
+
+//dispatch cost of the event system. every case runs blocks of operations, the mean is total time over all
+//operations, percentiles are over the per operation time of each block, and allocations are counted
+//by replacing the global operator new. options:
+//  --format=table|json|csv   output, json and csv are meant for diffing between builds
+//  --filter=text             only cases whose name contains text
+//  --quick                   fewer blocks, for a smoke run
+#include "EventReplay.hpp"
+#include "EventSystem.hpp"
+#include "ShmTransport.hpp"
+#include "StaticEventBus.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    std::atomic<uint64_t> allocations{ 0 };
+}
+
+//every replaceable form, so each new is paired with a delete of this file and allocations counts them all
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void* operator new(size_t size, std::align_val_t align)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    //aligned_alloc wants a multiple of the alignment
+    const size_t alignment = std::max<size_t>((size_t)align, sizeof(void*));
+    if (void* p = std::aligned_alloc(alignment, (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t align)
+{
+    return operator new(size, align);
+}
+
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return operator new(size, align);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, align, tag);
+}
+
+//gcc inlines these into callers and then takes the free for a mismatch with operator new, which this file also replaces
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+    using es::ESI;
+    using es::ESL;
+    using es::EventSystem;
+
+    template <typename T>
+    inline void DoNotOptimize(const T& value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        static volatile const void* sink;
+        sink = &value;
+#endif
+    }
+
+    enum EventID
+    {
+        Tick,
+        Wildcard,
+        Mixed,
+        Member,
+        Lambda,
+        StdFunction,
+        FreeFunction,
+        Batch,
+        Posted,
+        Unknown,
+        Churn,
+        Coalesced,
+        Payload,
+        Handoff,
+        Rearm,
+        Nested,
+        Recorded,
+        Shared,
+        Keyed,
+        Static,
+        Timed,
+        Affine,
+        Overloaded,
+    };
+
+    struct Listener
+    {
+        void On(int x) { DoNotOptimize(x); }
+        void OnOther(float x) { DoNotOptimize(x); }
+    };
+
+    void OnFree(int x)
+    {
+        DoNotOptimize(x);
+    }
+
+    //a handler of the static bus, one type per listener as a hand written fan out would have
+    template <int I>
+    struct StaticListener
+    {
+        Listener* r = nullptr;
+        void operator()(int x) const { r->On(x + I); }
+    };
+
+    struct Options
+    {
+        std::string format = "table";
+        std::string filter;
+        bool quick = false;
+    };
+
+    struct Result
+    {
+        std::string name;
+        uint64_t ops = 0;
+        double nsPerOp = 0;
+        double p50 = 0;
+        double p90 = 0;
+        double p99 = 0;
+        double allocsPerOp = 0;
+    };
+
+    double Percentile(std::vector<double>& samples, double q)
+    {
+        if (samples.empty())
+        {
+            return 0;
+        }
+        const size_t i = std::min(samples.size() - 1, (size_t)(q * (double)samples.size()));
+        std::nth_element(samples.begin(), samples.begin() + (ptrdiff_t)i, samples.end());
+        return samples[i];
+    }
+
+    class Suite
+    {
+    public:
+        explicit Suite(Options options) : _options(std::move(options)) {}
+
+        [[nodiscard]] bool Selected(std::string_view name) const
+        {
+            return _options.filter.empty() || name.find(_options.filter) != std::string_view::npos;
+        }
+
+        [[nodiscard]] size_t Blocks(size_t blocks) const
+        {
+            return _options.quick ? std::max<size_t>(blocks / 20, 2) : blocks;
+        }
+
+        /// <summary>
+        /// time blocks of blockOps operations, run(blockOps) does one block.
+        /// reset runs untimed between blocks, for cases that consume state
+        /// </summary>
+        template <typename Run, typename Reset>
+        void Measure(const std::string& name, size_t blocks, size_t blockOps, Run&& run, Reset&& reset)
+        {
+            if (!Selected(name))
+            {
+                return;
+            }
+
+            blocks = Blocks(blocks);
+            run(blockOps);  //warm up caches and lazily built tables
+            reset();
+
+            std::vector<double> samples;
+            samples.reserve(blocks);
+            double total = 0;
+            uint64_t allocs = 0;
+            for (size_t b = 0; b < blocks; ++b)
+            {
+                const uint64_t a0 = allocations.load(std::memory_order_relaxed);
+                const auto t0 = Clock::now();
+                run(blockOps);
+                const auto t1 = Clock::now();
+                allocs += allocations.load(std::memory_order_relaxed) - a0;
+                const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+                total += ns;
+                samples.push_back(ns / (double)blockOps);
+                reset();
+            }
+
+            Record(name, blocks * blockOps, total, samples, allocs);
+        }
+
+        template <typename Run>
+        void Measure(const std::string& name, size_t blocks, size_t blockOps, Run&& run)
+        {
+            Measure(name, blocks, blockOps, std::forward<Run>(run), []() {});
+        }
+
+        /// <summary>
+        /// producers threads each run blocks concurrently, ns/op is wall time over all operations of all threads
+        /// </summary>
+        template <typename Run>
+        void MeasureThreads(const std::string& name, size_t producers, size_t blocks, size_t blockOps, Run&& run)
+        {
+            if (!Selected(name))
+            {
+                return;
+            }
+
+            blocks = Blocks(blocks);
+            run(0, blockOps);
+
+            std::vector<std::vector<double>> samples(producers);
+            std::atomic<size_t> ready{ 0 };
+            std::atomic<bool> go{ false };
+            std::vector<std::thread> threads;
+            const uint64_t a0 = allocations.load(std::memory_order_relaxed);
+            for (size_t t = 0; t < producers; ++t)
+            {
+                threads.emplace_back([&, t]()
+                    {
+                        samples[t].reserve(blocks);
+                        ready.fetch_add(1);
+                        while (!go.load(std::memory_order_acquire))
+                        {
+                            std::this_thread::yield();
+                        }
+                        for (size_t b = 0; b < blocks; ++b)
+                        {
+                            const auto t0 = Clock::now();
+                            run(t, blockOps);
+                            samples[t].push_back(std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / (double)blockOps);
+                        }
+                    });
+            }
+
+            while (ready.load() < producers)
+            {
+                std::this_thread::yield();
+            }
+            const auto t0 = Clock::now();
+            go.store(true, std::memory_order_release);
+            for (auto& t : threads)
+            {
+                t.join();
+            }
+            const double total = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+            const uint64_t allocs = allocations.load(std::memory_order_relaxed) - a0;
+
+            std::vector<double> all;
+            for (auto& s : samples)
+            {
+                all.insert(all.end(), s.begin(), s.end());
+            }
+            Record(name, producers * blocks * blockOps, total, all, allocs);
+        }
+
+        void Print() const
+        {
+            const unsigned hw = std::thread::hardware_concurrency();
+            if (_options.format == "json")
+            {
+                std::printf("{\n  \"context\": {\"compiler\": \"%s\", \"hardware_threads\": %u, \"quick\": %s},\n  \"benchmarks\": [\n",
+                    Compiler(), hw, _options.quick ? "true" : "false");
+                for (size_t i = 0; i < _results.size(); ++i)
+                {
+                    const Result& r = _results[i];
+                    std::printf("    {\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.3f, \"p50_ns\": %.3f, \"p90_ns\": %.3f, \"p99_ns\": %.3f, \"allocs_per_op\": %.4f}%s\n",
+                        r.name.c_str(), (unsigned long long)r.ops, r.nsPerOp, r.p50, r.p90, r.p99, r.allocsPerOp, i + 1 < _results.size() ? "," : "");
+                }
+                std::printf("  ]\n}\n");
+                return;
+            }
+
+            if (_options.format == "csv")
+            {
+                std::printf("name,ops,ns_per_op,p50_ns,p90_ns,p99_ns,allocs_per_op\n");
+                for (const Result& r : _results)
+                {
+                    std::printf("%s,%llu,%.3f,%.3f,%.3f,%.3f,%.4f\n", r.name.c_str(), (unsigned long long)r.ops, r.nsPerOp, r.p50, r.p90, r.p99, r.allocsPerOp);
+                }
+                return;
+            }
+
+            std::printf("%s, %u hardware threads\n", Compiler(), hw);
+            std::printf("%-40s %12s %10s %10s %10s %10s %10s\n", "name", "ops", "ns/op", "p50", "p90", "p99", "allocs/op");
+            for (const Result& r : _results)
+            {
+                std::printf("%-40s %12llu %10.2f %10.2f %10.2f %10.2f %10.4f\n", r.name.c_str(), (unsigned long long)r.ops, r.nsPerOp, r.p50, r.p90, r.p99, r.allocsPerOp);
+            }
+        }
+
+    private:
+        static const char* Compiler()
+        {
+#if defined(__clang__)
+            return "clang " __clang_version__;
+#elif defined(__GNUC__)
+            return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+            return "msvc";
+#else
+            return "unknown";
+#endif
+        }
+
+        void Record(const std::string& name, uint64_t ops, double total, std::vector<double>& samples, uint64_t allocs)
+        {
+            Result r;
+            r.name = name;
+            r.ops = ops;
+            r.nsPerOp = total / (double)ops;
+            r.p50 = Percentile(samples, 0.50);
+            r.p90 = Percentile(samples, 0.90);
+            r.p99 = Percentile(samples, 0.99);
+            r.allocsPerOp = (double)allocs / (double)ops;
+            _results.push_back(r);
+            if (_options.format == "table")
+            {
+                std::fprintf(stderr, "done %s\n", name.c_str());
+            }
+        }
+
+        Options _options;
+        std::vector<Result> _results;
+    };
+
+    void RegisterCases(Suite& suite)
+    {
+        std::vector<Listener> recvers(1024);
+        int sender = 0;
+        suite.Measure("register/member", 200, recvers.size(), [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Register(Tick, &sender, &recvers[i], &Listener::On);
+                }
+            }, []() { ESI().Clear(); });
+
+        suite.Measure("register/lambda", 200, recvers.size(), [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Register(Tick, &recvers[i], [](int x) { DoNotOptimize(x); });
+                }
+            }, []() { ESI().Clear(); });
+
+        //a list per sender, carved from the pool of the bus and reused after each Clear
+        EventSystem pooled;
+        pooled.SetPooledMemory();
+        suite.Measure("register/lambda/pooled", 200, recvers.size(), [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    pooled.Register(Tick, &recvers[i], [](int x) { DoNotOptimize(x); });
+                }
+            }, [&]() { pooled.Clear(); });
+    }
+
+    void SendCases(Suite& suite)
+    {
+        for (size_t fanOut : { 1, 8, 64, 512 })
+        {
+            std::vector<Listener> recvers(fanOut);
+            int sender = 0;
+            for (auto& r : recvers)
+            {
+                ESI().Register(Tick, &sender, &r, &Listener::On);
+                ESI().Register(Wildcard, nullptr, &r, &Listener::On);
+                ESI().Register(Mixed, &sender, &r, &Listener::On);
+                ESI().Register(Mixed, nullptr, &r, &Listener::On);
+            }
+
+            const std::string suffix = "/fanout-" + std::to_string(fanOut);
+            const size_t ops = std::max<size_t>(16, 4096 / fanOut);
+            suite.Measure("send/sender" + suffix, 500, ops, [&](size_t n)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        ESI().Send(Tick, &sender, (int)i);
+                    }
+                });
+            suite.Measure("sendall/wildcard" + suffix, 500, ops, [&](size_t n)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        ESI().SendAll(Wildcard, (int)i);
+                    }
+                });
+            suite.Measure("send/sender+wildcard" + suffix, 500, ops, [&](size_t n)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        ESI().Send(Mixed, &sender, (int)i);
+                    }
+                });
+            ESI().Clear();
+        }
+
+        //many senders, so the sender lookup misses the cache like a real program
+        {
+            std::vector<Listener> senders(4096);
+            for (auto& s : senders)
+            {
+                ESI().Register(Tick, &s, &s, &Listener::On);
+            }
+            std::mt19937 rng(1);
+            std::vector<uint32_t> order(65536);
+            for (auto& o : order)
+            {
+                o = rng() % senders.size();
+            }
+            size_t next = 0;
+            suite.Measure("send/4096-senders", 500, 1024, [&](size_t n)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        ESI().Send(Tick, &senders[order[next++ & (order.size() - 1)]], (int)i);
+                    }
+                });
+            suite.Measure("send/unknown-event", 500, 1024, [&](size_t n)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        ESI().Send(Unknown, &senders[0], (int)i);
+                    }
+                });
+            suite.Measure("sendlazy/unknown-event", 500, 1024, [&](size_t n)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        ESI().SendLazy(Unknown, &senders[0], [i]() { return std::string(64, (char)i); });
+                    }
+                });
+            ESI().Clear();
+        }
+
+        //the event has listeners, but none for this sender. with thousands of senders the filter is mostly set,
+        //the lookup decides as before
+        {
+            std::vector<Listener> senders(8);
+            for (auto& s : senders)
+            {
+                ESI().Register(Tick, &s, &s, &Listener::On);
+            }
+            Listener stranger;
+            suite.Measure("send/unknown-sender", 500, 1024, [&](size_t n)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        ESI().Send(Tick, &stranger, (int)i);
+                    }
+                });
+            ESI().Clear();
+        }
+
+        //half the listeners take other arguments, a send passes them by on one compare each. against sendall/wildcard/fanout-8
+        {
+            std::vector<Listener> recvers(8);
+            for (auto& r : recvers)
+            {
+                ESI().Register(Overloaded, nullptr, &r, &Listener::On);
+                ESI().Register(Overloaded, nullptr, &r, &Listener::OnOther);
+            }
+            suite.Measure("sendall/overloaded/fanout-8+8", 500, 512, [&](size_t n)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        ESI().SendAll(Overloaded, (int)i);
+                    }
+                });
+            ESI().Clear();
+        }
+    }
+
+    void CallbackCases(Suite& suite)
+    {
+        std::vector<Listener> recvers(8);
+        for (auto& r : recvers)
+        {
+            ESI().Register(Member, nullptr, &r, &Listener::On);
+            ESI().Register(Lambda, nullptr, [](int x) { DoNotOptimize(x); });
+            ESI().Register(StdFunction, nullptr, std::function<void(int)>([](int x) { DoNotOptimize(x); }));
+            ESI().Register(FreeFunction, nullptr, &OnFree);
+        }
+
+        const std::pair<const char*, EventID> kinds[] = {
+            { "callback/member/fanout-8", Member },
+            { "callback/lambda/fanout-8", Lambda },
+            { "callback/std-function/fanout-8", StdFunction },
+            { "callback/free-function/fanout-8", FreeFunction },
+        };
+        for (const auto& [name, evt] : kinds)
+        {
+            suite.Measure(name, 500, 1024, [&, evt = evt](size_t n)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        ESI().SendAll(evt, (int)i);
+                    }
+                });
+        }
+        ESI().Clear();
+    }
+
+    void BatchCases(Suite& suite)
+    {
+        std::vector<Listener> recvers(8);
+        int sender = 0;
+        for (auto& r : recvers)
+        {
+            ESI().Register(Batch, &sender, &r, &Listener::On);
+        }
+        std::vector<int> payloads(1024);
+
+        //ns/op is per payload here
+        suite.Measure("sendbatch/loop/fanout-8", 200, payloads.size(), [&](size_t)
+            {
+                for (int p : payloads)
+                {
+                    ESI().Send(Batch, &sender, p);
+                }
+            });
+        suite.Measure("sendbatch/event-major/fanout-8", 200, payloads.size(), [&](size_t)
+            {
+                ESI().SendBatch(Batch, &sender, payloads, es::BatchOrder::EventMajor);
+            });
+        suite.Measure("sendbatch/listener-major/fanout-8", 200, payloads.size(), [&](size_t)
+            {
+                ESI().SendBatch(Batch, &sender, payloads, es::BatchOrder::ListenerMajor);
+            });
+        ESI().Clear();
+    }
+
+    //large arguments reach const reference listeners without a copy, SendMove hands a move only one to the last listener
+    void PayloadCases(Suite& suite)
+    {
+        int sender = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            ESI().Register(Payload, &sender, [](const std::string& s) { DoNotOptimize(s.size()); });
+            ESI().Register(Handoff, &sender, [](const std::unique_ptr<int>& p) { DoNotOptimize(*p); });
+        }
+        auto kept = std::make_unique<int>(1);
+        ESI().Register(Handoff, nullptr, [&kept](std::unique_ptr<int> p) { kept = std::move(p); });
+
+        const std::string text(1024, 'x');
+        suite.Measure("payload/string-1k/fanout-4", 500, 1024, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Send(Payload, &sender, text);
+                }
+            });
+        suite.Measure("payload/unique-ptr/sendmove/fanout-5", 500, 1024, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().SendMove(Handoff, &sender, std::move(kept));
+                }
+            });
+        ESI().Clear();
+    }
+
+    struct Quote
+    {
+        int64_t id;
+        double price;
+    };
+
+    //sends against a log in the temp directory, then a replay of one block of them per block
+    void RecordCases(Suite& suite)
+    {
+        int feed = 0;
+        std::vector<Listener> recvers(4);
+        for (auto& r : recvers)
+        {
+            ESI().Register(Recorded, &feed, [&r](int x, const Quote& q) { r.On(x + (int)q.id); });
+        }
+
+        const std::string path = (std::filesystem::temp_directory_path() / "es-bench-record").string();
+        suite.Measure("record/off/fanout-4", 500, 1024, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Send(Recorded, &feed, (int)i, Quote{ (int64_t)i, 1.5 });
+                }
+            });
+
+        es::EventRecorder recorder;
+        if (recorder.Open(path))
+        {
+            ESI().SetRecorder(&recorder);
+            suite.Measure("record/on/fanout-4", 500, 1024, [&](size_t n)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        ESI().Send(Recorded, &feed, (int)i, Quote{ (int64_t)i, 1.5 });
+                    }
+                });
+
+            //one block of sends is the replayed log
+            recorder.Open(path);
+            for (int i = 0; i < 1024; ++i)
+            {
+                ESI().Send(Recorded, &feed, i, Quote{ i, 1.5 });
+            }
+            ESI().SetRecorder(nullptr);
+            recorder.Close();
+
+            es::EventReplayer replayer(ESI());
+            replayer.Open(path);
+            replayer.Bind<int, Quote>(Recorded);
+            replayer.MapSender((uint64_t)(uintptr_t)&feed, &feed);
+            suite.Measure("replay/fanout-4", 500, 1024, [&](size_t)
+                {
+                    DoNotOptimize(replayer.Run().events);
+                });
+        }
+
+        std::error_code ec;
+        for (uint32_t i = 0; std::filesystem::remove(path + "." + std::to_string(i), ec); ++i)
+        {
+        }
+        ESI().Clear();
+    }
+
+    //1000 listeners that each want one job id, filtering in the listener against keyed registrations
+    void KeyedCases(Suite& suite)
+    {
+        constexpr int listeners = 1000;
+        std::vector<Listener> recvers(listeners);
+        for (int i = 0; i < listeners; ++i)
+        {
+            ESI().Register(Keyed, nullptr, [&r = recvers[i], i](const Quote& q) { if (q.id == i) { r.On(i); } });
+        }
+        suite.Measure("filter/in-listener/1000", 200, 64, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Send(Keyed, nullptr, Quote{ (int64_t)(i % listeners), 1.5 });
+                }
+            });
+        ESI().Clear();
+
+        for (int i = 0; i < listeners; ++i)
+        {
+            ESI().Register(Keyed, nullptr, &Quote::id, (int64_t)i, [&r = recvers[i], i](const Quote&) { r.On(i); });
+        }
+        suite.Measure("filter/keyed/1000", 500, 1024, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Send(Keyed, nullptr, Quote{ (int64_t)(i % listeners), 1.5 });
+                }
+            });
+        ESI().Clear();
+    }
+
+    //the same four listeners called by hand, by the static bus and by the dynamic bus
+    void StaticCases(Suite& suite)
+    {
+        std::vector<Listener> recvers(4);
+        StaticListener<0> l0{ &recvers[0] };
+        StaticListener<1> l1{ &recvers[1] };
+        StaticListener<2> l2{ &recvers[2] };
+        StaticListener<3> l3{ &recvers[3] };
+        es::StaticEventBus<es::StaticEvent<Static, StaticListener<0>, StaticListener<1>, StaticListener<2>, StaticListener<3>>> bus(l0, l1, l2, l3);
+        ESI().Register(Static, nullptr, l0);
+        ESI().Register(Static, nullptr, l1);
+        ESI().Register(Static, nullptr, l2);
+        ESI().Register(Static, nullptr, l3);
+
+        suite.Measure("static/direct/fanout-4", 500, 1024, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    l0((int)i);
+                    l1((int)i);
+                    l2((int)i);
+                    l3((int)i);
+                }
+            });
+        suite.Measure("static/bus/fanout-4", 500, 1024, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    bus.SendAll<Static>((int)i);
+                }
+            });
+        suite.Measure("static/dynamic/fanout-4", 500, 1024, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().SendAll(Static, (int)i);
+                }
+            });
+        ESI().Clear();
+    }
+
+    //two buses of this process on one region, a send on one and a Poll on the other per block, so ns/op is
+    //publish, receive and the listener calls, without the wake up of another process
+    void SharedCases(Suite& suite)
+    {
+        const std::string name = "es-bench-" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()) & 0xffffff);
+        es::SharedRing::Unlink(name);
+        es::EventSystem remote;
+        es::ShmTransport local(ESI());
+        es::ShmTransport far(remote);
+        if (!local.Attach(name) || !far.Attach(name))
+        {
+            es::SharedRing::Unlink(name);
+            return;
+        }
+
+        int feed = 0;
+        std::vector<Listener> recvers(4);
+        for (auto& r : recvers)
+        {
+            ESI().Register(Shared, &feed, [&r](int x, const Quote& q) { r.On(x + (int)q.id); });
+        }
+        suite.Measure("shm/not-subscribed/fanout-4", 500, 1024, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Send(Shared, &feed, (int)i, Quote{ (int64_t)i, 1.5 });
+                }
+            });
+
+        int remoteFeed = 0;
+        for (auto& r : recvers)
+        {
+            remote.Register(Shared, &remoteFeed, [&r](int x, const Quote& q) { r.On(x + (int)q.id); });
+        }
+        local.NameSender(&feed, 1);
+        far.MapSender(1, &remoteFeed);
+        far.Subscribe<int, Quote>(Shared);
+        suite.Measure("shm/publish+poll/fanout-4", 500, 1024, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Send(Shared, &feed, (int)i, Quote{ (int64_t)i, 1.5 });
+                }
+                DoNotOptimize(far.Poll());
+            });
+
+        far.Detach();
+        local.Detach();
+        es::SharedRing::Unlink(name);
+        ESI().Clear();
+    }
+
+    void CoalesceCases(Suite& suite)
+    {
+        std::vector<Listener> recvers(8);
+        std::vector<int> senders(16);
+        for (auto& r : recvers)
+        {
+            ESI().Register(Coalesced, nullptr, &r, &Listener::On);
+        }
+
+        //64 updates per sender per frame, ns/op is per update
+        suite.Measure("coalesce/off/16-senders/fanout-8", 200, 64 * senders.size(), [&](size_t)
+            {
+                for (int i = 0; i < 64; ++i)
+                {
+                    for (int& sender : senders)
+                    {
+                        ESI().Send(Coalesced, &sender, i);
+                    }
+                }
+            });
+        ESI().SetCoalesce(Coalesced);
+        suite.Measure("coalesce/latest/16-senders/fanout-8", 200, 64 * senders.size(), [&](size_t)
+            {
+                for (int i = 0; i < 64; ++i)
+                {
+                    for (int& sender : senders)
+                    {
+                        ESI().Send(Coalesced, &sender, i);
+                    }
+                }
+                ESI().Flush();
+            });
+        ESI().SetCoalesce(Coalesced, [](int& pending, int incoming) { pending += incoming; });
+        suite.Measure("coalesce/reduce/16-senders/fanout-8", 200, 64 * senders.size(), [&](size_t)
+            {
+                for (int i = 0; i < 64; ++i)
+                {
+                    for (int& sender : senders)
+                    {
+                        ESI().Send(Coalesced, &sender, i);
+                    }
+                }
+                ESI().Flush();
+            });
+        ESI().StopCoalesce(Coalesced);
+        ESI().Clear();
+    }
+
+    /// <summary>
+    /// a listener that replaces its registration every time it runs, like a co_await that waits again,
+    /// optionally sending a nested event from inside the callback
+    /// </summary>
+    struct Rearming
+    {
+        void Arm()
+        {
+            handle = ESI().Register(Rearm, sender, this, &Rearming::On);
+        }
+
+        void On(int x)
+        {
+            ESI().Unregister(handle);
+            Arm();
+            if (nested)
+            {
+                ESI().Send(Nested, sender, x);
+            }
+        }
+
+        const void* sender = nullptr;
+        EventSystem::CallBackHandle handle = 0;
+        bool nested = false;
+    };
+
+    void ReentrantCases(Suite& suite)
+    {
+        int sender = 0;
+        std::vector<Rearming> recvers(8);
+        std::vector<Listener> others(8);
+        for (size_t i = 0; i < recvers.size(); ++i)
+        {
+            recvers[i].sender = &sender;
+            recvers[i].Arm();
+            ESI().Register(Rearm, &sender, &others[i], &Listener::On);
+            ESI().Register(Nested, &sender, &others[i], &Listener::On);
+        }
+
+        suite.Measure("reentrant/rearm/fanout-16", 500, 256, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Send(Rearm, &sender, (int)i);
+                }
+            });
+
+        for (auto& r : recvers)
+        {
+            r.nested = true;
+        }
+        suite.Measure("reentrant/rearm+nested-send/fanout-16", 500, 256, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Send(Rearm, &sender, (int)i);
+                }
+            });
+        ESI().Clear();
+    }
+
+    void UnregisterCases(Suite& suite)
+    {
+        const size_t scale = 100000;
+        const size_t block = 1000;
+        std::vector<Listener> recvers(scale);
+        std::vector<es::EventSystem::CallBackHandle> handles;
+        size_t next = 0;
+        int sender = 0;
+        auto fill = [&]()
+            {
+                ESI().Clear();
+                handles.clear();
+                for (auto& r : recvers)
+                {
+                    handles.push_back(ESI().Register(Churn, &sender, &r, &Listener::On));
+                }
+                std::shuffle(handles.begin(), handles.end(), std::mt19937(7));
+                next = 0;
+            };
+
+        //removes from a table of 100k listeners, refilled once half of it is gone
+        fill();
+        suite.Measure("unregister/handle/100k", 200, block, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Unregister(handles[next++]);
+                }
+            }, [&]()
+            {
+                if (next + block > scale / 2)
+                {
+                    fill();
+                }
+            });
+
+        fill();
+        suite.Measure("unregister/object/100k", 200, block, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Unregister((const void*)&recvers[next++]);
+                }
+            }, [&]()
+            {
+                if (next + block > scale / 2)
+                {
+                    fill();
+                }
+            });
+        ESI().Clear();
+    }
+
+    void PostCases(Suite& suite)
+    {
+        std::vector<Listener> recvers(4);
+        for (auto& r : recvers)
+        {
+            ESI().Register(Posted, nullptr, &r, &Listener::On);
+        }
+        suite.Measure("post+pump/fanout-4", 500, 1024, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().PostAll(Posted, (int)i);
+                }
+                ESI().Pump();
+            });
+        ESI().Clear();
+    }
+
+    void TimerCases(Suite& suite)
+    {
+        std::vector<Listener> recvers(4);
+        for (auto& r : recvers)
+        {
+            ESI().Register(Timed, nullptr, &r, &Listener::On);
+        }
+        ESI().SetManualTimers(true);
+        std::vector<EventSystem::TimerHandle> handles(1024);
+
+        //timeouts that almost never fire: scheduled over a minute and cancelled, ns/op is per schedule and cancel
+        suite.Measure("timer/schedule+cancel", 500, handles.size(), [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    handles[i] = ESI().SendAfter(std::chrono::milliseconds(1 + i * 61 % 60000), Timed, nullptr, (int)i);
+                }
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().CancelTimer(handles[i]);
+                }
+            });
+        //ns/op is per send scheduled and delivered by one Tick
+        suite.Measure("timer/tick/fanout-4", 500, handles.size(), [&](size_t n)
+            {
+                const auto now = Clock::now();
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().SendAt(now, Timed, nullptr, (int)i);
+                }
+                ESI().Tick(now);
+            });
+        ESI().SetManualTimers(false);
+        ESI().Clear();
+    }
+
+    void ThreadCases(Suite& suite)
+    {
+        std::vector<Listener> recvers(8);
+        for (auto& r : recvers)
+        {
+            ESI().Register(Wildcard, nullptr, &r, &Listener::On);
+        }
+        ESI().SetThreadSafe(true);
+
+        std::vector<size_t> producerCounts{ 1, 2, 4 };
+        if (const size_t hw = std::thread::hardware_concurrency(); hw > 4)
+        {
+            producerCounts.push_back(hw);
+        }
+        for (size_t producers : producerCounts)
+        {
+            suite.MeasureThreads("threads/sendall/fanout-8/producers-" + std::to_string(producers), producers, 200, 1024, [](size_t, size_t n)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        ESI().SendAll(Wildcard, (int)i);
+                    }
+                });
+
+            //each producer on its own thread local bus, nothing shared and no locks
+            suite.MeasureThreads("threads/local-bus/fanout-8/producers-" + std::to_string(producers), producers, 200, 1024, [&recvers](size_t, size_t n)
+                {
+                    EventSystem& bus = ESL();
+                    thread_local bool registered = false;
+                    if (!registered)
+                    {
+                        for (auto& r : recvers)
+                        {
+                            bus.Register(Wildcard, nullptr, &r, &Listener::On);
+                        }
+                        registered = true;
+                    }
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        bus.SendAll(Wildcard, (int)i);
+                    }
+                });
+        }
+
+        //RegisterOn listeners: called in place on the owner thread, queued and drained from anywhere else
+        es::Mailbox owned;
+        es::Mailbox remote(std::thread().get_id(), 8192);
+        for (auto& r : recvers)
+        {
+            ESI().RegisterOn(owned, Affine, &owned, &r, &Listener::On);
+            ESI().RegisterOn(remote, Affine, &remote, &r, &Listener::On);
+        }
+        suite.Measure("threads/mailbox/owner/fanout-8", 500, 1024, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Send(Affine, &owned, (int)i);
+                }
+            });
+        suite.Measure("threads/mailbox/queued+drain/fanout-8", 500, 1024, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ESI().Send(Affine, &remote, (int)i);
+                }
+                remote.Drain();
+            });
+
+        ESI().Clear();
+        ESI().SetThreadSafe(false);
+    }
+
+    Options ParseOptions(int argc, char** argv)
+    {
+        Options options;
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string_view arg = argv[i];
+            if (arg.starts_with("--format="))
+            {
+                options.format = arg.substr(9);
+            }
+            else if (arg.starts_with("--filter="))
+            {
+                options.filter = arg.substr(9);
+            }
+            else if (arg == "--quick")
+            {
+                options.quick = true;
+            }
+            else
+            {
+                std::fprintf(stderr, "usage: %s [--format=table|json|csv] [--filter=text] [--quick]\n", argv[0]);
+                std::exit(2);
+            }
+        }
+
+        if (options.format != "table" && options.format != "json" && options.format != "csv")
+        {
+            std::fprintf(stderr, "unknown format %s\n", options.format.c_str());
+            std::exit(2);
+        }
+        return options;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Suite suite(ParseOptions(argc, argv));
+    RegisterCases(suite);
+    SendCases(suite);
+    CallbackCases(suite);
+    BatchCases(suite);
+    CoalesceCases(suite);
+    PayloadCases(suite);
+    ReentrantCases(suite);
+    RecordCases(suite);
+    SharedCases(suite);
+    KeyedCases(suite);
+    StaticCases(suite);
+    UnregisterCases(suite);
+    PostCases(suite);
+    TimerCases(suite);
+    ThreadCases(suite);
+    suite.Print();
+    return 0;
+}
@@ -0,0 +1,218 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+namespace es
+{
+    template <typename Signature>
+    class Delegate;
+
+    /// <summary>
+    /// type erased callable like std::function, but with inline storage big enough for
+    /// a member function pointer plus the receiver pointer, so the usual listeners never allocate.
+    /// calling it is one indirect call into a thunk which has the target inlined.
+    /// callables that are too big, over aligned or may throw on move are kept on the heap
+    /// </summary>
+    template <typename R, typename... Args>
+    class Delegate<R(Args...)>
+    {
+        struct MemberFnProbe
+        {
+            void Fn();
+        };
+
+    public:
+        static constexpr size_t inlineSize = sizeof(void (MemberFnProbe::*)()) + sizeof(void*);
+        static constexpr size_t inlineAlign = alignof(void*);
+
+        template <typename F>
+        static constexpr bool fitsInline = sizeof(F) <= inlineSize && alignof(F) <= inlineAlign
+            && std::is_nothrow_move_constructible_v<F>;
+
+        Delegate() = default;
+
+        template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Delegate>>>
+        Delegate(F&& f)
+        {
+            Emplace(std::forward<F>(f));
+        }
+
+        Delegate(const Delegate& other)
+        {
+            CopyFrom(other);
+        }
+
+        Delegate(Delegate&& other) noexcept
+        {
+            MoveFrom(other);
+        }
+
+        Delegate& operator=(const Delegate& other)
+        {
+            if (this != &other)
+            {
+                Reset();
+                CopyFrom(other);
+            }
+            return *this;
+        }
+
+        Delegate& operator=(Delegate&& other) noexcept
+        {
+            if (this != &other)
+            {
+                Reset();
+                MoveFrom(other);
+            }
+            return *this;
+        }
+
+        ~Delegate()
+        {
+            Reset();
+        }
+
+        R operator()(Args... args) const
+        {
+            return _invoke(const_cast<void*>(static_cast<const void*>(_storage)), std::forward<Args>(args)...);
+        }
+
+        explicit operator bool() const
+        {
+            return _invoke != nullptr;
+        }
+
+        /// <summary>
+        /// true if the callable lives in the delegate itself, not on the heap
+        /// </summary>
+        [[nodiscard]] bool IsInline() const
+        {
+            return _ops == nullptr || !_ops->heap;
+        }
+
+        [[nodiscard]] size_t HeapSize() const
+        {
+            return _ops != nullptr ? _ops->heapSize : 0;
+        }
+
+        void Reset()
+        {
+            if (_ops != nullptr)
+            {
+                _ops->destroy(_storage);
+            }
+            _invoke = nullptr;
+            _ops = nullptr;
+        }
+
+    private:
+        using Invoker = R(*)(void*, Args&&...);
+
+        //lifetime management, null when the callable is trivially copyable and inline so copies are a memcpy
+        struct Ops
+        {
+            void (*copy)(void* dst, const void* src);
+            void (*move)(void* dst, void* src);
+            void (*destroy)(void* p);
+            bool heap;
+            size_t heapSize;    //bytes of the heap block, 0 inline
+        };
+
+        template <typename F>
+        struct InlineModel
+        {
+            static R Invoke(void* p, Args&&... args)
+            {
+                return (*static_cast<F*>(p))(std::forward<Args>(args)...);
+            }
+
+            static void Copy(void* dst, const void* src) { ::new (dst) F(*static_cast<const F*>(src)); }
+            static void Move(void* dst, void* src)
+            {
+                ::new (dst) F(std::move(*static_cast<F*>(src)));
+                static_cast<F*>(src)->~F();
+            }
+            static void Destroy(void* p) { static_cast<F*>(p)->~F(); }
+
+            static constexpr Ops ops{ &Copy, &Move, &Destroy, false, 0 };
+        };
+
+        template <typename F>
+        struct HeapModel
+        {
+            static F*& Target(void* p) { return *static_cast<F**>(p); }
+
+            static R Invoke(void* p, Args&&... args)
+            {
+                return (*Target(p))(std::forward<Args>(args)...);
+            }
+
+            static void Copy(void* dst, const void* src) { ::new (dst) F*(new F(**static_cast<F* const*>(src))); }
+            static void Move(void* dst, void* src) { ::new (dst) F*(Target(src)); }
+            static void Destroy(void* p) { delete Target(p); }
+
+            static constexpr Ops ops{ &Copy, &Move, &Destroy, true, sizeof(F) };
+        };
+
+        template <typename F>
+        void Emplace(F&& f)
+        {
+            using Fn = std::decay_t<F>;
+            static_assert(std::is_copy_constructible_v<Fn>, "listener callables are copied like std::function");
+            if constexpr (fitsInline<Fn>)
+            {
+                ::new (static_cast<void*>(_storage)) Fn(std::forward<F>(f));
+                _invoke = &InlineModel<Fn>::Invoke;
+                if constexpr (!std::is_trivially_copyable_v<Fn>)
+                {
+                    _ops = &InlineModel<Fn>::ops;
+                }
+            }
+            else
+            {
+                ::new (static_cast<void*>(_storage)) Fn*(new Fn(std::forward<F>(f)));
+                _invoke = &HeapModel<Fn>::Invoke;
+                _ops = &HeapModel<Fn>::ops;
+            }
+        }
+
+        void CopyFrom(const Delegate& other)
+        {
+            if (other._ops != nullptr)
+            {
+                other._ops->copy(_storage, other._storage);
+            }
+            else
+            {
+                std::memcpy(_storage, other._storage, inlineSize);
+            }
+            _invoke = other._invoke;
+            _ops = other._ops;
+        }
+
+        void MoveFrom(Delegate& other) noexcept
+        {
+            if (other._ops != nullptr)
+            {
+                other._ops->move(_storage, other._storage);
+            }
+            else
+            {
+                std::memcpy(_storage, other._storage, inlineSize);
+            }
+            _invoke = other._invoke;
+            _ops = other._ops;
+            other._invoke = nullptr;
+            other._ops = nullptr;
+        }
+
+        alignas(inlineAlign) unsigned char _storage[inlineSize];
+        Invoker _invoke = nullptr;
+        const Ops* _ops = nullptr;
+    };
+}
@@ -0,0 +1,265 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace es
+{
+    /// <summary>
+    /// process wide epoch based reclamation. readers pin the current epoch in a per thread slot
+    /// without taking any lock, writers unlink an object, retire it, and it is freed
+    /// once no reader that could still see it is active.
+    /// guards nest, only the outermost one of a thread touches its slot
+    /// </summary>
+    class EpochReclaimer
+    {
+        static constexpr size_t maxThreads = 256;
+        static constexpr uint64_t idle = 0;
+
+        struct alignas(64) Slot
+        {
+            std::atomic<uint64_t> epoch{ idle };
+            std::atomic<bool> owned{ false };
+        };
+
+        struct ThreadState
+        {
+            Slot* slot = nullptr;
+            uint32_t depth = 0;
+            bool overflow = false;
+
+            ~ThreadState()
+            {
+                if (slot != nullptr)
+                {
+                    slot->epoch.store(idle, std::memory_order_release);
+                    slot->owned.store(false, std::memory_order_release);
+                }
+            }
+        };
+
+        struct Retired
+        {
+            void* p;
+            void (*deleter)(void*);
+            uint64_t epoch;
+        };
+
+        //whatever is still retired at process exit is freed, no reader is left by then
+        struct RetiredList
+        {
+            std::vector<Retired> items;
+
+            ~RetiredList()
+            {
+                for (auto& r : items)
+                {
+                    r.deleter(r.p);
+                }
+            }
+        };
+
+    public:
+        class ReadGuard
+        {
+        public:
+            ReadGuard() { Enter(); }
+            ~ReadGuard() { Leave(); }
+            ReadGuard(const ReadGuard&) = delete;
+            void operator=(const ReadGuard&) = delete;
+        };
+
+        /// <summary>
+        /// keeps whatever the current thread can see alive after its ReadGuard ends, and may be released on any thread.
+        /// must be taken inside a ReadGuard
+        /// </summary>
+        class Pin
+        {
+        public:
+            Pin()
+            {
+                const ThreadState& st = State();
+                const uint64_t epoch = st.slot != nullptr && !st.overflow ? st.slot->epoch.load(std::memory_order_relaxed) : idle;
+                if (epoch != idle)
+                {
+                    _slot = Acquire();
+                }
+
+                if (_slot != nullptr)
+                {
+                    _slot->epoch.store(epoch, std::memory_order_relaxed);
+                }
+                else
+                {
+                    _overflowReaders.fetch_add(1, std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+
+            ~Pin()
+            {
+                if (_slot != nullptr)
+                {
+                    _slot->epoch.store(idle, std::memory_order_release);
+                    _slot->owned.store(false, std::memory_order_release);
+                }
+                else
+                {
+                    _overflowReaders.fetch_sub(1, std::memory_order_release);
+                }
+            }
+
+            Pin(const Pin&) = delete;
+            void operator=(const Pin&) = delete;
+
+        private:
+            Slot* _slot = nullptr;
+        };
+
+        template <typename T>
+        static void Retire(T* p)
+        {
+            if (p != nullptr)
+            {
+                Retire(p, [](void* v) { delete static_cast<T*>(v); });
+            }
+        }
+
+        /// <summary>
+        /// p must already be unreachable for new readers
+        /// </summary>
+        static void Retire(void* p, void (*deleter)(void*))
+        {
+            std::lock_guard lock(_lock);
+            _retired.items.push_back(Retired{ p, deleter, _epoch.fetch_add(1) });
+            CollectLocked();
+        }
+
+        /// <summary>
+        /// free whatever is no longer visible to any reader
+        /// </summary>
+        static void Collect()
+        {
+            std::lock_guard lock(_lock);
+            CollectLocked();
+        }
+
+    private:
+        static Slot* Slots()
+        {
+            static Slot slots[maxThreads];
+            return slots;
+        }
+
+        static ThreadState& State()
+        {
+            thread_local ThreadState state;
+            return state;
+        }
+
+        static Slot* Acquire()
+        {
+            for (size_t i = 0; i < maxThreads; ++i)
+            {
+                bool expected = false;
+                if (!Slots()[i].owned.load(std::memory_order_relaxed)
+                    && Slots()[i].owned.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+                {
+                    size_t used = _slotsUsed.load(std::memory_order_relaxed);
+                    while (used < i + 1 && !_slotsUsed.compare_exchange_weak(used, i + 1, std::memory_order_acq_rel))
+                    {
+                    }
+                    return &Slots()[i];
+                }
+            }
+            return nullptr;
+        }
+
+        static void Enter()
+        {
+            ThreadState& st = State();
+            if (st.depth++ > 0)
+            {
+                return;
+            }
+
+            if (st.slot == nullptr)
+            {
+                st.slot = Acquire();
+            }
+
+            if (st.slot != nullptr)
+            {
+                st.slot->epoch.store(_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+            }
+            else
+            {
+                //more threads than slots, these readers hold back every reclamation while active
+                st.overflow = true;
+                _overflowReaders.fetch_add(1, std::memory_order_relaxed);
+            }
+            //the pinned epoch must be visible before any shared pointer is loaded
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        static void Leave()
+        {
+            ThreadState& st = State();
+            if (--st.depth > 0)
+            {
+                return;
+            }
+
+            if (st.overflow)
+            {
+                st.overflow = false;
+                _overflowReaders.fetch_sub(1, std::memory_order_release);
+            }
+            else
+            {
+                st.slot->epoch.store(idle, std::memory_order_release);
+            }
+        }
+
+        static void CollectLocked()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_overflowReaders.load(std::memory_order_acquire) > 0)
+            {
+                return;
+            }
+
+            uint64_t oldest = UINT64_MAX;
+            const size_t used = _slotsUsed.load(std::memory_order_acquire);
+            for (size_t i = 0; i < used; ++i)
+            {
+                const uint64_t e = Slots()[i].epoch.load(std::memory_order_acquire);
+                if (e != idle && e < oldest)
+                {
+                    oldest = e;
+                }
+            }
+
+            //readers pinned at an epoch after the retirement can not have seen the object
+            std::erase_if(_retired.items, [oldest](const Retired& r)
+                {
+                    if (r.epoch < oldest)
+                    {
+                        r.deleter(r.p);
+                        return true;
+                    }
+                    return false;
+                });
+        }
+
+        inline static std::atomic<size_t> _slotsUsed{ 0 };
+        inline static std::atomic<uint32_t> _overflowReaders{ 0 };
+        inline static std::atomic<uint64_t> _epoch{ 1 };
+        inline static std::mutex _lock;
+        inline static RetiredList _retired;
+    };
+}
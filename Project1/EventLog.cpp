@@ -0,0 +1,534 @@
+//(C) benyuan 2024
+//all rights reserved
+#include "EventLog.hpp"
+#include "EventReplay.hpp"
+#include <algorithm>
+#include <array>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace es
+{
+    namespace
+    {
+        /// <summary>
+        /// a file mapped whole into memory, created at a fixed size for writing or mapped as it is for reading
+        /// </summary>
+        class MappedFile
+        {
+        public:
+            MappedFile() = default;
+            MappedFile(const MappedFile&) = delete;
+            void operator=(const MappedFile&) = delete;
+
+            ~MappedFile()
+            {
+                Close(_size);
+            }
+
+            bool Create(const std::string& path, size_t size)
+            {
+#ifdef _WIN32
+                _file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+                if (_file == INVALID_HANDLE_VALUE)
+                {
+                    return false;
+                }
+                _mapping = CreateFileMappingA(_file, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr);
+                _data = _mapping != nullptr ? static_cast<std::byte*>(MapViewOfFile(_mapping, FILE_MAP_WRITE, 0, 0, size)) : nullptr;
+#else
+                _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+                if (_fd < 0 || ::ftruncate(_fd, (off_t)size) != 0)
+                {
+                    return Fail();
+                }
+                void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+                _data = p != MAP_FAILED ? static_cast<std::byte*>(p) : nullptr;
+#endif
+                _size = size;
+                _writable = true;
+                return _data != nullptr || Fail();
+            }
+
+            bool OpenRead(const std::string& path)
+            {
+#ifdef _WIN32
+                _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+                LARGE_INTEGER size{};
+                if (_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(_file, &size) || size.QuadPart == 0)
+                {
+                    return Fail();
+                }
+                _size = (size_t)size.QuadPart;
+                _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                _data = _mapping != nullptr ? static_cast<std::byte*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+                _fd = ::open(path.c_str(), O_RDONLY);
+                struct stat st{};
+                if (_fd < 0 || ::fstat(_fd, &st) != 0 || st.st_size == 0)
+                {
+                    return Fail();
+                }
+                _size = (size_t)st.st_size;
+                void* p = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, _fd, 0);
+                _data = p != MAP_FAILED ? static_cast<std::byte*>(p) : nullptr;
+#ifdef MADV_SEQUENTIAL
+                if (_data != nullptr)
+                {
+                    ::madvise(p, _size, MADV_SEQUENTIAL);
+                }
+#endif
+#endif
+                return _data != nullptr || Fail();
+            }
+
+            /// <summary>
+            /// unmap, and cut a written file to keep bytes
+            /// </summary>
+            void Close(size_t keep)
+            {
+#ifdef _WIN32
+                if (_data != nullptr)
+                {
+                    UnmapViewOfFile(_data);
+                }
+                if (_mapping != nullptr)
+                {
+                    CloseHandle(_mapping);
+                }
+                if (_file != INVALID_HANDLE_VALUE)
+                {
+                    LARGE_INTEGER end{};
+                    end.QuadPart = (LONGLONG)keep;
+                    if (_writable && _data != nullptr && keep < _size && SetFilePointerEx(_file, end, nullptr, FILE_BEGIN))
+                    {
+                        SetEndOfFile(_file);
+                    }
+                    CloseHandle(_file);
+                }
+                _mapping = nullptr;
+                _file = INVALID_HANDLE_VALUE;
+#else
+                if (_data != nullptr)
+                {
+                    ::munmap(_data, _size);
+                    if (_writable && keep < _size && ::ftruncate(_fd, (off_t)keep) != 0)
+                    {
+                        //the tail stays zero filled, a reader stops at it all the same
+                    }
+                }
+                if (_fd >= 0)
+                {
+                    ::close(_fd);
+                }
+                _fd = -1;
+#endif
+                _data = nullptr;
+                _size = 0;
+            }
+
+            [[nodiscard]] std::byte* Data() const { return _data; }
+            [[nodiscard]] size_t Size() const { return _size; }
+
+        private:
+            bool Fail()
+            {
+                Close(_size);
+                return false;
+            }
+
+#ifdef _WIN32
+            HANDLE _file = INVALID_HANDLE_VALUE;
+            HANDLE _mapping = nullptr;
+#else
+            int _fd = -1;
+#endif
+            std::byte* _data = nullptr;
+            size_t _size = 0;
+            bool _writable = false;
+        };
+
+        std::string SegmentPath(const std::string& path, uint32_t index)
+        {
+            return path + "." + std::to_string(index);
+        }
+
+        bool ValidHeader(const MappedFile& file)
+        {
+            if (file.Size() < sizeof(LogSegmentHeader))
+            {
+                return false;
+            }
+            const auto* h = reinterpret_cast<const LogSegmentHeader*>(file.Data());
+            return h->fileMagic == LogSegmentHeader::magic && h->fileVersion == LogSegmentHeader::version
+                && h->toolchain == ToolchainSignature();
+        }
+    }
+
+    uint64_t ToolchainSignature()
+    {
+        static const uint64_t signature = []()
+            {
+#if defined(_MSC_VER) && !defined(__clang__)
+                std::string name = "msvc " + std::to_string(_MSC_FULL_VER);
+#else
+                std::string name = __VERSION__;
+#endif
+#if defined(_LIBCPP_VERSION)
+                name += ", libc++ " + std::to_string(_LIBCPP_VERSION);
+#elif defined(__GLIBCXX__)
+                name += ", libstdc++ " + std::to_string(__GLIBCXX__);
+#elif defined(_MSVC_STL_VERSION)
+                name += ", msvc stl " + std::to_string(_MSVC_STL_VERSION);
+#endif
+                //type names also depend on the library ABI, std::string of the old gcc ABI is named differently
+                name += ", " + std::to_string(sizeof(void*)) + ", " + std::to_string(LogSignature<int, double, std::string, std::vector<int>>());
+                uint64_t h = 0xcbf29ce484222325ull;
+                for (const char c : name)
+                {
+                    h = (h ^ (uint8_t)c) * 0x100000001b3ull;
+                }
+                return h;
+            }();
+        return signature;
+    }
+
+    struct EventRecorder::Segment
+    {
+        MappedFile file;
+        uint32_t index = 0;
+        std::atomic<size_t> used{ sizeof(LogSegmentHeader) };
+        std::chrono::steady_clock::time_point start;
+
+        [[nodiscard]] size_t Written() const
+        {
+            return std::min(used.load(std::memory_order_relaxed), file.Size());
+        }
+
+        //no thread writes to it any more, the tick rate is measured over the whole log so far
+        static void Unmap(void* p)
+        {
+            Segment* seg = static_cast<Segment*>(p);
+            auto* h = reinterpret_cast<LogSegmentHeader*>(seg->file.Data());
+            const uint64_t ticks = MetricsRecorder::Now() - h->startTicks;
+            const auto elapsed = std::chrono::steady_clock::now() - seg->start;
+            if (ticks > 0 && elapsed >= std::chrono::milliseconds(1))
+            {
+                h->nsPerTick = std::chrono::duration<double, std::nano>(elapsed).count() / (double)ticks;
+            }
+            seg->file.Close(seg->Written());
+            delete seg;
+        }
+    };
+
+    EventRecorder::~EventRecorder()
+    {
+        Close();
+        //a thread may still be inside Record with this recorder, free its segment before the recorder goes
+        EpochReclaimer::Collect();
+    }
+
+    bool EventRecorder::Open(const std::string& path, size_t segmentBytes)
+    {
+        Close();
+        std::lock_guard lock(_lock);
+        _path = path;
+        _segmentBytes = std::max(segmentBytes, sizeof(LogSegmentHeader) + sizeof(LogRecordHeader) + 64);
+        _start = std::chrono::steady_clock::now();
+        _startTicks = MetricsRecorder::Now();
+        _closedBytes = 0;
+
+        //a first tick rate for the header, a segment measures it again when it is done
+        auto elapsed = std::chrono::steady_clock::now() - _start;
+        while (elapsed < std::chrono::milliseconds(1) || MetricsRecorder::Now() == _startTicks)
+        {
+            std::this_thread::yield();
+            elapsed = std::chrono::steady_clock::now() - _start;
+        }
+        _nsPerTick = std::chrono::duration<double, std::nano>(elapsed).count() / (double)(MetricsRecorder::Now() - _startTicks);
+
+        Segment* seg = NextSegment(0);
+        if (seg == nullptr)
+        {
+            return false;
+        }
+        _current.store(seg, std::memory_order_release);
+        for (auto& [sender, id] : _names)
+        {
+            WriteName(sender, id);
+        }
+        return true;
+    }
+
+    void EventRecorder::Close()
+    {
+        std::lock_guard lock(_lock);
+        if (Segment* seg = _current.exchange(nullptr, std::memory_order_acq_rel); seg != nullptr)
+        {
+            _closedBytes += seg->Written();
+            EpochReclaimer::Retire(seg, &Segment::Unmap);
+        }
+    }
+
+    void EventRecorder::NameSender(const void* sender, uint64_t id)
+    {
+        std::lock_guard lock(_lock);
+        auto it = std::find_if(_names.begin(), _names.end(), [sender](const auto& n) { return n.first == sender; });
+        if (it != _names.end())
+        {
+            it->second = id;
+        }
+        else
+        {
+            _names.emplace_back(sender, id);
+        }
+        if (_current.load(std::memory_order_relaxed) != nullptr)
+        {
+            WriteName(sender, id);
+        }
+    }
+
+    RecorderStats EventRecorder::Stats() const
+    {
+        RecorderStats stats;
+        stats.records = _records.load(std::memory_order_relaxed);
+        {
+            std::lock_guard lock(_lock);
+            const Segment* seg = _current.load(std::memory_order_relaxed);
+            stats.bytes = _closedBytes + (seg != nullptr ? seg->Written() : 0);
+        }
+        stats.segments = _segments.load(std::memory_order_relaxed);
+        stats.unrecordable = _unrecordable.load(std::memory_order_relaxed);
+        stats.dropped = _dropped.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void EventRecorder::WriteName(const void* sender, uint64_t id)
+    {
+        EpochReclaimer::ReadGuard guard;
+        if (LogRecordHeader* h = Reserve(LogRecordKind::SenderName, 0, sender, 0, id, 0); h != nullptr)
+        {
+            Commit(h, 0);
+        }
+    }
+
+    EventRecorder::Segment* EventRecorder::NextSegment(uint32_t index)
+    {
+        auto seg = std::make_unique<Segment>();
+        seg->index = index;
+        seg->start = _start;
+        if (!seg->file.Create(SegmentPath(_path, index), _segmentBytes))
+        {
+            return nullptr;
+        }
+
+        auto* h = reinterpret_cast<LogSegmentHeader*>(seg->file.Data());
+        h->fileMagic = LogSegmentHeader::magic;
+        h->fileVersion = LogSegmentHeader::version;
+        h->index = index;
+        h->openedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+            - std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+        h->startTicks = _startTicks;
+        h->nsPerTick = _nsPerTick;
+        h->toolchain = ToolchainSignature();
+        _segments.fetch_add(1, std::memory_order_relaxed);
+        return seg.release();
+    }
+
+    bool EventRecorder::Rotate(Segment* full)
+    {
+        std::lock_guard lock(_lock);
+        if (_current.load(std::memory_order_relaxed) != full)
+        {
+            //another thread rotated already, or the log was closed
+            return _current.load(std::memory_order_relaxed) != nullptr;
+        }
+
+        Segment* next = NextSegment(full->index + 1);
+        _current.store(next, std::memory_order_release);
+        _closedBytes += full->Written();
+        EpochReclaimer::Retire(full, &Segment::Unmap);
+        return next != nullptr;
+    }
+
+    LogRecordHeader* EventRecorder::Reserve(LogRecordKind kind, int evt, const void* sender, uint16_t argCount, uint64_t signature, size_t payload)
+    {
+        const uint32_t size = RecordSize(payload);
+        for (;;)
+        {
+            Segment* seg = _current.load(std::memory_order_acquire);
+            if (seg == nullptr || size > _segmentBytes - sizeof(LogSegmentHeader))
+            {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            //past the end, the space is given up and the segment is done, no later reservation fits either
+            const size_t at = seg->used.fetch_add(size, std::memory_order_relaxed);
+            if (at + size > seg->file.Size())
+            {
+                if (!Rotate(seg))
+                {
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+                continue;
+            }
+
+            auto* h = reinterpret_cast<LogRecordHeader*>(seg->file.Data() + at);
+            h->kind = kind;
+            h->argCount = argCount;
+            h->evt = evt;
+            h->reserved = 0;
+            h->sender = (uint64_t)(uintptr_t)sender;
+            h->ticks = MetricsRecorder::Now();
+            h->signature = signature;
+            return h;
+        }
+    }
+
+    struct EventReplayer::Segment
+    {
+        MappedFile file;
+    };
+
+    EventReplayer::EventReplayer(EventSystem& es)
+        : _es(es)
+    {
+    }
+
+    EventReplayer::~EventReplayer() = default;
+
+    bool EventReplayer::Open(const std::string& path)
+    {
+        _segments.clear();
+        for (uint32_t index = 0;; ++index)
+        {
+            auto seg = std::make_unique<Segment>();
+            if (!seg->file.OpenRead(SegmentPath(path, index)) || !ValidHeader(seg->file))
+            {
+                break;
+            }
+            _segments.push_back(std::move(seg));
+        }
+        return !_segments.empty();
+    }
+
+    void EventReplayer::MapSender(uint64_t id, const void* sender)
+    {
+        _senders[id] = sender;
+    }
+
+    ReplayStats EventReplayer::Run(ReplayPacing pacing, double speed)
+    {
+        using Clock = std::chrono::steady_clock;
+        ReplayStats stats;
+        std::array<uint64_t, MetricsRecorder::bucketCount> latency{};
+        std::array<uint64_t, MetricsRecorder::bucketCount> late{};
+        uint64_t maxTicks = 0;
+        uint64_t lateCount = 0;
+        FlatMap<uint64_t, uint64_t> names;     //recorded address to NameSender id
+        bool first = true;
+        double firstNs = 0;
+        speed = speed > 0 ? speed : 1.0;
+
+        //sends are timed in ticks, converted with the rate over the whole run
+        const Clock::time_point start = Clock::now();
+        const uint64_t startTicks = MetricsRecorder::Now();
+        for (auto& seg : _segments)
+        {
+            const auto* header = reinterpret_cast<const LogSegmentHeader*>(seg->file.Data());
+            const std::byte* p = seg->file.Data() + sizeof(LogSegmentHeader);
+            const std::byte* end = seg->file.Data() + seg->file.Size();
+            while ((size_t)(end - p) >= sizeof(LogRecordHeader))
+            {
+                const auto* h = reinterpret_cast<const LogRecordHeader*>(p);
+                if (h->size < sizeof(LogRecordHeader) || h->size % 8 != 0 || h->size > (size_t)(end - p))
+                {
+                    break;
+                }
+                p += h->size;
+
+                if (h->kind == LogRecordKind::SenderName)
+                {
+                    names[h->sender] = h->signature;
+                    continue;
+                }
+                if (h->kind != LogRecordKind::Event)
+                {
+                    continue;
+                }
+
+                const Binding* binding = _bindings.Find(h->evt);
+                if (binding == nullptr || binding->signature != h->signature)
+                {
+                    ++stats.unbound;
+                    continue;
+                }
+
+                const uint64_t* name = names.Find(h->sender);
+                const void* const* mapped = _senders.Find(name != nullptr ? *name : h->sender);
+                const void* sender = mapped != nullptr ? *mapped : nullptr;
+
+                if (pacing == ReplayPacing::Original)
+                {
+                    //records of concurrent senders may be a little out of time order
+                    const double at = (double)(int64_t)(h->ticks - header->startTicks) * header->nsPerTick;
+                    if (first)
+                    {
+                        firstNs = at;
+                        first = false;
+                    }
+                    const Clock::time_point due = start + std::chrono::nanoseconds((int64_t)(std::max(at - firstNs, 0.0) / speed));
+                    Clock::time_point now = Clock::now();
+                    //sleep is coarse, the last stretch is spun
+                    if (due - now > std::chrono::microseconds(200))
+                    {
+                        std::this_thread::sleep_until(due - std::chrono::microseconds(100));
+                    }
+                    while ((now = Clock::now()) < due)
+                    {
+                    }
+                    const uint64_t behind = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count();
+                    ++late[MetricsRecorder::Bucket(behind)];
+                    ++lateCount;
+                }
+
+                PayloadReader in(reinterpret_cast<const std::byte*>(h + 1), reinterpret_cast<const std::byte*>(h) + h->size);
+                const uint64_t t0 = MetricsRecorder::Now();
+                const bool sent = binding->send(_es, h->evt, sender, in);
+                const uint64_t ticks = MetricsRecorder::Now() - t0;
+                if (!sent)
+                {
+                    ++stats.corrupt;
+                    continue;
+                }
+                ++stats.events;
+                ++latency[MetricsRecorder::Bucket(ticks)];
+                maxTicks = std::max(maxTicks, ticks);
+            }
+        }
+
+        const auto elapsed = Clock::now() - start;
+        const uint64_t ticks = MetricsRecorder::Now() - startTicks;
+        const double nsPerTick = ticks > 0 ? std::chrono::duration<double, std::nano>(elapsed).count() / (double)ticks : 1.0;
+        stats.seconds = std::chrono::duration<double>(elapsed).count();
+        stats.eventsPerSecond = stats.seconds > 0 ? (double)stats.events / stats.seconds : 0;
+        stats.p50Ns = MetricsRecorder::Percentile(latency.data(), stats.events, 0.50) * nsPerTick;
+        stats.p99Ns = MetricsRecorder::Percentile(latency.data(), stats.events, 0.99) * nsPerTick;
+        stats.maxNs = (double)maxTicks * nsPerTick;
+        stats.lateP99Ns = MetricsRecorder::Percentile(late.data(), lateCount, 0.99);
+        return stats;
+    }
+}
@@ -0,0 +1,323 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+#include "EpochReclaimer.hpp"
+#include "Metrics.hpp"
+
+namespace es
+{
+    /// <summary>
+    /// reads the payload of one record. a read past its end fails the reader and yields zeros
+    /// </summary>
+    class PayloadReader
+    {
+    public:
+        PayloadReader(const std::byte* p, const std::byte* end) : _p(p), _end(end) {}
+
+        bool Read(void* out, size_t n)
+        {
+            if ((size_t)(_end - _p) < n)
+            {
+                _failed = true;
+                std::memset(out, 0, n);
+                return false;
+            }
+            std::memcpy(out, _p, n);
+            _p += n;
+            return true;
+        }
+
+        template <typename T>
+        T Read()
+        {
+            T v;
+            Read(&v, sizeof(T));
+            return v;
+        }
+
+        [[nodiscard]] bool Failed() const { return _failed; }
+
+    private:
+        const std::byte* _p;
+        const std::byte* _end;
+        bool _failed = false;
+    };
+
+    /// <summary>
+    /// how an argument type is written to an event log and read back. specialize it for other types:
+    /// Size(v) is the byte count, Write(out, v) returns the end of what it wrote, Read(in) rebuilds the value.
+    /// trivially copyable types are copied as they are. pointers are not recordable, what they point to would not be replayed
+    /// </summary>
+    template <typename T>
+    struct EventCodec;
+
+    template <typename T>
+        requires (std::is_trivially_copyable_v<T> && !std::is_pointer_v<T> && !std::is_member_pointer_v<T>)
+    struct EventCodec<T>
+    {
+        static constexpr size_t Size(const T&) { return sizeof(T); }
+
+        static std::byte* Write(std::byte* out, const T& v)
+        {
+            std::memcpy(out, &v, sizeof(T));
+            return out + sizeof(T);
+        }
+
+        static T Read(PayloadReader& in) { return in.Read<T>(); }
+    };
+
+    template <typename T>
+    concept Recordable = requires(const T& v, std::byte* out, PayloadReader& in)
+    {
+        { EventCodec<T>::Size(v) } -> std::convertible_to<size_t>;
+        { EventCodec<T>::Write(out, v) } -> std::same_as<std::byte*>;
+        { EventCodec<T>::Read(in) } -> std::same_as<T>;
+    };
+
+    //a 32 bit length, then the elements
+    template <typename C, typename Traits, typename Alloc>
+        requires std::is_trivially_copyable_v<C>
+    struct EventCodec<std::basic_string<C, Traits, Alloc>>
+    {
+        using T = std::basic_string<C, Traits, Alloc>;
+
+        static size_t Size(const T& v) { return sizeof(uint32_t) + v.size() * sizeof(C); }
+
+        static std::byte* Write(std::byte* out, const T& v)
+        {
+            const uint32_t n = (uint32_t)v.size();
+            std::memcpy(out, &n, sizeof(n));
+            std::memcpy(out + sizeof(n), v.data(), n * sizeof(C));
+            return out + sizeof(n) + n * sizeof(C);
+        }
+
+        static T Read(PayloadReader& in)
+        {
+            const uint32_t n = in.Read<uint32_t>();
+            T v;
+            if (!in.Failed())
+            {
+                v.resize(n);
+                in.Read(v.data(), n * sizeof(C));
+            }
+            return v;
+        }
+    };
+
+    template <typename E, typename Alloc>
+        requires Recordable<E>
+    struct EventCodec<std::vector<E, Alloc>>
+    {
+        using T = std::vector<E, Alloc>;
+
+        static size_t Size(const T& v)
+        {
+            size_t size = sizeof(uint32_t);
+            for (const E& e : v)
+            {
+                size += EventCodec<E>::Size(e);
+            }
+            return size;
+        }
+
+        static std::byte* Write(std::byte* out, const T& v)
+        {
+            const uint32_t n = (uint32_t)v.size();
+            std::memcpy(out, &n, sizeof(n));
+            out += sizeof(n);
+            for (const E& e : v)
+            {
+                out = EventCodec<E>::Write(out, e);
+            }
+            return out;
+        }
+
+        static T Read(PayloadReader& in)
+        {
+            const uint32_t n = in.Read<uint32_t>();
+            T v;
+            for (uint32_t i = 0; i < n && !in.Failed(); ++i)
+            {
+                v.push_back(EventCodec<E>::Read(in));
+            }
+            return v;
+        }
+    };
+
+    /// <summary>
+    /// 64 bit FNV-1a of the argument type names, a replay binding must have the same one as the record.
+    /// stable across runs of builds from the same compiler and standard library only, the names differ between
+    /// toolchains, so logs and shared rings carry the ToolchainSignature of their writer
+    /// </summary>
+    template <typename ...Args>
+    uint64_t LogSignature()
+    {
+        static const uint64_t signature = []()
+            {
+                uint64_t h = 0xcbf29ce484222325ull;
+                for (const char* name : { "", typeid(Args).name()... })
+                {
+                    for (; *name != 0; ++name)
+                    {
+                        h = (h ^ (uint8_t)*name) * 0x100000001b3ull;
+                    }
+                    h = (h ^ ',') * 0x100000001b3ull;
+                }
+                return h;
+            }();
+        return signature;
+    }
+
+    /// <summary>
+    /// 64 bit FNV-1a of the compiler, its version, the standard library and the LogSignature of a few of its types.
+    /// a log or a shared ring written by a build with another value is refused, its signatures would not match
+    /// </summary>
+    uint64_t ToolchainSignature();
+
+    //file layout: a segment header, then records back to back, 8 byte aligned. a record is written before its size,
+    //so a size of 0 ends the segment, either its unused tail or a record that was never finished
+    struct LogSegmentHeader
+    {
+        static constexpr uint64_t magic = 0x31474f4c54564545ull;   //"EEVTLOG1"
+        static constexpr uint32_t version = 2;
+
+        uint64_t fileMagic;
+        uint32_t fileVersion;
+        uint32_t index;             //segments of one log are path.0, path.1, ...
+        int64_t openedNs;           //system clock when the log was opened
+        uint64_t startTicks;        //MetricsRecorder::Now when the log was opened, record times count from it
+        double nsPerTick;           //measured when the segment is done, a first estimate until then
+        uint64_t toolchain;         //ToolchainSignature of the writer
+    };
+
+    enum class LogRecordKind : uint16_t
+    {
+        Event = 1,
+        SenderName = 2,     //sender is named signature from here on
+    };
+
+    struct LogRecordHeader
+    {
+        uint32_t size;          //header and payload, rounded up to 8
+        LogRecordKind kind;
+        uint16_t argCount;
+        int32_t evt;
+        uint32_t reserved;
+        uint64_t sender;        //the sender pointer, see EventRecorder::NameSender
+        uint64_t ticks;         //MetricsRecorder::Now, see LogSegmentHeader
+        uint64_t signature;     //LogSignature of the arguments
+    };
+
+    struct RecorderStats
+    {
+        uint64_t records = 0;
+        uint64_t bytes = 0;
+        uint64_t segments = 0;
+        uint64_t unrecordable = 0;  //sends with an argument that has no EventCodec
+        uint64_t dropped = 0;       //records larger than a segment, sends while closed, or a segment that could not be created
+    };
+
+    /// <summary>
+    /// appends every event a bus sends to a log of memory mapped segment files, see EventSystem::SetRecorder.
+    /// any number of threads record at once: a record reserves its bytes with one atomic add and is written in place,
+    /// a full segment is swapped for the next one and unmapped once no thread still writes to it
+    /// </summary>
+    class EventRecorder
+    {
+    public:
+        static constexpr size_t defaultSegmentBytes = 64u << 20;
+
+        EventRecorder() = default;
+        ~EventRecorder();
+        EventRecorder(const EventRecorder&) = delete;
+        void operator=(const EventRecorder&) = delete;
+
+        /// <summary>
+        /// start a log at path, its segments are path.0, path.1, ... of segmentBytes each, existing ones are overwritten
+        /// </summary>
+        /// <returns>false if the first segment could not be created</returns>
+        bool Open(const std::string& path, size_t segmentBytes = defaultSegmentBytes);
+
+        /// <summary>
+        /// stop recording, the last segment is cut to what was written
+        /// </summary>
+        void Close();
+        [[nodiscard]] bool IsOpen() const { return _current.load(std::memory_order_relaxed) != nullptr; }
+
+        /// <summary>
+        /// record sender as id instead of its address, so a replay can map it to an object of its own.
+        /// names set before Open are written when it opens
+        /// </summary>
+        void NameSender(const void* sender, uint64_t id);
+
+        [[nodiscard]] RecorderStats Stats() const;
+
+        template <typename ...Args>
+        void Record(int evt, const void* sender, const Args&... args)
+        {
+            if constexpr ((Recordable<Args> && ...))
+            {
+                EpochReclaimer::ReadGuard guard;
+                const size_t payload = (size_t(0) + ... + EventCodec<Args>::Size(args));
+                LogRecordHeader* h = Reserve(LogRecordKind::Event, evt, sender, sizeof...(Args), LogSignature<Args...>(), payload);
+                if (h != nullptr)
+                {
+                    [[maybe_unused]] std::byte* out = reinterpret_cast<std::byte*>(h + 1);
+                    ((out = EventCodec<Args>::Write(out, args)), ...);
+                    Commit(h, payload);
+                }
+            }
+            else
+            {
+                _unrecordable.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+        struct Segment;
+
+        static uint32_t RecordSize(size_t payload)
+        {
+            return (uint32_t)((sizeof(LogRecordHeader) + payload + 7) & ~size_t(7));
+        }
+
+        //fills the header but its size, null when the record is dropped
+        LogRecordHeader* Reserve(LogRecordKind kind, int evt, const void* sender, uint16_t argCount, uint64_t signature, size_t payload);
+
+        void Commit(LogRecordHeader* h, size_t payload)
+        {
+            std::atomic_ref<uint32_t>(h->size).store(RecordSize(payload), std::memory_order_release);
+            _records.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        Segment* NextSegment(uint32_t index);
+        bool Rotate(Segment* full);
+        void WriteName(const void* sender, uint64_t id);
+
+        std::atomic<Segment*> _current{ nullptr };
+        mutable std::mutex _lock;   //opening, rotating and closing segments, and the names
+        std::string _path;
+        size_t _segmentBytes = defaultSegmentBytes;
+        std::chrono::steady_clock::time_point _start;
+        uint64_t _startTicks = 0;
+        double _nsPerTick = 1;
+        uint64_t _closedBytes = 0;
+        std::vector<std::pair<const void*, uint64_t>> _names;
+        std::atomic<uint64_t> _records{ 0 };
+        std::atomic<uint64_t> _segments{ 0 };
+        std::atomic<uint64_t> _unrecordable{ 0 };
+        std::atomic<uint64_t> _dropped{ 0 };
+    };
+}
@@ -0,0 +1,412 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace es
+{
+    /// <summary>
+    /// what Post does when the queue is full
+    /// </summary>
+    enum class QueueFullPolicy
+    {
+        Block,  //wait for the consumer to make room
+        Drop,   //discard the event, Post returns false
+        Grow,   //spill to an unbounded overflow list, allocates while the ring is full
+    };
+
+    /// <summary>
+    /// bounded lock free multi producer, single consumer queue of deferred jobs.
+    /// every ring cell is a preallocated slot with inline storage for the job, so a producer pays
+    /// one CAS and a construction, and allocates nothing unless the job is bigger than a cell or the ring spills
+    /// </summary>
+    class EventQueue
+    {
+    public:
+        static constexpr size_t cellStorage = 96;
+
+        explicit EventQueue(size_t capacity = 4096, QueueFullPolicy policy = QueueFullPolicy::Grow)
+        {
+            Reset(capacity, policy);
+        }
+
+        ~EventQueue()
+        {
+            Clear();
+        }
+
+        EventQueue(const EventQueue&) = delete;
+        void operator=(const EventQueue&) = delete;
+
+        /// <summary>
+        /// resize the ring, pending jobs are dropped. not safe while producers are running
+        /// </summary>
+        void Reset(size_t capacity, QueueFullPolicy policy)
+        {
+            Clear();
+            size_t cap = 2;
+            while (cap < capacity)
+            {
+                cap *= 2;
+            }
+
+            _cells.reset(new Cell[cap]);
+            _mask = cap - 1;
+            for (size_t i = 0; i < cap; ++i)
+            {
+                _cells[i].seq.store(i, std::memory_order_relaxed);
+            }
+            _head = 0;
+            _tail.store(0, std::memory_order_relaxed);
+            _policy = policy;
+        }
+
+        [[nodiscard]] size_t Capacity() const { return _mask + 1; }
+        [[nodiscard]] QueueFullPolicy Policy() const { return _policy; }
+
+        /// <summary>
+        /// enqueue job, a callable taking no argument, run later by Pump
+        /// </summary>
+        /// <returns>false if the job was dropped because the queue is full</returns>
+        template <typename F>
+        bool Push(F&& job)
+        {
+            using Fn = std::decay_t<F>;
+            for (;;)
+            {
+                if (_spilled.load(std::memory_order_acquire) == 0 && TryPushRing(job))
+                {
+                    break;
+                }
+
+                if (_policy == QueueFullPolicy::Drop)
+                {
+                    return false;
+                }
+
+                //the consumer itself can not wait for room it has to make
+                if (_policy == QueueFullPolicy::Grow || _consumer.load(std::memory_order_relaxed) == std::this_thread::get_id())
+                {
+                    Spill(new Fn(std::forward<F>(job)));
+                    break;
+                }
+
+                std::this_thread::yield();
+            }
+
+            Wake();
+            return true;
+        }
+
+        /// <summary>
+        /// run queued jobs on the calling thread, at most maxJobs. only one thread pumps at a time,
+        /// a concurrent or nested Pump returns 0
+        /// </summary>
+        /// <returns>number of jobs run</returns>
+        size_t Pump(size_t maxJobs = SIZE_MAX)
+        {
+            if (_pumping.test_and_set(std::memory_order_acquire))
+            {
+                return 0;
+            }
+
+            struct Release
+            {
+                EventQueue& q;
+                ~Release()
+                {
+                    q._consumer.store(std::thread::id(), std::memory_order_relaxed);
+                    q._pumping.clear(std::memory_order_release);
+                }
+            } release{ *this };
+            _consumer.store(std::this_thread::get_id(), std::memory_order_relaxed);
+
+            size_t count = 0;
+            while (count < maxJobs && PopRing())
+            {
+                ++count;
+            }
+
+            while (count < maxJobs && _spilled.load(std::memory_order_acquire) > 0)
+            {
+                SpillNode node;
+                {
+                    std::lock_guard lock(_spillLock);
+                    if (_spillHead == _spill.size())
+                    {
+                        break;
+                    }
+                    node = _spill[_spillHead++];
+                    if (_spillHead == _spill.size())
+                    {
+                        _spill.clear();
+                        _spillHead = 0;
+                    }
+                }
+
+                //producers return to the ring only once the spill is drained, so ordering is kept
+                struct Done
+                {
+                    EventQueue& q;
+                    ~Done() { q._spilled.fetch_sub(1, std::memory_order_release); }
+                } done{ *this };
+                node.run(node.job);
+                ++count;
+            }
+            return count;
+        }
+
+        [[nodiscard]] bool Empty() const
+        {
+            const Cell& c = _cells[_head & _mask];
+            return c.seq.load(std::memory_order_acquire) != _head + 1 && _spilled.load(std::memory_order_acquire) == 0;
+        }
+
+        /// <summary>
+        /// block the consumer thread until a job is pushed, or Notify is called and stop() holds
+        /// </summary>
+        template <typename Stop>
+        void Wait(Stop&& stop)
+        {
+            const uint32_t signal = _signal.load(std::memory_order_acquire);
+            _sleeping.store(true, std::memory_order_seq_cst);
+            if (Empty() && !stop())
+            {
+                _signal.wait(signal, std::memory_order_acquire);
+            }
+            _sleeping.store(false, std::memory_order_relaxed);
+        }
+
+        void Notify()
+        {
+            _signal.fetch_add(1, std::memory_order_release);
+            _signal.notify_one();
+        }
+
+        /// <summary>
+        /// drop every pending job without running it
+        /// </summary>
+        void Clear()
+        {
+            if (!_cells)
+            {
+                return;
+            }
+
+            while (true)
+            {
+                Cell& c = _cells[_head & _mask];
+                if (c.seq.load(std::memory_order_acquire) != _head + 1)
+                {
+                    break;
+                }
+                c.drop(c.storage);
+                c.seq.store(_head + _mask + 1, std::memory_order_release);
+                ++_head;
+            }
+
+            std::lock_guard lock(_spillLock);
+            for (size_t i = _spillHead; i < _spill.size(); ++i)
+            {
+                _spill[i].drop(_spill[i].job);
+            }
+            _spilled.fetch_sub(_spill.size() - _spillHead, std::memory_order_release);
+            _spill.clear();
+            _spillHead = 0;
+        }
+
+    private:
+        struct alignas(64) Cell
+        {
+            std::atomic<size_t> seq{ 0 };
+            void (*run)(void* storage) = nullptr;
+            void (*drop)(void* storage) = nullptr;
+            alignas(std::max_align_t) unsigned char storage[cellStorage];
+        };
+
+        struct SpillNode
+        {
+            void* job = nullptr;
+            void (*run)(void* job) = nullptr;
+            void (*drop)(void* job) = nullptr;
+        };
+
+        template <typename Fn>
+        struct InlineJob
+        {
+            static void Run(void* p)
+            {
+                Fn& f = *static_cast<Fn*>(p);
+                struct Destroy
+                {
+                    Fn& f;
+                    ~Destroy() { f.~Fn(); }
+                } destroy{ f };
+                f();
+            }
+
+            static void Drop(void* p)
+            {
+                static_cast<Fn*>(p)->~Fn();
+            }
+        };
+
+        template <typename Fn>
+        struct HeapJob
+        {
+            static Fn* Target(void* p) { return *static_cast<Fn**>(p); }
+
+            static void Run(void* p)
+            {
+                std::unique_ptr<Fn> f(Target(p));
+                (*f)();
+            }
+
+            static void Drop(void* p)
+            {
+                delete Target(p);
+            }
+        };
+
+        template <typename Fn>
+        struct SpillJob
+        {
+            static void Run(void* p)
+            {
+                std::unique_ptr<Fn> f(static_cast<Fn*>(p));
+                (*f)();
+            }
+
+            static void Drop(void* p)
+            {
+                delete static_cast<Fn*>(p);
+            }
+        };
+
+        static void Noop(void*) {}
+
+        template <typename F>
+        bool TryPushRing(F& job)
+        {
+            using Fn = std::decay_t<F>;
+            size_t pos = _tail.load(std::memory_order_relaxed);
+            Cell* cell = nullptr;
+            for (;;)
+            {
+                cell = &_cells[pos & _mask];
+                const size_t seq = cell->seq.load(std::memory_order_acquire);
+                const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                if (diff == 0)
+                {
+                    if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = _tail.load(std::memory_order_relaxed);
+                }
+            }
+
+            //the cell is claimed, it must be published even if constructing the job throws
+            struct Publish
+            {
+                Cell* cell;
+                size_t seq;
+                ~Publish()
+                {
+                    if (cell->run == nullptr)
+                    {
+                        cell->run = &Noop;
+                        cell->drop = &Noop;
+                    }
+                    cell->seq.store(seq, std::memory_order_release);
+                }
+            } publish{ cell, pos + 1 };
+
+            cell->run = nullptr;
+            if constexpr (sizeof(Fn) <= cellStorage && alignof(Fn) <= alignof(std::max_align_t))
+            {
+                ::new (static_cast<void*>(cell->storage)) Fn(std::forward<F>(job));
+                cell->run = &InlineJob<Fn>::Run;
+                cell->drop = &InlineJob<Fn>::Drop;
+            }
+            else
+            {
+                ::new (static_cast<void*>(cell->storage)) Fn*(new Fn(std::forward<F>(job)));
+                cell->run = &HeapJob<Fn>::Run;
+                cell->drop = &HeapJob<Fn>::Drop;
+            }
+            return true;
+        }
+
+        bool PopRing()
+        {
+            Cell& c = _cells[_head & _mask];
+            if (c.seq.load(std::memory_order_acquire) != _head + 1)
+            {
+                return false;
+            }
+
+            //the cell is handed back to producers even if the job throws
+            struct Recycle
+            {
+                EventQueue& q;
+                Cell& c;
+                ~Recycle()
+                {
+                    c.seq.store(q._head + q._mask + 1, std::memory_order_release);
+                    ++q._head;
+                }
+            } recycle{ *this, c };
+            c.run(c.storage);
+            return true;
+        }
+
+        template <typename Fn>
+        void Spill(Fn* job)
+        {
+            std::lock_guard lock(_spillLock);
+            _spill.push_back(SpillNode{ job, &SpillJob<Fn>::Run, &SpillJob<Fn>::Drop });
+            _spilled.fetch_add(1, std::memory_order_release);
+        }
+
+        void Wake()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_sleeping.load(std::memory_order_relaxed))
+            {
+                Notify();
+            }
+        }
+
+        std::unique_ptr<Cell[]> _cells;
+        size_t _mask = 0;
+        alignas(64) std::atomic<size_t> _tail{ 0 };
+        alignas(64) size_t _head = 0;
+        std::atomic_flag _pumping;
+        std::atomic<std::thread::id> _consumer;
+        std::atomic<bool> _sleeping{ false };
+        std::atomic<uint32_t> _signal{ 0 };
+        QueueFullPolicy _policy = QueueFullPolicy::Grow;
+
+        std::mutex _spillLock;
+        std::vector<SpillNode> _spill;
+        size_t _spillHead = 0;
+        std::atomic<size_t> _spilled{ 0 };
+    };
+}
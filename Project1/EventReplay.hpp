@@ -0,0 +1,131 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "EventSystem.hpp"
+#include "FlatMap.hpp"
+
+namespace es
+{
+    enum class ReplayPacing
+    {
+        AsFastAsPossible,
+        Original,           //each event at its recorded time from the start of the replay, divided by speed
+    };
+
+    struct ReplayStats
+    {
+        uint64_t events = 0;        //sent
+        uint64_t unbound = 0;       //events with no Bind, or with other argument types than their Bind
+        uint64_t corrupt = 0;       //payloads shorter than their arguments
+        double seconds = 0;
+        double eventsPerSecond = 0;
+        //one Send, its listeners included
+        double p50Ns = 0;
+        double p99Ns = 0;
+        double maxNs = 0;
+        //Original pacing, how late a send was against its recorded time
+        double lateP99Ns = 0;
+    };
+
+    /// <summary>
+    /// sends the events of an EventRecorder log on a bus again. the argument types of an event are not in the log,
+    /// each event to replay is bound to them with Bind, and checked against the log signature of every record.
+    /// arguments are read into a tuple and handed over like SendMove
+    /// </summary>
+    class EventReplayer
+    {
+    public:
+        explicit EventReplayer(EventSystem& es = ESI());
+        ~EventReplayer();
+        EventReplayer(const EventReplayer&) = delete;
+        void operator=(const EventReplayer&) = delete;
+
+        /// <summary>
+        /// map the segments path.0, path.1, ... up to the first one missing
+        /// </summary>
+        /// <returns>false if there is no valid first segment, or it was written by a build of another toolchain, see ToolchainSignature</returns>
+        bool Open(const std::string& path);
+
+        template <typename ...Args, typename EventType>
+        void Bind(EventType evtID)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            static_assert((Recordable<std::decay_t<Args>> && ...), "an argument type has no EventCodec");
+            _bindings[(int)evtID] = Binding{ LogSignature<std::decay_t<Args>...>(), &SendDecoded<std::decay_t<Args>...> };
+        }
+
+        /// <summary>
+        /// bind a typed event to its EventSignature, it is replayed through the typed SendMove
+        /// </summary>
+        template <auto EventID>
+        void Bind()
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            BindTyped<EventID>(std::type_identity<typename EventSignature<EventID>::Type>());
+        }
+
+        /// <summary>
+        /// replay the events of sender identity id from sender. the identity is the id given to
+        /// EventRecorder::NameSender, or the recorded address of an unnamed sender. unmapped senders replay as nullptr,
+        /// which reaches the same listeners, the ones registered without sender
+        /// </summary>
+        void MapSender(uint64_t id, const void* sender);
+
+        /// <summary>
+        /// send every record of the log on the calling thread, in log order
+        /// </summary>
+        ReplayStats Run(ReplayPacing pacing = ReplayPacing::AsFastAsPossible, double speed = 1.0);
+
+    private:
+        struct Segment;
+
+        using SendFn = bool (*)(EventSystem& es, int evt, const void* sender, PayloadReader& in);
+
+        struct Binding
+        {
+            uint64_t signature = 0;
+            SendFn send = nullptr;
+        };
+
+        //braced initialization reads the arguments in order
+        template <typename ...Args>
+        static bool SendDecoded(EventSystem& es, int evt, const void* sender, PayloadReader& in)
+        {
+            std::tuple<Args...> args{ EventCodec<Args>::Read(in)... };
+            if (in.Failed())
+            {
+                return false;
+            }
+            std::apply([&](Args&... a) { es.SendMove(evt, sender, std::move(a)...); }, args);
+            return true;
+        }
+
+        template <auto EventID, typename ...Args>
+        static bool SendTyped(EventSystem& es, int, const void* sender, PayloadReader& in)
+        {
+            std::tuple<Args...> args{ EventCodec<Args>::Read(in)... };
+            if (in.Failed())
+            {
+                return false;
+            }
+            std::apply([&](Args&... a) { es.template SendMove<EventID>(sender, std::move(a)...); }, args);
+            return true;
+        }
+
+        template <auto EventID, typename ReturnType, typename ...Args>
+        void BindTyped(std::type_identity<ReturnType(Args...)>)
+        {
+            static_assert((Recordable<std::decay_t<Args>> && ...), "an argument type has no EventCodec");
+            _bindings[(int)EventID] = Binding{ LogSignature<std::decay_t<Args>...>(), &SendTyped<EventID, std::decay_t<Args>...> };
+        }
+
+        EventSystem& _es;
+        std::vector<std::unique_ptr<Segment>> _segments;
+        FlatMap<int, Binding> _bindings;
+        FlatMap<uint64_t, const void*> _senders;
+    };
+}
@@ -1,101 +1,2808 @@
 //(C) benyuan 2024
 //all rights reserved
 #include "EventSystem.hpp"
-#include <tuple>
-#include <map>
-#include <forward_list>
+#include "FlatMap.hpp"
+#include "EpochReclaimer.hpp"
+#include "EventQueue.hpp"
+#include "ThreadPool.hpp"
+#include "TimingWheel.hpp"
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <mutex>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <functional>
 #include <type_traits>
 
 namespace es
 {
+    /// <summary>
+    /// copyable atomic pointer, so it can live in FlatMap values. readers acquire, writers release
+    /// </summary>
+    template <typename T>
+    struct AtomicPtr
+    {
+        AtomicPtr() = default;
+        AtomicPtr(const AtomicPtr& other) : _p(other.Load()) {}
+        AtomicPtr& operator=(const AtomicPtr& other)
+        {
+            Store(other.Load());
+            return *this;
+        }
+
+        T* Load() const { return _p.load(std::memory_order_acquire); }
+        void Store(T* p) { _p.store(p, std::memory_order_release); }
+
+    private:
+        std::atomic<T*> _p{ nullptr };
+    };
+
+    /// <summary>
+    /// the pool of EventSystem::SetPooledMemory. every block it gave out holds a reference, as does the bus,
+    /// so a list retired to the reclaimer is freed into it even after the bus is gone
+    /// </summary>
+    class PooledMemory : public std::pmr::memory_resource
+    {
+    public:
+        explicit PooledMemory(const std::pmr::pool_options& options) : _pool(options) {}
+
+        void Release()
+        {
+            Unref();
+        }
+
+    private:
+        void* do_allocate(size_t bytes, size_t align) override
+        {
+            void* p = _pool.allocate(bytes, align);
+            _refs.fetch_add(1, std::memory_order_relaxed);
+            return p;
+        }
+
+        void do_deallocate(void* p, size_t bytes, size_t align) override
+        {
+            _pool.deallocate(p, bytes, align);
+            Unref();
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+        {
+            return this == &other;
+        }
+
+        void Unref()
+        {
+            if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                delete this;
+            }
+        }
+
+        std::pmr::synchronized_pool_resource _pool;    //lists are freed on any thread that collects the reclaimer
+        std::atomic<size_t> _refs{ 1 };
+    };
+
+    /// <summary>
+    /// a published listener list or sender table is never changed while it may be read:
+    /// in thread safe mode, or while a Call is running on this thread, writers build a copy,
+    /// publish it, and retire the old one. otherwise they simply edit in place
+    /// </summary>
     struct EventSystemImp
     {
-        struct CallBackInfo
+        static constexpr uint32_t noPos = UINT32_MAX;
+
+        //listener storage comes from the resource of the bus, the global heap when it has none
+        static void* Allocate(std::pmr::memory_resource* resource, size_t bytes, size_t align)
+        {
+            return resource != nullptr ? resource->allocate(bytes, align) : ::operator new(bytes);
+        }
+
+        static void Deallocate(std::pmr::memory_resource* resource, void* p, size_t bytes, size_t align)
+        {
+            if (resource != nullptr)
+            {
+                resource->deallocate(p, bytes, align);
+            }
+            else
+            {
+                ::operator delete(p);
+            }
+        }
+
+        /// <summary>
+        /// one registration. removal only marks it dead, which readers can observe concurrently,
+        /// the entry is dropped when its list is compacted. a list replaced under a running send points each
+        /// live entry at its copy, removals mark the copy and the send still sees them
+        /// </summary>
+        struct CallBackInfo
+        {
+            CallBackInfo(EventSystem::FnCallBack&& cb, const void* rc, uint64_t signature, uint32_t slot, uint32_t generation, bool batch)
+                : cb(std::move(cb)), rc(rc), signature(signature), slot(slot), generation(generation), batch(batch)
+            {
+            }
+
+            CallBackInfo(const CallBackInfo& other)
+                : cb(other.cb), rc(other.rc), signature(other.signature), slot(other.slot), generation(other.generation), dead(other.Dead()), batch(other.batch)
+            {
+            }
+
+            CallBackInfo(CallBackInfo&& other) noexcept
+                : cb(std::move(other.cb)), rc(other.rc), signature(other.signature), slot(other.slot), generation(other.generation), dead(other.Dead()), batch(other.batch)
+            {
+            }
+
+            CallBackInfo& operator=(CallBackInfo&& other) noexcept
+            {
+                cb = std::move(other.cb);
+                rc = other.rc;
+                signature = other.signature;
+                slot = other.slot;
+                generation = other.generation;
+                dead.store(other.Dead(), std::memory_order_relaxed);
+                batch = other.batch;
+                return *this;
+            }
+
+            //a send holds its epoch until it returns, so the copies of what it walks are not freed before
+            [[nodiscard]] bool Dead() const
+            {
+                for (const CallBackInfo* c = this; c != nullptr; c = c->copy.load(std::memory_order_acquire))
+                {
+                    if (c->dead.load(std::memory_order_acquire))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            EventSystem::FnCallBack cb;
+            const void* rc = nullptr;
+            uint64_t signature = 0; //of the arguments it takes, sends of other arguments pass it by
+            uint32_t slot = noPos;  //index in the handle slot map
+            uint32_t generation = 0;
+            std::atomic<bool> dead{ false };
+            bool batch = false;     //span listener, takes a whole SendBatch in one call
+            std::atomic<const CallBackInfo*> copy{ nullptr };  //in the list that replaced this one, null in the current list
+        };
+
+        /// <summary>
+        /// where a registration lives, indexed by the low half of its handle
+        /// </summary>
+        struct HandleSlot
+        {
+            const void* sd = nullptr;
+            const void* rc = nullptr;
+            int evt = 0;
+            uint32_t generation = 1;
+            uint32_t listPos = noPos;      //position in the (evt, sd) listener list
+            uint32_t sdIndexPos = noPos;   //position in _byObject[sd]
+            uint32_t rcIndexPos = noPos;   //position in _byObject[rc], unused when rc is sd
+            uint32_t nextFree = noPos;
+            bool live = false;
+            bool pending = false;          //registered during a send, listPos is its index in _pendingAdds
+        };
+
+        /// <summary>
+        /// listeners of one (event, sender), ordered by recver address then newest first,
+        /// the same order the old recver map and forward_list gave.
+        /// header and entries share one allocation so a lookup reaches the callbacks with one less miss
+        /// </summary>
+        struct alignas(CallBackInfo) ListenerList
+        {
+            static ListenerList* Create(uint32_t capacity, std::pmr::memory_resource* resource)
+            {
+                void* mem = Allocate(resource, Bytes(capacity), alignof(ListenerList));
+                return ::new (mem) ListenerList(capacity, resource);
+            }
+
+            static void operator delete(ListenerList* p, std::destroying_delete_t)
+            {
+                std::pmr::memory_resource* resource = p->_resource;
+                const size_t bytes = Bytes(p->_capacity);
+                p->~ListenerList();
+                Deallocate(resource, p, bytes, alignof(ListenerList));
+            }
+
+            static size_t Bytes(uint32_t capacity)
+            {
+                return sizeof(ListenerList) + sizeof(CallBackInfo) * capacity;
+            }
+
+            ~ListenerList()
+            {
+                std::destroy(begin(), end());
+            }
+
+            CallBackInfo* begin() { return reinterpret_cast<CallBackInfo*>(this + 1); }
+            CallBackInfo* end() { return begin() + _size; }
+            const CallBackInfo* begin() const { return reinterpret_cast<const CallBackInfo*>(this + 1); }
+            const CallBackInfo* end() const { return begin() + _size; }
+            [[nodiscard]] bool Empty() const { return _size == 0; }
+            [[nodiscard]] bool Full() const { return _size == _capacity; }
+            [[nodiscard]] uint32_t Size() const { return _size; }
+            [[nodiscard]] uint32_t Capacity() const { return _capacity; }
+            [[nodiscard]] uint32_t DeadCount() const { return _dead; }
+            CallBackInfo& operator[](uint32_t i) { return begin()[i]; }
+
+            void MarkDead(uint32_t i)
+            {
+                begin()[i].dead.store(true, std::memory_order_release);
+                ++_dead;
+            }
+
+            /// <summary>
+            /// copy of the entries pred accepts, with room for extra more
+            /// </summary>
+            template <typename Pred>
+            ListenerList* CopyIf(Pred&& pred, uint32_t extra) const
+            {
+                ListenerList* l = Create(_size + extra, _resource);
+                for (const auto& cbi : *this)
+                {
+                    if (pred(cbi))
+                    {
+                        ::new (l->end()) CallBackInfo(cbi);
+                        ++l->_size;
+                        l->_dead += cbi.Dead() ? 1 : 0;
+                    }
+                }
+                return l;
+            }
+
+            ListenerList* Grow() const
+            {
+                return CopyIf([](const CallBackInfo&) { return true; }, _capacity < 4 ? 4 : _capacity);
+            }
+
+            //newest first inside the same recver, needs !Full(). returns the position, entries after it moved by one
+            uint32_t Insert(CallBackInfo&& cbi)
+            {
+                CallBackInfo* pos = std::lower_bound(begin(), end(), cbi.rc, [](const CallBackInfo& item, const void* r) { return std::less<const void*>()(item.rc, r); });
+                if (pos == end())
+                {
+                    ::new (end()) CallBackInfo(std::move(cbi));
+                }
+                else
+                {
+                    ::new (end()) CallBackInfo(std::move(end()[-1]));
+                    std::move_backward(pos, end() - 1, end());
+                    *pos = std::move(cbi);
+                }
+                ++_size;
+                return (uint32_t)(pos - begin());
+            }
+
+            void EraseDead()
+            {
+                CallBackInfo* last = std::remove_if(begin(), end(), [](const CallBackInfo& cbi) { return cbi.Dead(); });
+                std::destroy(last, end());
+                _size = (uint32_t)(last - begin());
+                _dead = 0;
+            }
+
+        private:
+            ListenerList(uint32_t capacity, std::pmr::memory_resource* resource) : _resource(resource), _capacity(capacity) {}
+
+            std::pmr::memory_resource* _resource;   //null for the global heap, copies come from the same one
+            uint32_t _size = 0;
+            uint32_t _capacity = 0;
+            uint32_t _dead = 0;
+        };
+
+        /// <summary>
+        /// what a send from one sender reaches: its own listeners, then the wildcard ones, in one array.
+        /// it points into both lists and is dropped whenever either of them changes, the entries are
+        /// the ones alive when it was built, later removals are still seen through the dead flag
+        /// </summary>
+        struct alignas(const CallBackInfo*) MergedList
+        {
+            static MergedList* Create(const ListenerList& own, const ListenerList& any, std::pmr::memory_resource* resource)
+            {
+                const uint32_t capacity = own.Size() + any.Size();
+                void* mem = Allocate(resource, Bytes(capacity), alignof(MergedList));
+                MergedList* m = ::new (mem) MergedList;
+                m->resource = resource;
+                m->capacity = capacity;
+                const CallBackInfo** out = reinterpret_cast<const CallBackInfo**>(m + 1);
+                for (const auto& cbi : own)
+                {
+                    if (!cbi.Dead())
+                    {
+                        out[m->size++] = &cbi;
+                    }
+                }
+                m->split = m->size;
+                for (const auto& cbi : any)
+                {
+                    if (!cbi.Dead())
+                    {
+                        out[m->size++] = &cbi;
+                    }
+                }
+                return m;
+            }
+
+            static void operator delete(MergedList* p, std::destroying_delete_t)
+            {
+                Deallocate(p->resource, p, Bytes(p->capacity), alignof(MergedList));
+            }
+
+            static size_t Bytes(uint32_t capacity)
+            {
+                return sizeof(MergedList) + sizeof(const CallBackInfo*) * capacity;
+            }
+
+            const CallBackInfo* const* begin() const { return reinterpret_cast<const CallBackInfo* const*>(this + 1); }
+
+            std::pmr::memory_resource* resource = nullptr;
+            uint32_t size = 0;
+            uint32_t split = 0;     //entries before it are the sender's own, the rest were registered without sender
+            uint32_t capacity = 0;
+        };
+
+        struct SenderListeners
+        {
+            AtomicPtr<ListenerList> list;
+            AtomicPtr<MergedList> merged;   //null until the first send, or noWildcard
+        };
+
+        //the merged list of a sender while the event has no wildcard listeners: its own list is all of it
+        static MergedList noWildcard;
+
+        /// <summary>
+        /// handle slots of the registrations one object sends or receives. the first few are inline,
+        /// so an object that keeps replacing its only listener, like a co_await waiting again, allocates nothing
+        /// </summary>
+        struct ObjectSlots
+        {
+            static constexpr uint32_t inlineCount = 3;
+
+            [[nodiscard]] uint32_t Size() const { return _size; }
+            [[nodiscard]] bool Empty() const { return _size == 0; }
+            uint32_t& operator[](uint32_t i) { return i < inlineCount ? _inline[i] : _more[i - inlineCount]; }
+            uint32_t Back() { return (*this)[_size - 1]; }
+
+            void Push(uint32_t slot)
+            {
+                if (_size < inlineCount)
+                {
+                    _inline[_size] = slot;
+                }
+                else
+                {
+                    _more.push_back(slot);
+                }
+                ++_size;
+            }
+
+            void Pop()
+            {
+                if (--_size >= inlineCount)
+                {
+                    _more.pop_back();
+                }
+            }
+
+        private:
+            uint32_t _inline[inlineCount] = {};
+            uint32_t _size = 0;
+            std::vector<uint32_t> _more;
+        };
+
+        //a registration made while a send runs on the owning thread, it joins its list when the outermost send returns
+        struct PendingAdd
+        {
+            int evt;
+            const void* sd;
+            CallBackInfo cbi;
+        };
+
+        //senders of one event
+        using EvtCallBackInfo = FlatMap<const void*, SenderListeners>;
+        using EventSlot = AtomicPtr<EvtCallBackInfo>;
+        using SparseEvents = FlatMap<int, EventSlot>;
+
+        //event ids are enums, so most of them are small and live in the dense table
+        static constexpr int denseEventLimit = 1024;
+
+        /// <summary>
+        /// keyed listeners of one event with one key extractor. each key has an internal event of its own,
+        /// so its listeners live in the usual sender tables
+        /// </summary>
+        struct KeyGroup
+        {
+            EventSystem::KeyExtractor extractor;
+            FlatMap<uint64_t, int> events;
+        };
+        using KeyedEvents = FlatMap<int, std::vector<KeyGroup>>;
+
+        //what an internal key event stands for, and how many registrations use it
+        struct KeyRef
+        {
+            int evt = 0;
+            EventSystem::KeyExtractor extractor;
+            uint64_t key = 0;
+            uint32_t count = 0;
+        };
+
+        //internal key events take the lowest ids
+        static constexpr int keyEventBase = INT_MIN;
+        static constexpr int keyEventCount = 1 << 30;
+
+        static bool IsKeyEvent(int evt)
+        {
+            return evt < keyEventBase + keyEventCount;
+        }
+
+        ~EventSystemImp()
+        {
+            StopDispatcher();
+            StopTimer();
+            _pool.reset();
+            _queue.Clear();
+            _wheel.Clear([](void* send) { delete static_cast<EventSystem::TimedSend*>(send); });
+            _threadSafe = false;
+            _callDepth = 0;
+            RemoveAll();
+            if (_pooled != nullptr)
+            {
+                _pooled->Release();
+            }
+        }
+
+        bool Shared() const
+        {
+            return _threadSafe || _callDepth > 0;
+        }
+
+        //a send runs on the owning thread, list changes wait until it returns
+        bool Deferring() const
+        {
+            return !_threadSafe && _callDepth > 0;
+        }
+
+        template <typename T>
+        void Retire(T* p)
+        {
+            if (p == nullptr)
+            {
+                return;
+            }
+
+            if (_threadSafe)
+            {
+                EpochReclaimer::Retire(p);
+            }
+            else if (_callDepth > 0)
+            {
+                _retired.push_back({ p, [](void* v) { delete static_cast<T*>(v); } });
+            }
+            else
+            {
+                delete p;
+            }
+        }
+
+        const EventSlot* FindSlot(int evt) const
+        {
+            if ((unsigned)evt < (unsigned)denseEventLimit)
+            {
+                return &_dense[evt];
+            }
+
+            const SparseEvents* sparse = _sparse.Load();
+            return sparse != nullptr ? sparse->Find(evt) : nullptr;
+        }
+
+        EventSlot& GetSlot(int evt)
+        {
+            if ((unsigned)evt < (unsigned)denseEventLimit)
+            {
+                return _dense[evt];
+            }
+
+            SparseEvents* sparse = _sparse.Load();
+            if (sparse != nullptr)
+            {
+                if (EventSlot* slot = sparse->Find(evt); slot != nullptr)
+                {
+                    return *slot;
+                }
+            }
+
+            if (!Shared())
+            {
+                if (sparse == nullptr)
+                {
+                    sparse = new SparseEvents;
+                    _sparse.Store(sparse);
+                }
+                return (*sparse)[evt];
+            }
+
+            SparseEvents* next = sparse != nullptr ? new SparseEvents(*sparse) : new SparseEvents;
+            EventSlot& slot = (*next)[evt];
+            _sparse.Store(next);
+            Retire(sparse);
+            return slot;
+        }
+
+        const std::vector<KeyGroup>* FindKeyed(int evt) const
+        {
+            if (!_anyKeyed.load(std::memory_order_relaxed))
+            {
+                return nullptr;
+            }
+
+            const KeyedEvents* keyed = _keyed.Load();
+            return keyed != nullptr ? keyed->Find(evt) : nullptr;
+        }
+
+        /// <summary>
+        /// the internal event of (evt, extractor, key), made on its first registration
+        /// </summary>
+        int KeyEvent(int evt, const EventSystem::KeyExtractor& extractor, uint64_t key)
+        {
+            KeyedEvents* keyed = _keyed.Load();
+            if (const std::vector<KeyGroup>* groups = keyed != nullptr ? keyed->Find(evt) : nullptr; groups != nullptr)
+            {
+                for (const KeyGroup& group : *groups)
+                {
+                    if (const int* id = group.extractor == extractor ? group.events.Find(key) : nullptr; id != nullptr)
+                    {
+                        ++_keyRefs.Find(*id)->count;
+                        return *id;
+                    }
+                }
+            }
+
+            int id = _nextKeyEvent;
+            if (_freeKeyEvents.empty())
+            {
+                assert(IsKeyEvent(_nextKeyEvent) && "too many keys");
+                ++_nextKeyEvent;
+            }
+            else
+            {
+                id = _freeKeyEvents.back();
+                _freeKeyEvents.pop_back();
+            }
+            _keyRefs[id] = KeyRef{ evt, extractor, key, 1 };
+
+            KeyedEvents* next = keyed == nullptr ? new KeyedEvents : Shared() ? new KeyedEvents(*keyed) : keyed;
+            std::vector<KeyGroup>& groups = (*next)[evt];
+            auto group = std::find_if(groups.begin(), groups.end(), [&](const KeyGroup& g) { return g.extractor == extractor; });
+            if (group == groups.end())
+            {
+                group = groups.insert(groups.end(), KeyGroup{ extractor, {} });
+            }
+            group->events[key] = id;
+            if (next != keyed)
+            {
+                _keyed.Store(next);
+                Retire(keyed);
+            }
+            _anyKeyed.store(true, std::memory_order_relaxed);
+            return id;
+        }
+
+        //the last registration of a key event is gone, its id is reused. a send that still found it only calls
+        //listeners whose key matches, they compare it themselves
+        void ReleaseKeyEvent(int id)
+        {
+            KeyRef* ref = _keyRefs.Find(id);
+            if (--ref->count > 0)
+            {
+                return;
+            }
+
+            const KeyRef dropped = *ref;
+            _keyRefs.Erase(id);
+            _freeKeyEvents.push_back(id);
+
+            KeyedEvents* keyed = _keyed.Load();
+            KeyedEvents* next = Shared() ? new KeyedEvents(*keyed) : keyed;
+            std::vector<KeyGroup>& groups = *next->Find(dropped.evt);
+            auto group = std::find_if(groups.begin(), groups.end(), [&](const KeyGroup& g) { return g.extractor == dropped.extractor; });
+            group->events.Erase(dropped.key);
+            if (group->events.Empty())
+            {
+                groups.erase(group);
+            }
+            if (groups.empty())
+            {
+                next->Erase(dropped.evt);
+            }
+            if (next != keyed)
+            {
+                _keyed.Store(next);
+                Retire(keyed);
+            }
+            _anyKeyed.store(!next->Empty(), std::memory_order_relaxed);
+        }
+
+        template <typename Fn>
+        void ForEachSlot(Fn&& fn)
+        {
+            for (auto& slot : _dense)
+            {
+                fn(slot);
+            }
+
+            if (SparseEvents* sparse = _sparse.Load(); sparse != nullptr)
+            {
+                sparse->ForEach([&fn](int, EventSlot& slot) { fn(slot); });
+            }
+        }
+
+        static EventSystem::CallBackHandle MakeHandle(uint32_t slot, uint32_t generation)
+        {
+            return ((EventSystem::CallBackHandle)generation << 32) | slot;
+        }
+
+        uint32_t AllocSlot()
+        {
+            if (_freeSlot == noPos)
+            {
+                _handles.emplace_back();
+                return (uint32_t)_handles.size() - 1;
+            }
+
+            const uint32_t slot = _freeSlot;
+            _freeSlot = _handles[slot].nextFree;
+            return slot;
+        }
+
+        void FreeSlot(uint32_t slot)
+        {
+            if (!_mailboxListeners.Empty())
+            {
+                DropMailbox(slot);
+            }
+            HandleSlot& h = _handles[slot];
+            h.live = false;
+            h.pending = false;
+            ++h.generation;
+            h.nextFree = _freeSlot;
+            _freeSlot = slot;
+        }
+
+        //calls of a RegisterOn listener still in its mailbox are skipped from now on
+        void DropMailbox(uint32_t slot)
+        {
+            if (std::shared_ptr<EventSystem::MailboxListener>* listener = _mailboxListeners.Find(slot); listener != nullptr)
+            {
+                (*listener)->live.store(false, std::memory_order_release);
+                _mailboxListeners.Erase(slot);
+            }
+        }
+
+        void IndexObject(const void* ob, uint32_t slot, uint32_t& pos)
+        {
+            ObjectSlots& slots = _byObject[ob];
+            pos = slots.Size();
+            slots.Push(slot);
+        }
+
+        //swap and pop, the moved registration learns its new position
+        void UnindexObject(const void* ob, uint32_t pos)
+        {
+            ObjectSlots* slots = _byObject.Find(ob);
+            const uint32_t last = slots->Size() - 1;
+            if (pos != last)
+            {
+                const uint32_t moved = (*slots)[last];
+                (*slots)[pos] = moved;
+                HandleSlot& m = _handles[moved];
+                (m.sd == ob && m.sdIndexPos == last ? m.sdIndexPos : m.rcIndexPos) = pos;
+            }
+            slots->Pop();
+            if (slots->Empty())
+            {
+                _byObject.Erase(ob);
+            }
+        }
+
+        //dead entries are skipped, their handle slot may already be reused
+        void Reindex(ListenerList& list, uint32_t from)
+        {
+            for (uint32_t i = from; i < list.Size(); ++i)
+            {
+                if (!list[i].Dead())
+                {
+                    _handles[list[i].slot].listPos = i;
+                }
+            }
+        }
+
+        //after Reindex of next, a send still walking list sees removals through it
+        void Forward(ListenerList& list, const ListenerList& next)
+        {
+            for (CallBackInfo& cbi : list)
+            {
+                if (!cbi.Dead())
+                {
+                    cbi.copy.store(&next.begin()[_handles[cbi.slot].listPos], std::memory_order_release);
+                }
+            }
+        }
+
+        EventSystem::CallBackHandle Add(int evt, const void* sd, const void* rc, EventSystem::FnCallBack&& cb, uint64_t signature, bool batch)
+        {
+            const uint32_t handleSlot = AllocSlot();
+            HandleSlot& h = _handles[handleSlot];
+            h.sd = sd;
+            h.rc = rc;
+            h.evt = evt;
+            h.live = true;
+            h.rcIndexPos = noPos;
+            Track(evt, sd, 1);
+            IndexObject(sd, handleSlot, h.sdIndexPos);
+            if (rc != sd)
+            {
+                IndexObject(rc, handleSlot, h.rcIndexPos);
+            }
+
+            CallBackInfo cbi(std::move(cb), rc, signature, handleSlot, h.generation, batch);
+            if (Deferring())
+            {
+                h.pending = true;
+                h.listPos = (uint32_t)_pendingAdds.size();
+                _pendingAdds.push_back(PendingAdd{ evt, sd, std::move(cbi) });
+                return MakeHandle(handleSlot, h.generation);
+            }
+
+            Insert(evt, sd, std::move(cbi));
+            return MakeHandle(handleSlot, h.generation);
+        }
+
+        void Insert(int evt, const void* sd, CallBackInfo&& cbi)
+        {
+            EventSlot& slot = GetSlot(evt);
+            EvtCallBackInfo* senders = slot.Load();
+            SenderListeners* listSlot = senders != nullptr ? senders->Find(sd) : nullptr;
+            ListenerList* list = listSlot != nullptr ? listSlot->list.Load() : nullptr;
+            if (senders != nullptr)
+            {
+                Invalidate(*senders, sd);
+            }
+
+            if (!Shared())
+            {
+                if (senders == nullptr)
+                {
+                    senders = new EvtCallBackInfo;
+                    slot.Store(senders);
+                }
+                if (list == nullptr || list->Full())
+                {
+                    ListenerList* grown = list != nullptr ? list->Grow() : ListenerList::Create(1, _resource);
+                    (*senders)[sd].list.Store(grown);
+                    delete list;
+                    list = grown;
+                }
+                Reindex(*list, list->Insert(std::move(cbi)));
+                return;
+            }
+
+            ListenerList* nextList = list != nullptr ? list->CopyIf([](const CallBackInfo&) { return true; }, 1) : ListenerList::Create(1, _resource);
+            Reindex(*nextList, nextList->Insert(std::move(cbi)));
+            if (list != nullptr)
+            {
+                Forward(*list, *nextList);
+            }
+            if (listSlot != nullptr)
+            {
+                listSlot->list.Store(nextList);
+                Retire(list);
+                return;
+            }
+
+            //new sender, the sender table itself has to be copied
+            EvtCallBackInfo* next = senders != nullptr ? new EvtCallBackInfo(*senders) : new EvtCallBackInfo;
+            (*next)[sd].list.Store(nextList);
+            slot.Store(next);
+            Retire(senders);
+        }
+
+        /// <summary>
+        /// drop the dead entries of the (evt, sd) list once they are at least half of it,
+        /// so removal stays O(1) amortized
+        /// </summary>
+        void Compact(EventSlot& slot, const void* sd)
+        {
+            EvtCallBackInfo* senders = slot.Load();
+            AtomicPtr<ListenerList>& listSlot = senders->Find(sd)->list;
+            ListenerList* list = listSlot.Load();
+            if (list->DeadCount() * 2 < list->Size())
+            {
+                return;
+            }
+
+            //entries move or go away, merged lists must not point at them
+            Invalidate(*senders, sd);
+
+            if (list->DeadCount() < list->Size())
+            {
+                if (!Shared())
+                {
+                    list->EraseDead();
+                    Reindex(*list, 0);
+                    return;
+                }
+
+                ListenerList* next = list->CopyIf([](const CallBackInfo& cbi) { return !cbi.Dead(); }, 0);
+                Reindex(*next, 0);
+                Forward(*list, *next);
+                listSlot.Store(next);
+                Retire(list);
+                return;
+            }
+
+            //nothing alive, the sender goes away
+            if (!Shared())
+            {
+                senders->Erase(sd);
+                delete list;
+                if (senders->Empty())
+                {
+                    slot.Store(nullptr);
+                    delete senders;
+                }
+                return;
+            }
+
+            EvtCallBackInfo* next = nullptr;
+            if (senders->Size() > 1)
+            {
+                next = new EvtCallBackInfo(*senders);
+                next->Erase(sd);
+            }
+            slot.Store(next);
+            Retire(senders);
+            Retire(list);
+        }
+
+        void RemoveSlot(uint32_t handleSlot)
+        {
+            HandleSlot& h = _handles[handleSlot];
+            if (h.pending)
+            {
+                //never called, so nothing runs it
+                CallBackInfo& cbi = _pendingAdds[h.listPos].cbi;
+                cbi.dead.store(true, std::memory_order_relaxed);
+                cbi.cb.Reset();
+                Unindex(h);
+                Track(h.evt, h.sd, -1);
+                const int evt = h.evt;
+                FreeSlot(handleSlot);
+                if (IsKeyEvent(evt))
+                {
+                    ReleaseKeyEvent(evt);
+                }
+                return;
+            }
+
+            EventSlot& slot = const_cast<EventSlot&>(*FindSlot(h.evt));
+            ListenerList& list = *slot.Load()->Find(h.sd)->list.Load();
+            list.MarkDead(h.listPos);
+            if (!Shared())
+            {
+                //nobody can be running it, release what the callable holds right away
+                list[h.listPos].cb.Reset();
+            }
+
+            Unindex(h);
+            Track(h.evt, h.sd, -1);
+            const int evt = h.evt;
+            const void* sd = h.sd;
+            FreeSlot(handleSlot);
+            if (!Deferring())
+            {
+                Compact(slot, sd);
+            }
+            else if (_compactLater.empty() || _compactLater.back() != std::pair(evt, sd))
+            {
+                _compactLater.emplace_back(evt, sd);
+            }
+
+            if (IsKeyEvent(evt))
+            {
+                ReleaseKeyEvent(evt);
+            }
+        }
+
+        /// <summary>
+        /// count a registration of evt from sd in or out of the listener filter of the bus, keyed ones under their event.
+        /// a bit is set before the listener is published and cleared after the last one is gone
+        /// </summary>
+        void Track(int evt, const void* sd, int delta)
+        {
+            using Filter = EventSystem::ListenerFilter;
+            if (IsKeyEvent(evt))
+            {
+                evt = _keyRefs.Find(evt)->evt;
+            }
+            const uint32_t e = Filter::EventBit(evt);
+            Mark(_filter->events, e, _filterEvents[e] += delta);
+            if (sd == nullptr)
+            {
+                Mark(_filter->wildcards, e, _filterWildcards[e] += delta);
+            }
+            else
+            {
+                const uint32_t h = Filter::SenderBit(sd);
+                Mark(_filter->senders, h, _filterSenders[h] += delta);
+            }
+        }
+
+        static void Mark(std::atomic<uint64_t>* bits, uint32_t i, uint32_t count)
+        {
+            const uint64_t bit = 1ull << (i % 64);
+            const bool set = (bits[i / 64].load(std::memory_order_relaxed) & bit) != 0;
+            if (count > 0 && !set)
+            {
+                bits[i / 64].fetch_or(bit, std::memory_order_relaxed);
+            }
+            else if (count == 0 && set)
+            {
+                bits[i / 64].fetch_and(~bit, std::memory_order_relaxed);
+            }
+        }
+
+        //a send of evt from sd would call a listener now
+        bool Listened(int evt, const void* sd) const
+        {
+            if (FindKeyed(evt) != nullptr)
+            {
+                return true;
+            }
+            const EventSlot* slot = FindSlot(evt);
+            const EvtCallBackInfo* senders = slot != nullptr ? slot->Load() : nullptr;
+            if (senders == nullptr)
+            {
+                return false;
+            }
+            auto alive = [](const SenderListeners* listeners)
+                {
+                    if (listeners != nullptr)
+                    {
+                        for (const CallBackInfo& cbi : *listeners->list.Load())
+                        {
+                            if (!cbi.Dead())
+                            {
+                                return true;
+                            }
+                        }
+                    }
+                    return false;
+                };
+            return (sd != nullptr && alive(senders->Find(sd))) || alive(senders->Find(nullptr));
+        }
+
+        void Unindex(const HandleSlot& h)
+        {
+            UnindexObject(h.sd, h.sdIndexPos);
+            if (h.rcIndexPos != noPos)
+            {
+                UnindexObject(h.rc, h.rcIndexPos);
+            }
+        }
+
+        /// <summary>
+        /// every registration sent by ob or received by ob, through the reverse index
+        /// </summary>
+        void Remove(const void* ob)
+        {
+            while (auto* slots = _byObject.Find(ob))
+            {
+                RemoveSlot(slots->Back());
+            }
+        }
+
+        void Remove(EventSystem::CallBackHandle id)
+        {
+            const uint32_t handleSlot = (uint32_t)id;
+            if (handleSlot < _handles.size() && _handles[handleSlot].live && _handles[handleSlot].generation == (uint32_t)(id >> 32))
+            {
+                RemoveSlot(handleSlot);
+            }
+        }
+
+        void RemoveAll()
+        {
+            ForEachSlot([this](EventSlot& slot)
+                {
+                    EvtCallBackInfo* senders = slot.Load();
+                    if (senders == nullptr)
+                    {
+                        return;
+                    }
+                    slot.Store(nullptr);
+                    senders->ForEach([this](const void*, SenderListeners& listSlot)
+                        {
+                            DropMerged(listSlot);
+                            Retire(listSlot.list.Load());
+                        });
+                    Retire(senders);
+                });
+
+            SparseEvents* sparse = _sparse.Load();
+            _sparse.Store(nullptr);
+            Retire(sparse);
+
+            KeyedEvents* keyed = _keyed.Load();
+            _keyed.Store(nullptr);
+            _anyKeyed.store(false, std::memory_order_relaxed);
+            Retire(keyed);
+            _keyRefs.Clear();
+            _freeKeyEvents.clear();
+            _nextKeyEvent = keyEventBase;
+
+            for (uint32_t i = 0; i < _handles.size(); ++i)
+            {
+                if (_handles[i].live)
+                {
+                    FreeSlot(i);
+                }
+            }
+            _byObject.Clear();
+            _pendingAdds.clear();
+            _compactLater.clear();
+
+            std::fill(std::begin(_filterEvents), std::end(_filterEvents), 0u);
+            std::fill(std::begin(_filterWildcards), std::end(_filterWildcards), 0u);
+            std::fill(std::begin(_filterSenders), std::end(_filterSenders), 0u);
+            for (auto* bits : { &_filter->events, &_filter->wildcards })
+            {
+                for (auto& word : *bits)
+                {
+                    word.store(0, std::memory_order_relaxed);
+                }
+            }
+            for (auto& word : _filter->senders)
+            {
+                word.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        bool HasListeners()
+        {
+            bool any = !_pendingAdds.empty();
+            ForEachSlot([&any](EventSlot& slot) { any = any || slot.Load() != nullptr; });
+            return any;
+        }
+
+        //lists made from now on come from resource, the ones retired before free into their own
+        void SetResource(std::pmr::memory_resource* resource, PooledMemory* pooled)
+        {
+            if (_pooled != nullptr)
+            {
+                _pooled->Release();
+            }
+            _resource = resource;
+            _pooled = pooled;
+        }
+
+        MemorySnapshot Memory()
+        {
+            FlatMap<int, EventMemory> events;
+            //keyed listeners are listed under their event, a key event whose last registration is gone under its own id
+            auto entry = [&](int evt) -> EventMemory&
+                {
+                    const KeyRef* ref = IsKeyEvent(evt) ? _keyRefs.Find(evt) : nullptr;
+                    EventMemory& m = events[ref != nullptr ? ref->evt : evt];
+                    m.evt = ref != nullptr ? ref->evt : evt;
+                    return m;
+                };
+            auto addCallable = [](EventMemory& m, const CallBackInfo& cbi)
+                {
+                    if (const size_t heap = cbi.cb.HeapSize(); heap > 0)
+                    {
+                        ++m.blocks;
+                        m.bytes += heap;
+                    }
+                };
+            auto addSlot = [&](int evt, EventSlot& slot)
+                {
+                    const EvtCallBackInfo* senders = slot.Load();
+                    if (senders == nullptr)
+                    {
+                        return;
+                    }
+                    EventMemory& m = entry(evt);
+                    m.blocks += senders->Bytes() > 0 ? 3 : 1;
+                    m.bytes += sizeof(EvtCallBackInfo) + senders->Bytes();
+                    senders->ForEach([&](const void*, const SenderListeners& listeners)
+                        {
+                            const ListenerList* list = listeners.list.Load();
+                            ++m.senders;
+                            ++m.blocks;
+                            m.bytes += ListenerList::Bytes(list->Capacity());
+                            for (const CallBackInfo& cbi : *list)
+                            {
+                                m.listeners += cbi.Dead() ? 0 : 1;
+                                addCallable(m, cbi);
+                            }
+                            if (const MergedList* merged = listeners.merged.Load(); merged != nullptr && merged != &noWildcard)
+                            {
+                                ++m.blocks;
+                                m.bytes += MergedList::Bytes(merged->capacity);
+                            }
+                        });
+                };
+
+            for (int evt = 0; evt < denseEventLimit; ++evt)
+            {
+                addSlot(evt, _dense[evt]);
+            }
+            if (SparseEvents* sparse = _sparse.Load(); sparse != nullptr)
+            {
+                sparse->ForEach(addSlot);
+            }
+            for (const PendingAdd& add : _pendingAdds)
+            {
+                if (!add.cbi.Dead())
+                {
+                    EventMemory& m = entry(add.evt);
+                    ++m.listeners;
+                    addCallable(m, add.cbi);
+                }
+            }
+
+            MemorySnapshot snapshot;
+            events.ForEach([&snapshot](int, const EventMemory& m) { snapshot.events.push_back(m); });
+            std::sort(snapshot.events.begin(), snapshot.events.end(), [](const EventMemory& a, const EventMemory& b) { return a.evt < b.evt; });
+
+            snapshot.tableBytes = sizeof(_dense) + _handles.capacity() * sizeof(HandleSlot) + _byObject.Bytes()
+                + _pendingAdds.capacity() * sizeof(PendingAdd) + _keyRefs.Bytes();
+            _byObject.ForEach([&snapshot](const void*, const ObjectSlots& slots)
+                {
+                    snapshot.tableBytes += slots.Size() > ObjectSlots::inlineCount ? (slots.Size() - ObjectSlots::inlineCount) * sizeof(uint32_t) : 0;
+                });
+            if (const SparseEvents* sparse = _sparse.Load(); sparse != nullptr)
+            {
+                snapshot.tableBytes += sizeof(SparseEvents) + sparse->Bytes();
+            }
+            if (const KeyedEvents* keyed = _keyed.Load(); keyed != nullptr)
+            {
+                snapshot.tableBytes += sizeof(KeyedEvents) + keyed->Bytes();
+                keyed->ForEach([&snapshot](int, const std::vector<KeyGroup>& groups)
+                    {
+                        snapshot.tableBytes += groups.capacity() * sizeof(KeyGroup);
+                        for (const KeyGroup& group : groups)
+                        {
+                            snapshot.tableBytes += group.events.Bytes();
+                        }
+                    });
+            }
+            snapshot.totalBytes = snapshot.tableBytes;
+            for (const EventMemory& m : snapshot.events)
+            {
+                snapshot.totalBytes += m.bytes;
+            }
+            return snapshot;
+        }
+
+        void DropMerged(SenderListeners& listeners)
+        {
+            MergedList* merged = listeners.merged.Load();
+            if (merged == nullptr)
+            {
+                return;
+            }
+
+            listeners.merged.Store(nullptr);
+            if (merged != &noWildcard)
+            {
+                --_mergedCount;
+                Retire(merged);
+            }
+        }
+
+        //a change to the list of sd stales its merged list, a change to the wildcard list stales them all
+        void Invalidate(EvtCallBackInfo& senders, const void* sd)
+        {
+            if (sd != nullptr)
+            {
+                if (SenderListeners* listeners = senders.Find(sd); listeners != nullptr)
+                {
+                    DropMerged(*listeners);
+                }
+                return;
+            }
+
+            senders.ForEach([this](const void*, SenderListeners& listeners) { DropMerged(listeners); });
+        }
+
+        /// <summary>
+        /// build and cache the merged list of (evt, sd) on its first send. null when it can not be cached now:
+        /// the cache is full, or in thread safe mode a writer holds the lock, the send then takes both lists
+        /// </summary>
+        const MergedList* Merge(int evt, const void* sd)
+        {
+            std::unique_lock<std::mutex> lock;
+            if (_threadSafe)
+            {
+                lock = std::unique_lock(_writeLock, std::try_to_lock);
+                if (!lock.owns_lock())
+                {
+                    return nullptr;
+                }
+            }
+
+            //the tables may have changed since the send looked, build from what is published now
+            const EventSlot* slot = FindSlot(evt);
+            EvtCallBackInfo* senders = slot != nullptr ? slot->Load() : nullptr;
+            SenderListeners* own = senders != nullptr ? senders->Find(sd) : nullptr;
+            if (own == nullptr)
+            {
+                return nullptr;
+            }
+            if (const MergedList* merged = own->merged.Load(); merged != nullptr)
+            {
+                return merged;
+            }
+
+            const SenderListeners* any = senders->Find(nullptr);
+            if (any == nullptr)
+            {
+                own->merged.Store(&noWildcard);
+                return &noWildcard;
+            }
+            if (_mergedCount >= _mergedLimit)
+            {
+                return nullptr;
+            }
+
+            MergedList* merged = MergedList::Create(*own->list.Load(), *any->list.Load(), _resource);
+            own->merged.Store(merged);
+            ++_mergedCount;
+            return merged;
+        }
+
+        void FreeRetired()
+        {
+            std::vector<std::pair<void*, void (*)(void*)>> retired;
+            retired.swap(_retired);
+            for (auto& [p, deleter] : retired)
+            {
+                deleter(p);
+            }
+        }
+
+        /// <summary>
+        /// what listeners changed while sends ran, applied once the outermost one returned: registrations join
+        /// their lists in the order they were made, then the lists that lost listeners are compacted
+        /// </summary>
+        void ApplyDeferred()
+        {
+            //taken out first, a callable released below may send and register again
+            std::vector<PendingAdd> adds;
+            adds.swap(_pendingAdds);
+            for (PendingAdd& add : adds)
+            {
+                if (!add.cbi.Dead())
+                {
+                    _handles[add.cbi.slot].pending = false;
+                    Insert(add.evt, add.sd, std::move(add.cbi));
+                }
+            }
+
+            std::vector<std::pair<int, const void*>> compact;
+            compact.swap(_compactLater);
+            for (const auto& [evt, sd] : compact)
+            {
+                const EventSlot* slot = FindSlot(evt);
+                EvtCallBackInfo* senders = slot != nullptr ? slot->Load() : nullptr;
+                if (senders != nullptr && senders->Find(sd) != nullptr)
+                {
+                    Compact(const_cast<EventSlot&>(*slot), sd);
+                }
+            }
+
+            //keep the capacity for the next send
+            adds.clear();
+            if (_pendingAdds.empty())
+            {
+                _pendingAdds.swap(adds);
+            }
+            compact.clear();
+            if (_compactLater.empty())
+            {
+                _compactLater.swap(compact);
+            }
+
+            if (!_retired.empty())
+            {
+                FreeRetired();
+            }
+        }
+
+        /// <summary>
+        /// tracks Call nesting on the owning thread when not in thread safe mode. inside it Unregister only marks
+        /// the entry dead, seen at once by the running sends, and Register is pending until the outermost send returns
+        /// </summary>
+        struct CallScope
+        {
+            explicit CallScope(EventSystemImp& imp) : _imp(imp) { ++_imp._callDepth; }
+            ~CallScope()
+            {
+                if (--_imp._callDepth == 0 && (!_imp._retired.empty() || !_imp._pendingAdds.empty() || !_imp._compactLater.empty()))
+                {
+                    _imp.ApplyDeferred();
+                }
+            }
+            EventSystemImp& _imp;
+        };
+
+        //serializes writers in thread safe mode only
+        std::unique_lock<std::mutex> LockWriter()
+        {
+            return _threadSafe ? std::unique_lock(_writeLock) : std::unique_lock<std::mutex>();
+        }
+
+        void StopDispatcher()
+        {
+            if (_dispatcher.joinable())
+            {
+                _stopDispatcher.store(true, std::memory_order_release);
+                _queue.Notify();
+                _dispatcher.join();
+            }
+        }
+
+        void ArmWait(EventWait& wait)
+        {
+            std::lock_guard lock(_timerLock);
+            if (!_timer.joinable())
+            {
+                _stopTimer = false;
+                _timer = std::thread([this]() { RunTimer(); });
+            }
+
+            wait.prev = nullptr;
+            wait.next = _timed;
+            if (_timed != nullptr)
+            {
+                _timed->prev = &wait;
+            }
+            _timed = &wait;
+            wait.linked = true;
+            _timerDirty = true;
+            _timerWake.notify_one();
+        }
+
+        //the timer queues a FlushDue once the earliest coalescing window ends
+        void ArmFlush(std::chrono::steady_clock::time_point due)
+        {
+            std::lock_guard lock(_timerLock);
+            if (due >= _flushAt)
+            {
+                return;
+            }
+            if (!_timer.joinable())
+            {
+                _stopTimer = false;
+                _timer = std::thread([this]() { RunTimer(); });
+            }
+            _flushAt = due;
+            _timerDirty = true;
+            _timerWake.notify_one();
+        }
+
+        void DisarmWait(EventWait& wait)
+        {
+            if (wait.deadline == std::chrono::steady_clock::time_point::max())
+            {
+                return;
+            }
+            std::lock_guard lock(_timerLock);
+            Unlink(wait);
+        }
+
+        /// <summary>
+        /// queue the resume of a wait that timed out or was stopped. when the Post queue refuses it,
+        /// the timer retries a bit later
+        /// </summary>
+        void QueueExpire(EventWait* wait, EventSystem::CallBackHandle handle)
+        {
+            if (_queue.Push([this, wait, handle]() { Expire(wait, handle); }))
+            {
+                return;
+            }
+
+            std::lock_guard lock(_timerLock);
+            _expired.emplace_back(wait, handle);
+            if (!_timer.joinable())
+            {
+                _stopTimer = false;
+                _timer = std::thread([this]() { RunTimer(); });
+            }
+            _timerDirty = true;
+            _timerWake.notify_one();
+        }
+
+        //a wait unregisters before its coroutine frame goes away, so a live handle means wait is still there
+        void Expire(EventWait* wait, EventSystem::CallBackHandle handle)
+        {
+            bool live = false;
+            {
+                auto lock = LockWriter();
+                const uint32_t handleSlot = (uint32_t)handle;
+                live = handleSlot < _handles.size() && _handles[handleSlot].live && _handles[handleSlot].generation == (uint32_t)(handle >> 32);
+            }
+
+            if (live)
+            {
+                wait->expire(wait);
+            }
+        }
+
+        /// <summary>
+        /// latest arguments of one coalesced (event, sender). the value stays constructed after delivery,
+        /// so the next send assigns into it
+        /// </summary>
+        struct CoalescedSlot
+        {
+            const void* sender = nullptr;
+            const EventSystem::CoalesceOps* ops = nullptr;
+            void* value = nullptr;
+            std::chrono::steady_clock::time_point due;
+            bool pending = false;
+        };
+
+        struct CoalescedEvent
+        {
+            ~CoalescedEvent()
+            {
+                for (CoalescedSlot& slot : slots)
+                {
+                    if (slot.value != nullptr)
+                    {
+                        slot.ops->destroy(slot.value);
+                        ::operator delete(slot.value, std::align_val_t(slot.ops->align));
+                    }
+                }
+            }
+
+            std::chrono::steady_clock::duration window{};
+            EventSystem::CoalesceReduce reduce;
+            const EventSystem::CoalesceOps* ops = nullptr;  //argument types, from the reducer or the first send
+            FlatMap<const void*, uint32_t> bySender;        //slot index + 1
+            std::vector<CoalescedSlot> slots;
+        };
+
+        std::unique_lock<std::mutex> LockCoalesce()
+        {
+            return _threadSafe ? std::unique_lock(_coalesceLock) : std::unique_lock<std::mutex>();
+        }
+
+        /// <summary>
+        /// keep the arguments of a send to a coalesced event, false when evt is not coalesced
+        /// </summary>
+        bool StoreCoalesced(int evt, const void* sender, const void* args, const EventSystem::CoalesceOps& ops)
+        {
+            auto lock = LockCoalesce();
+            std::unique_ptr<CoalescedEvent>* found = _coalesced.Find(evt);
+            if (found == nullptr)
+            {
+                return false;
+            }
+
+            CoalescedEvent& ce = **found;
+            assert((ce.ops == nullptr || ce.ops == &ops) && "a coalesced event is sent with other argument types");
+            if (ce.ops != nullptr && ce.ops != &ops)
+            {
+                return false;
+            }
+            ce.ops = &ops;
+
+            uint32_t& index = ce.bySender[sender];
+            if (index == 0)
+            {
+                ce.slots.push_back(CoalescedSlot{ .sender = sender, .ops = &ops, .value = nullptr, .due = {}, .pending = false });
+                index = (uint32_t)ce.slots.size();
+            }
+
+            CoalescedSlot& slot = ce.slots[index - 1];
+            if (slot.value == nullptr)
+            {
+                slot.value = ::operator new(ops.size, std::align_val_t(ops.align));
+                ops.construct(slot.value, args);
+            }
+            else if (slot.pending && ce.reduce)
+            {
+                ce.reduce(slot.value, args);
+            }
+            else
+            {
+                ops.assign(slot.value, args);
+            }
+
+            if (!slot.pending)
+            {
+                slot.pending = true;
+                _pendingCoalesced.emplace_back(evt, index - 1);
+                if (ce.window > std::chrono::steady_clock::duration::zero())
+                {
+                    slot.due = std::chrono::steady_clock::now() + ce.window;
+                    ArmFlush(slot.due);
+                }
+            }
+            return true;
+        }
+
+        /// <summary>
+        /// deliver pending coalesced events, all of them or only those due by dueBy, or only of event only.
+        /// the lock is released around each delivery, events that become pending meanwhile wait for the next flush
+        /// </summary>
+        size_t DeliverCoalesced(std::optional<std::chrono::steady_clock::time_point> dueBy, std::optional<int> only)
+        {
+            auto lock = LockCoalesce();
+            std::vector<std::pair<int, uint32_t>> batch;
+            batch.swap(_pendingCoalesced);
+
+            size_t delivered = 0;
+            size_t kept = 0;
+            auto next = std::chrono::steady_clock::time_point::max();
+            for (size_t i = 0; i < batch.size(); ++i)
+            {
+                const auto [evt, index] = batch[i];
+                std::unique_ptr<CoalescedEvent>* found = _coalesced.Find(evt);
+                if (found == nullptr || index >= (*found)->slots.size() || !(*found)->slots[index].pending)
+                {
+                    continue;
+                }
+
+                CoalescedSlot& slot = (*found)->slots[index];
+                if ((only && evt != *only) || (dueBy && slot.due > *dueBy))
+                {
+                    batch[kept++] = batch[i];
+                    if ((*found)->window > std::chrono::steady_clock::duration::zero())
+                    {
+                        next = std::min(next, slot.due);
+                    }
+                    continue;
+                }
+
+                slot.pending = false;
+                ++delivered;
+                slot.ops->deliver(*_es, evt, slot.sender, slot.value, lock);
+                if (lock.mutex() != nullptr)
+                {
+                    lock.lock();
+                }
+            }
+
+            batch.resize(kept);
+            batch.insert(batch.end(), _pendingCoalesced.begin(), _pendingCoalesced.end());
+            _pendingCoalesced.swap(batch);
+            lock = {};
+            if (dueBy && next != std::chrono::steady_clock::time_point::max())
+            {
+                ArmFlush(next);
+            }
+            return delivered;
+        }
+
+        void FlushDue()
+        {
+            DeliverCoalesced(std::chrono::steady_clock::now(), std::nullopt);
+        }
+
+        EventSystem::TimerHandle Schedule(std::chrono::steady_clock::time_point at, std::chrono::steady_clock::duration period, EventSystem::TimedSend* send)
+        {
+            bool wake = false;
+            TimingWheel::Handle handle = 0;
+            {
+                std::lock_guard lock(_wheelLock);
+                handle = _wheel.Schedule(at, period, send);
+                wake = WakeFor(at);
+            }
+            if (wake)
+            {
+                WakeTimer();
+            }
+            return handle;
+        }
+
+        bool CancelTimer(EventSystem::TimerHandle handle)
+        {
+            void* send = nullptr;
+            bool cancelled = false;
+            {
+                std::lock_guard lock(_wheelLock);
+                cancelled = _wheel.Cancel(handle, send);
+            }
+            delete static_cast<EventSystem::TimedSend*>(send);
+            return cancelled;
+        }
+
+        /// <summary>
+        /// take what is due off the wheel, deliver it without the lock so listeners may schedule and cancel,
+        /// then put periodic sends back and free the rest
+        /// </summary>
+        size_t TickTimers(std::chrono::steady_clock::time_point now)
+        {
+            std::vector<TimingWheel::Expired> due;
+            {
+                std::lock_guard lock(_wheelLock);
+                _wheel.Advance(now, due);
+            }
+            if (due.empty())
+            {
+                return 0;
+            }
+
+            for (const TimingWheel::Expired& e : due)
+            {
+                static_cast<EventSystem::TimedSend*>(e.data)->Deliver(*_es, !e.periodic);
+            }
+
+            {
+                std::lock_guard lock(_wheelLock);
+                for (TimingWheel::Expired& e : due)
+                {
+                    if (e.periodic)
+                    {
+                        e.data = _wheel.Rearm(e.handle);
+                    }
+                }
+            }
+            for (const TimingWheel::Expired& e : due)
+            {
+                delete static_cast<EventSystem::TimedSend*>(e.data);
+            }
+            ArmTick();
+            return due.size();
+        }
+
+        //the Tick the timer thread queued
+        void TickDue()
+        {
+            {
+                std::lock_guard lock(_wheelLock);
+                _tickQueued = false;
+                _wheelWake = std::chrono::steady_clock::time_point::max();
+            }
+            TickTimers(std::chrono::steady_clock::now());
+            ArmTick();
+        }
+
+        void SetManualTimers(bool manual)
+        {
+            {
+                std::lock_guard lock(_wheelLock);
+                _manualTimers = manual;
+                _wheelWake = std::chrono::steady_clock::time_point::max();
+            }
+            ArmTick();
+        }
+
+        bool SetTimerResolution(std::chrono::steady_clock::duration resolution)
+        {
+            std::lock_guard lock(_wheelLock);
+            if (_wheel.Size() != 0)
+            {
+                return false;
+            }
+            _wheel = TimingWheel(resolution);
+            return true;
+        }
+
+        struct FanOutOptions
+        {
+            uint32_t threshold = EventSystem::defaultParallelThreshold;
+            uint32_t chunk = EventSystem::defaultParallelChunk;
+        };
+
+        /// <summary>
+        /// fan out options of evt for this call, null when listeners run inline. only in thread safe mode
+        /// </summary>
+        const FanOutOptions* FindFanOut(int evt, EventSystem::CallMode mode) const
+        {
+            static constexpr FanOutOptions defaults;
+            const FlatMap<int, FanOutOptions>* options = _anyFanOut.load(std::memory_order_relaxed) ? _fanOut.Load() : nullptr;
+            const FanOutOptions* opt = options != nullptr ? options->Find(evt) : nullptr;
+            if (opt == nullptr && mode == EventSystem::CallMode::Parallel)
+            {
+                return &defaults;
+            }
+            return opt;
+        }
+
+        ThreadPool& Pool()
+        {
+            if (ThreadPool* pool = _poolPtr.load(std::memory_order_acquire); pool != nullptr)
+            {
+                return *pool;
+            }
+
+            std::lock_guard lock(_poolLock);
+            if (!_pool)
+            {
+                _pool = std::make_unique<ThreadPool>(_poolSize);
+                _poolPtr.store(_pool.get(), std::memory_order_release);
+            }
+            return *_pool;
+        }
+
+        EventSlot _dense[denseEventLimit];
+        AtomicPtr<SparseEvents> _sparse;
+        AtomicPtr<KeyedEvents> _keyed;
+        std::atomic<bool> _anyKeyed{ false };
+        FlatMap<int, KeyRef> _keyRefs;
+        std::vector<int> _freeKeyEvents;
+        int _nextKeyEvent = keyEventBase;
+        std::vector<std::pair<void*, void (*)(void*)>> _retired;
+        std::vector<PendingAdd> _pendingAdds;
+        std::vector<std::pair<int, const void*>> _compactLater;
+        std::mutex _writeLock;
+        std::vector<HandleSlot> _handles;
+        uint32_t _freeSlot = noPos;
+        //registrations behind each bit of the listener filter of the bus
+        EventSystem::ListenerFilter* _filter = nullptr;
+        uint32_t _filterEvents[EventSystem::ListenerFilter::denseEvents + 1] = {};
+        uint32_t _filterWildcards[EventSystem::ListenerFilter::denseEvents + 1] = {};
+        uint32_t _filterSenders[EventSystem::ListenerFilter::senderBits] = {};
+        std::pmr::memory_resource* _resource = nullptr;    //listener and merged lists, null for the global heap
+        PooledMemory* _pooled = nullptr;                    //the resource when it is the pool of SetPooledMemory
+        size_t _mergedCount = 0;
+        size_t _mergedLimit = 4096;     //(event, sender) pairs with a merged list, the rest take both lists
+        //registrations by sender and by recver, so Unregister(ob) only visits ob's own
+        FlatMap<const void*, ObjectSlots> _byObject;
+        FlatMap<uint32_t, std::shared_ptr<EventSystem::MailboxListener>> _mailboxListeners;   //RegisterOn listeners by handle slot
+        int _callDepth = 0;
+        bool _threadSafe = false;
+        MetricsRecorder _metrics;
+
+        EventQueue _queue;
+        std::thread _dispatcher;
+        std::atomic<bool> _stopDispatcher{ false };
+
+        AtomicPtr<FlatMap<int, FanOutOptions>> _fanOut;
+        std::atomic<bool> _anyFanOut{ false };
+        size_t _poolSize = ThreadPool::DefaultSize();
+        std::mutex _poolLock;
+        std::unique_ptr<ThreadPool> _pool;
+        std::atomic<ThreadPool*> _poolPtr{ nullptr };
+
+        //coalesced events, and the (event, slot) pairs pending delivery in the order they became pending
+        const EventSystem* _es = nullptr;
+        std::mutex _coalesceLock;
+        FlatMap<int, std::unique_ptr<CoalescedEvent>> _coalesced;
+        std::vector<std::pair<int, uint32_t>> _pendingCoalesced;
+
+        //timed co_await Next waits and coalescing windows, the timer thread starts on the first one
+        std::mutex _timerLock;
+        std::condition_variable _timerWake;
+        std::thread _timer;
+        bool _stopTimer = false;
+        bool _timerDirty = false;
+        std::chrono::steady_clock::time_point _flushAt = std::chrono::steady_clock::time_point::max();
+        EventWait* _timed = nullptr;
+        std::vector<std::pair<EventWait*, EventSystem::CallBackHandle>> _expired;
+
+        //scheduled sends, the timer thread queues a TickDue once the earliest is due. _wheelWake is when it looks next,
+        //read and written with the wheel so a send scheduled earlier than that always wakes it
+        std::mutex _wheelLock;
+        TimingWheel _wheel;
+        std::chrono::steady_clock::time_point _wheelWake = std::chrono::steady_clock::time_point::max();
+        bool _tickQueued = false;
+        bool _manualTimers = false;
+
+    private:
+        //with the wheel lock held: the timer thread sleeps past due and has to look again
+        bool WakeFor(std::chrono::steady_clock::time_point due)
+        {
+            if (_manualTimers || _tickQueued || due >= _wheelWake)
+            {
+                return false;
+            }
+            _wheelWake = due;
+            return true;
+        }
+
+        //wake the timer thread if the wheel has something due before it looks next
+        void ArmTick()
+        {
+            bool wake = false;
+            {
+                std::lock_guard lock(_wheelLock);
+                wake = WakeFor(_wheel.NextDue());
+            }
+            if (wake)
+            {
+                WakeTimer();
+            }
+        }
+
+        void WakeTimer()
+        {
+            std::lock_guard lock(_timerLock);
+            if (!_timer.joinable())
+            {
+                _stopTimer = false;
+                _timer = std::thread([this]() { RunTimer(); });
+            }
+            _timerDirty = true;
+            _timerWake.notify_one();
+        }
+
+        void Unlink(EventWait& wait)
+        {
+            if (!wait.linked)
+            {
+                return;
+            }
+            (wait.prev != nullptr ? wait.prev->next : _timed) = wait.next;
+            if (wait.next != nullptr)
+            {
+                wait.next->prev = wait.prev;
+            }
+            wait.prev = nullptr;
+            wait.next = nullptr;
+            wait.linked = false;
+        }
+
+        /// <summary>
+        /// sleeps until the earliest deadline, then moves every expired wait to Expiring and queues its resume.
+        /// a scan is O(timed waits), there are few of them next to the listeners
+        /// </summary>
+        void RunTimer()
+        {
+            std::vector<std::pair<EventWait*, EventSystem::CallBackHandle>> due;
+            std::unique_lock lock(_timerLock);
+            while (!_stopTimer)
+            {
+                _timerDirty = false;
+                const auto now = std::chrono::steady_clock::now();
+                auto next = std::chrono::steady_clock::time_point::max();
+                due.swap(_expired);
+                for (EventWait* wait = _timed; wait != nullptr; )
+                {
+                    EventWait* following = wait->next;
+                    if (wait->deadline > now)
+                    {
+                        next = std::min(next, wait->deadline);
+                    }
+                    else if (uint32_t expected = EventWait::Waiting; wait->state.compare_exchange_strong(expected, EventWait::Expiring, std::memory_order_acq_rel))
+                    {
+                        due.emplace_back(wait, wait->handle);
+                        Unlink(*wait);
+                    }
+                    wait = following;
+                }
+
+                bool flush = false;
+                if (_flushAt <= now)
+                {
+                    _flushAt = std::chrono::steady_clock::time_point::max();
+                    flush = true;
+                }
+                next = std::min(next, _flushAt);
+
+                bool tick = false;
+                {
+                    std::lock_guard wheel(_wheelLock);
+                    if (!_manualTimers && !_tickQueued)
+                    {
+                        _wheelWake = _wheel.NextDue();
+                        tick = _tickQueued = _wheelWake <= now;
+                        next = std::min(next, _wheelWake);
+                    }
+                }
+
+                if (!due.empty() || flush || tick)
+                {
+                    lock.unlock();
+                    for (auto [wait, handle] : due)
+                    {
+                        QueueExpire(wait, handle);
+                    }
+                    due.clear();
+                    flush = flush && !_queue.Push([this]() { FlushDue(); });
+                    tick = tick && !_queue.Push([this]() { TickDue(); });
+                    if (tick)
+                    {
+                        std::lock_guard wheel(_wheelLock);
+                        _tickQueued = false;
+                    }
+                    lock.lock();
+                    if (flush)
+                    {
+                        _flushAt = std::min(_flushAt, now + std::chrono::milliseconds(1));
+                        next = std::min(next, _flushAt);
+                    }
+                    if (tick)
+                    {
+                        next = std::min(next, now + std::chrono::milliseconds(1));
+                    }
+                }
+                if (!_expired.empty())
+                {
+                    next = std::min(next, now + std::chrono::milliseconds(1));
+                }
+
+                auto wake = [this]() { return _stopTimer || _timerDirty; };
+                if (next == std::chrono::steady_clock::time_point::max())
+                {
+                    _timerWake.wait(lock, wake);
+                }
+                else
+                {
+                    _timerWake.wait_until(lock, next, wake);
+                }
+            }
+        }
+
+        void StopTimer()
+        {
+            {
+                std::lock_guard lock(_timerLock);
+                _stopTimer = true;
+                _timerWake.notify_one();
+            }
+            if (_timer.joinable())
+            {
+                _timer.join();
+            }
+        }
+    };
+
+    EventSystemImp::MergedList EventSystemImp::noWildcard;
+
+    /// <summary>
+    /// every listener call of a walk goes through here, so metrics builds can time each one.
+    /// the end of one call is the start of the next, one clock read per call. listeners of other
+    /// arguments than the send's are passed by, one compare each
+    /// </summary>
+    struct CallTimer
+    {
+        void Invoke(EventSystemImp& imp, int evt, const void* sender, const EventSystemImp::CallBackInfo& cbi
+            , const EventSystem::CallBackParam* args)
+        {
+            if (cbi.signature != args->signature)
+            {
+                return;
+            }
+#if ES_METRICS
+            cbi.cb(args);
+            const uint64_t now = MetricsRecorder::Now();
+            //a slow listener report runs user code, keep it out of the next call
+            mark = imp._metrics.RecordCall(evt, sender, cbi.rc, EventSystemImp::MakeHandle(cbi.slot, cbi.generation), now - mark)
+                ? MetricsRecorder::Now() : now;
+#else
+            (void)imp;
+            (void)evt;
+            (void)sender;
+            cbi.cb(args);
+#endif
+        }
+
+#if ES_METRICS
+        uint64_t mark = MetricsRecorder::Now();
+#endif
+    };
+
+    /// <summary>
+    /// one fanned out listener walk. the sender and the pool workers claim chunks from a shared counter,
+    /// so the sender finishes alone if the pool is busy and a nested parallel send can not deadlock
+    /// </summary>
+    struct FanOutState
+    {
+        struct Range
+        {
+            const EventSystemImp::CallBackInfo* begin;
+            const EventSystemImp::CallBackInfo* end;
+            const void* sender;
+        };
+
+        void AddChunks(const EventSystemImp::ListenerList& list, const void* sender, uint32_t chunk)
+        {
+            for (auto it = list.begin(); it != list.end(); )
+            {
+                auto end = (size_t)(list.end() - it) > chunk ? it + chunk : list.end();
+                chunks.push_back(Range{ it, end, sender });
+                it = end;
+            }
+        }
+
+        void Work()
+        {
+            for (size_t i = next.fetch_add(1, std::memory_order_relaxed); i < chunks.size(); i = next.fetch_add(1, std::memory_order_relaxed))
+            {
+                try
+                {
+                    CallTimer timer;
+                    for (auto cbi = chunks[i].begin; cbi != chunks[i].end; ++cbi)
+                    {
+                        if (!cbi->Dead())
+                        {
+                            timer.Invoke(*imp, evt, chunks[i].sender, *cbi, args);
+                        }
+                    }
+                }
+                catch (...)
+                {
+                    std::lock_guard lock(errorLock);
+                    if (!error)
+                    {
+                        error = std::current_exception();
+                    }
+                }
+
+                if (completed.fetch_add(1, std::memory_order_acq_rel) + 1 == chunks.size())
+                {
+                    completed.notify_all();
+                }
+            }
+        }
+
+        /// <summary>
+        /// the sender works too, and asks at most one helper per remaining chunk
+        /// </summary>
+        static void Run(const std::shared_ptr<FanOutState>& state, ThreadPool& pool, bool senderWorks)
+        {
+            const size_t helpers = std::min(pool.Size(), state->chunks.size() - (senderWorks ? 1 : 0));
+            for (size_t i = 0; i < helpers; ++i)
+            {
+                pool.Submit([state]() { state->Work(); });
+            }
+
+            if (senderWorks)
+            {
+                state->Work();
+                state->Wait();
+            }
+        }
+
+        bool Done() const
+        {
+            return completed.load(std::memory_order_acquire) == chunks.size();
+        }
+
+        void Wait()
+        {
+            for (size_t done = completed.load(std::memory_order_acquire); done < chunks.size(); done = completed.load(std::memory_order_acquire))
+            {
+                completed.wait(done, std::memory_order_acquire);
+            }
+
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+
+        std::vector<Range> chunks;
+        EventSystemImp* imp = nullptr;
+        int evt = 0;
+        const EventSystem::CallBackParam* args = nullptr;
+        std::atomic<size_t> next{ 0 };
+        std::atomic<size_t> completed{ 0 };
+        std::mutex errorLock;
+        std::exception_ptr error;
+
+        //SendAsync only, keep the arguments and the listener snapshot alive after the sender returned
+        std::unique_ptr<EventSystem::FanOutPayload> payload;
+        std::optional<EpochReclaimer::Pin> pin;
+    };
+
+    bool FanOut::Done() const
+    {
+        return _state == nullptr || _state->Done();
+    }
+
+    void FanOut::Wait() const
+    {
+        if (_state != nullptr)
+        {
+            _state->Wait();
+        }
+    }
+
+    EventSystem::EventSystem()
+        : _imp(new EventSystemImp)
+        , _queue(&_imp->_queue)
+    {
+        _imp->_es = this;
+        _imp->_filter = &_filter;
+    }
+
+    EventSystem::EventSystem(std::thread::id owner)
+        : EventSystem()
+    {
+        _owner = owner;
+    }
+
+    EventSystem::~EventSystem()
+    {
+        delete _imp;
+    }
+
+    void EventSystem::SetOwnerThread(std::thread::id owner)
+    {
+        _owner = owner;
+    }
+
+    void EventSystem::SetCoalesce(int evt, std::chrono::steady_clock::duration window, CoalesceReduce&& reduce, const CoalesceOps* ops)
+    {
+        StopCoalesce(evt);
+        auto lock = _imp->LockCoalesce();
+        auto& ce = _imp->_coalesced[evt];
+        ce = std::make_unique<EventSystemImp::CoalescedEvent>();
+        ce->window = window;
+        ce->reduce = std::move(reduce);
+        ce->ops = ops;
+        _coalescing.store(true, std::memory_order_release);
+    }
+
+    void EventSystem::StopCoalesce(int evt)
+    {
+        _imp->DeliverCoalesced(std::nullopt, evt);
+        auto lock = _imp->LockCoalesce();
+        _imp->_coalesced.Erase(evt);
+        std::erase_if(_imp->_pendingCoalesced, [evt](const std::pair<int, uint32_t>& p) { return p.first == evt; });
+        _coalescing.store(!_imp->_coalesced.Empty(), std::memory_order_release);
+    }
+
+    bool EventSystem::StoreCoalesced(int evt, const void* sender, const void* args, const CoalesceOps& ops) const
+    {
+        return _imp->StoreCoalesced(evt, sender, args, ops);
+    }
+
+    size_t EventSystem::Flush()
+    {
+        return _imp->DeliverCoalesced(std::nullopt, std::nullopt);
+    }
+
+    EventSystem::TimerHandle EventSystem::Schedule(std::chrono::steady_clock::time_point at, std::chrono::steady_clock::duration period, TimedSend* send)
+    {
+        return _imp->Schedule(at, period, send);
+    }
+
+    bool EventSystem::CancelTimer(TimerHandle handle)
+    {
+        return _imp->CancelTimer(handle);
+    }
+
+    size_t EventSystem::Tick(std::chrono::steady_clock::time_point now)
+    {
+        return _imp->TickTimers(now);
+    }
+
+    void EventSystem::SetManualTimers(bool manual)
+    {
+        _imp->SetManualTimers(manual);
+    }
+
+    bool EventSystem::SetTimerResolution(std::chrono::steady_clock::duration resolution)
+    {
+        return _imp->SetTimerResolution(resolution);
+    }
+
+    void EventSystem::ArmWait(EventWait& wait)
+    {
+        _imp->ArmWait(wait);
+    }
+
+    void EventSystem::DisarmWait(EventWait& wait)
+    {
+        _imp->DisarmWait(wait);
+    }
+
+    void EventSystem::ExpireWait(EventWait& wait)
+    {
+        _imp->QueueExpire(&wait, wait.handle);
+    }
+
+    size_t EventSystem::Pump(size_t maxEvents)
+    {
+        return _queue->Pump(maxEvents);
+    }
+
+    void EventSystem::SetPostQueue(size_t capacity, QueueFullPolicy policy)
+    {
+        _queue->Reset(capacity, policy);
+    }
+
+    void EventSystem::StartDispatcher()
+    {
+        if (_imp->_dispatcher.joinable())
         {
-            EventSystem::FnCallBack cb;
-            EventSystem::CallBackHandle id = 0;
-        };
+            return;
+        }
 
-        std::map<int, std::map<const void*, std::map<const void*, std::forward_list<CallBackInfo>>>> _listeners;
-        EventSystem::CallBackHandle _id = 0;
-    };
+        SetThreadSafe(true);
+        _imp->_stopDispatcher.store(false, std::memory_order_relaxed);
+        _imp->_dispatcher = std::thread([this]()
+            {
+                while (!_imp->_stopDispatcher.load(std::memory_order_acquire))
+                {
+                    if (_queue->Pump() == 0)
+                    {
+                        _queue->Wait([this]() { return _imp->_stopDispatcher.load(std::memory_order_acquire); });
+                    }
+                }
+                _queue->Pump();
+            });
+    }
 
-    EventSystemImp imp;
+    void EventSystem::StopDispatcher()
+    {
+        _imp->StopDispatcher();
+    }
 
+    void EventSystem::SetThreadSafe(bool threadSafe)
+    {
+        std::lock_guard lock(_imp->_writeLock);
+        _imp->_threadSafe = threadSafe;
+        EpochReclaimer::Collect();
+    }
 
-    EventSystem::EventSystem()
-        : _imp(&imp)
+    bool EventSystem::IsThreadSafe() const
     {
+        return _imp->_threadSafe;
+    }
+
+    MetricsSnapshot EventSystem::Metrics() const
+    {
+        return _imp->_metrics.Snapshot();
+    }
 
+    void EventSystem::ResetMetrics()
+    {
+        _imp->_metrics.Reset();
+    }
+
+    void EventSystem::SetSlowListener(double budgetNs, SlowListenerCallback callback)
+    {
+        _imp->_metrics.SetSlowListener(budgetNs, std::move(callback));
     }
 
     void EventSystem::Unregister(const void* ob)
     {
-        for (auto& l : _imp->_listeners)
+        auto lock = _imp->LockWriter();
+        _imp->Remove(ob);
+    }
+
+    void EventSystem::Unregister(CallBackHandle id)
+    {
+        auto lock = _imp->LockWriter();
+        _imp->Remove(id);
+    }
+
+    void EventSystem::Clear()
+    {
+        auto lock = _imp->LockWriter();
+        _imp->RemoveAll();
+    }
+
+
+    EventSystem::CallBackHandle EventSystem::Reg(int evt, const void* sd, const void* rc, FnCallBack&& cb, uint64_t signature, bool batch)
+    {
+        assert(!EventSystemImp::IsKeyEvent(evt) && "the lowest event ids are the internal events of keyed listeners");
+        auto lock = _imp->LockWriter();
+        return _imp->Add(evt, sd, rc, std::move(cb), signature, batch);
+    }
+
+    EventSystem::CallBackHandle EventSystem::RegMailbox(int evt, const void* sd, const void* rc, FnCallBack&& cb, uint64_t signature, std::shared_ptr<MailboxListener>&& listener)
+    {
+        if (!IsThreadSafe())
+        {
+            SetThreadSafe(true);
+        }
+        auto lock = _imp->LockWriter();
+        const CallBackHandle handle = _imp->Add(evt, sd, rc, std::move(cb), signature, false);
+        _imp->_mailboxListeners[(uint32_t)handle] = std::move(listener);
+        return handle;
+    }
+
+    EventSystem::CallBackHandle EventSystem::RegKeyed(int evt, const void* sd, const void* rc, FnCallBack&& cb, uint64_t signature, const KeyExtractor& extractor, uint64_t key)
+    {
+        auto lock = _imp->LockWriter();
+        return _imp->Add(_imp->KeyEvent(evt, extractor, key), sd, rc, std::move(cb), signature, false);
+    }
+
+    static void inline DoCall(EventSystemImp& imp, int evt, const EventSystemImp::EvtCallBackInfo& listeners
+        , const void* sender, const EventSystem::CallBackParam* args, const EventSystemImp::FanOutOptions* fanOut)
+    {
+        if (auto recvers = listeners.Find(sender); recvers != nullptr)
         {
-            l.second.erase(ob);
-            for (auto& item : l.second)
+            const EventSystemImp::ListenerList& list = *recvers->list.Load();
+            if (fanOut != nullptr && list.Size() >= fanOut->threshold)
+            {
+                auto state = std::make_shared<FanOutState>();
+                state->AddChunks(list, sender, fanOut->chunk);
+                state->imp = &imp;
+                state->evt = evt;
+                state->args = args;
+                FanOutState::Run(state, imp.Pool(), true);
+                return;
+            }
+
+            CallTimer timer;
+            for (auto& cbi : list)
             {
-                item.second.erase(ob);
+                if (!cbi.Dead())
+                {
+                    timer.Invoke(imp, evt, sender, cbi, args);
+                }
             }
         }
     }
 
-    void EventSystem::Unregister(CallBackHandle id)
+    //the sender's own list, then the wildcard one unless the send has no sender
+    static void FindLists(const EventSystemImp::EvtCallBackInfo& evtPairs, const void* sender, const EventSystemImp::ListenerList* (&lists)[2])
+    {
+        if (auto recvers = evtPairs.Find(sender); recvers != nullptr)
+        {
+            lists[0] = recvers->list.Load();
+        }
+        if (auto recvers = evtPairs.Find(nullptr); sender != nullptr && recvers != nullptr)
+        {
+            lists[1] = recvers->list.Load();
+        }
+    }
+
+    /// <summary>
+    /// a send that hands its arguments over: listeners get them without the right to move, except the last one alive
+    /// that takes them. each listener runs once the next live one is found, so whether it is the last is known by then
+    /// </summary>
+    static void DispatchLast(EventSystemImp& imp, int evt, const EventSystemImp::EvtCallBackInfo& evtPairs, const void* sender
+        , const EventSystem::CallBackParam* args)
     {
-        for (auto& l : _imp->_listeners)
+        const EventSystemImp::ListenerList* lists[2] = {};
+        const void* senders[2] = { sender, nullptr };
+        FindLists(evtPairs, sender, lists);
+
+        EventSystem::CallBackParam shared = *args;
+        shared.movable = 0;
+        const EventSystemImp::CallBackInfo* pending = nullptr;
+        const void* pendingSender = nullptr;
+        CallTimer timer;
+        for (int l = 0; l < 2; ++l)
         {
-            for (auto& snd : l.second)
+            if (lists[l] == nullptr)
+            {
+                continue;
+            }
+            for (auto& cbi : *lists[l])
             {
-                for (auto& rcv : snd.second)
+                if (cbi.Dead() || cbi.signature != args->signature)
+                {
+                    continue;
+                }
+                if (pending != nullptr && !pending->Dead())
                 {
-                    std::erase_if(rcv.second, [id](const auto& cbi) { return cbi.id == id; });
+                    timer.Invoke(imp, evt, pendingSender, *pending, &shared);
                 }
+                pending = &cbi;
+                pendingSender = senders[l];
             }
         }
+
+        if (pending != nullptr && !pending->Dead())
+        {
+            timer.Invoke(imp, evt, pendingSender, *pending, args);
+        }
     }
 
-    void EventSystem::Clear()
+    /// <summary>
+    /// a sender with listeners of its own goes through its merged list, one lookup and one loop.
+    /// fanned out sends split each list on its own size, so they look both up. slotEvt is the event the lists
+    /// belong to, the internal event of a key for keyed listeners
+    /// </summary>
+    static void inline Dispatch(EventSystemImp& imp, int evt, int slotEvt, const EventSystemImp::EvtCallBackInfo& evtPairs, const void* sender
+        , const EventSystem::CallBackParam* args, const EventSystemImp::FanOutOptions* fanOut = nullptr)
+    {
+        if (args->movable != 0)
+        {
+            DispatchLast(imp, evt, evtPairs, sender, args);
+            return;
+        }
+
+        if (fanOut != nullptr || sender == nullptr)
+        {
+            DoCall(imp, evt, evtPairs, sender, args, fanOut);
+
+            //sender is not null, send to both null listeners and obj listeners
+            if (sender != nullptr)
+            {
+                DoCall(imp, evt, evtPairs, nullptr, args, fanOut);
+            }
+            return;
+        }
+
+        const auto own = evtPairs.Find(sender);
+        if (own == nullptr)
+        {
+            DoCall(imp, evt, evtPairs, nullptr, args, nullptr);
+            return;
+        }
+
+        const EventSystemImp::MergedList* merged = own->merged.Load();
+        if (merged == nullptr)
+        {
+            merged = imp.Merge(slotEvt, sender);
+        }
+
+        CallTimer timer;
+        if (merged != nullptr && merged != &EventSystemImp::noWildcard)
+        {
+            const EventSystemImp::CallBackInfo* const* entries = merged->begin();
+            for (uint32_t i = 0; i < merged->size; ++i)
+            {
+                if (!entries[i]->Dead())
+                {
+                    timer.Invoke(imp, evt, i < merged->split ? sender : nullptr, *entries[i], args);
+                }
+            }
+            return;
+        }
+
+        for (auto& cbi : *own->list.Load())
+        {
+            if (!cbi.Dead())
+            {
+                timer.Invoke(imp, evt, sender, cbi, args);
+            }
+        }
+
+        //not cached, the wildcard list is looked up on its own
+        if (merged == nullptr)
+        {
+            DoCall(imp, evt, evtPairs, nullptr, args, nullptr);
+        }
+    }
+
+    //the internal event of the key the arguments have for each key extractor of the event
+    template <typename Fn>
+    static void ForEachKey(EventSystemImp& imp, const std::vector<EventSystemImp::KeyGroup>& groups, const EventSystem::CallBackParam* args, Fn&& fn)
+    {
+        for (const auto& group : groups)
+        {
+            uint64_t key = 0;
+            const int* id = group.extractor.hash(group.extractor.keyOf, args, key) ? group.events.Find(key) : nullptr;
+            const auto slot = id != nullptr ? imp.FindSlot(*id) : nullptr;
+            if (const auto evtPairs = slot != nullptr ? slot->Load() : nullptr; evtPairs != nullptr)
+            {
+                fn(*id, *evtPairs);
+            }
+        }
+    }
+
+    //a live listener of the walk takes these arguments, the sender's own or a wildcard one
+    static bool Accepts(const EventSystemImp::EvtCallBackInfo& evtPairs, const void* sender, const EventSystem::CallBackParam* args)
     {
-        _imp->_listeners.clear();
+        const EventSystemImp::ListenerList* lists[2] = {};
+        FindLists(evtPairs, sender, lists);
+        for (const EventSystemImp::ListenerList* list : lists)
+        {
+            if (list != nullptr && std::any_of(list->begin(), list->end(), [&](const EventSystemImp::CallBackInfo& cbi) { return !cbi.Dead() && cbi.signature == args->signature; }))
+            {
+                return true;
+            }
+        }
+        return false;
     }
 
+    /// <summary>
+    /// the listeners without key, then the ones of the key of the arguments. handed over arguments go to
+    /// the last walk with a listener that takes them, a key group whose listeners are all dead or of other
+    /// arguments does not use them up
+    /// </summary>
+    static void DispatchKeyed(EventSystemImp& imp, int evt, const EventSystemImp::EvtCallBackInfo* evtPairs, const std::vector<EventSystemImp::KeyGroup>& groups
+        , const void* sender, const EventSystem::CallBackParam* args, const EventSystemImp::FanOutOptions* fanOut)
+    {
+        EventSystem::CallBackParam shared = *args;
+        shared.movable = 0;
+        int last = -1;
+        if (args->movable != 0)
+        {
+            int walk = 0;
+            last = evtPairs != nullptr && Accepts(*evtPairs, sender, args) ? 0 : -1;
+            ForEachKey(imp, groups, args, [&](int, const EventSystemImp::EvtCallBackInfo& keyPairs)
+                {
+                    ++walk;
+                    last = Accepts(keyPairs, sender, args) ? walk : last;
+                });
+        }
+
+        if (evtPairs != nullptr)
+        {
+            Dispatch(imp, evt, evt, *evtPairs, sender, last == 0 ? args : &shared, fanOut);
+        }
+        int walk = 0;
+        ForEachKey(imp, groups, args, [&](int id, const EventSystemImp::EvtCallBackInfo& keyPairs)
+            {
+                ++walk;
+                Dispatch(imp, evt, id, keyPairs, sender, last == walk ? args : &shared, fanOut);
+            });
+    }
 
-    EventSystem::CallBackHandle EventSystem::Reg(int evt, const void* sd, const void* rc, FnCallBack&& cb)
+    void EventSystem::Call(int evtID, const void* sender, const EventSystem::CallBackParam* args, CallMode mode) const
     {
-        _imp->_listeners[evt][sd][rc].push_front(EventSystemImp::CallBackInfo{ std::move(cb), ++_imp->_id });
-        return _imp->_id;
+#if ES_METRICS
+        _imp->_metrics.RecordSend(evtID);
+#endif
+        if (_imp->_threadSafe)
+        {
+            EpochReclaimer::ReadGuard guard;
+            const auto slot = _imp->FindSlot(evtID);
+            const auto evtPairs = slot != nullptr ? slot->Load() : nullptr;
+            if (const auto keyed = _imp->FindKeyed(evtID); keyed != nullptr)
+            {
+                DispatchKeyed(*_imp, evtID, evtPairs, *keyed, sender, args, _imp->FindFanOut(evtID, mode));
+            }
+            else if (evtPairs != nullptr)
+            {
+                Dispatch(*_imp, evtID, evtID, *evtPairs, sender, args, _imp->FindFanOut(evtID, mode));
+            }
+            return;
+        }
+
+        const auto slot = _imp->FindSlot(evtID);
+        const auto evtPairs = slot != nullptr ? slot->Load() : nullptr;
+        const auto keyed = _imp->FindKeyed(evtID);
+        if (evtPairs == nullptr && keyed == nullptr)
+        {
+            return;
+        }
+
+        EventSystemImp::CallScope scope(*_imp);
+        if (keyed != nullptr)
+        {
+            DispatchKeyed(*_imp, evtID, evtPairs, *keyed, sender, args, nullptr);
+        }
+        else
+        {
+            Dispatch(*_imp, evtID, evtID, *evtPairs, sender, args);
+        }
     }
 
-    static void inline DoCall(std::map<const void*, std::map<const void*, std::forward_list<EventSystemImp::CallBackInfo>>>& listeners
-        , const void* sender, const EventSystem::CallBackParam* args)
+    /// <summary>
+    /// listener-major hands every listener the whole batch. event-major gives span listeners the batch up front,
+    /// then walks the payloads with a one payload view of the batch. keyed listeners get the payloads of their key
+    /// one at a time, after the listeners without key
+    /// </summary>
+    static void DispatchBatch(EventSystemImp& imp, int evt, const EventSystemImp::EvtCallBackInfo* evtPairs, const std::vector<EventSystemImp::KeyGroup>* keyed
+        , const void* sender, const EventSystem::CallBackParam* batch, BatchOrder order)
     {
-        if (auto recvers = listeners.find(sender); recvers != listeners.end())
+        const EventSystemImp::ListenerList* lists[2] = {};
+        const void* senders[2] = { sender, nullptr };
+        CallTimer timer;
+        if (evtPairs != nullptr)
+        {
+            FindLists(*evtPairs, sender, lists);
+        }
+
+        for (int l = 0; l < 2; ++l)
         {
-            for (auto& item : recvers->second)
+            if (lists[l] == nullptr)
             {
-                for (auto& cbi : item.second)
+                continue;
+            }
+            for (auto& cbi : *lists[l])
+            {
+                if (!cbi.Dead() && (order == BatchOrder::ListenerMajor || cbi.batch))
+                {
+                    timer.Invoke(imp, evt, senders[l], cbi, batch);
+                }
+            }
+        }
+
+        if (order == BatchOrder::ListenerMajor && keyed == nullptr)
+        {
+            return;
+        }
+
+        EventSystem::CallBackParam one = *batch;
+        one.batchSize = 1;
+        const char* payload = static_cast<const char*>(batch->p);
+        for (uint32_t i = 0; i < batch->batchSize; ++i, payload += batch->paramSize)
+        {
+            one.p = payload;
+            for (int l = 0; l < 2 && order == BatchOrder::EventMajor; ++l)
+            {
+                if (lists[l] == nullptr)
+                {
+                    continue;
+                }
+                for (auto& cbi : *lists[l])
                 {
-                    cbi.cb(args);
+                    if (!cbi.Dead() && !cbi.batch)
+                    {
+                        timer.Invoke(imp, evt, senders[l], cbi, &one);
+                    }
                 }
             }
+
+            if (keyed != nullptr)
+            {
+                ForEachKey(imp, *keyed, &one, [&](int id, const EventSystemImp::EvtCallBackInfo& keyPairs)
+                    {
+                        Dispatch(imp, evt, id, keyPairs, sender, &one);
+                    });
+            }
         }
     }
 
-    void EventSystem::Call(int evtID, const void* sender, const EventSystem::CallBackParam* args) const
+    void EventSystem::CallBatch(int evtID, const void* sender, const CallBackParam* batch, BatchOrder order) const
     {
-        auto evtPairs = _imp->_listeners.find(evtID);
-        if (evtPairs == _imp->_listeners.end())
+#if ES_METRICS
+        _imp->_metrics.RecordSend(evtID);
+#endif
+        if (_imp->_threadSafe)
+        {
+            EpochReclaimer::ReadGuard guard;
+            const auto slot = _imp->FindSlot(evtID);
+            const auto evtPairs = slot != nullptr ? slot->Load() : nullptr;
+            const auto keyed = _imp->FindKeyed(evtID);
+            if (evtPairs != nullptr || keyed != nullptr)
+            {
+                DispatchBatch(*_imp, evtID, evtPairs, keyed, sender, batch, order);
+            }
+            return;
+        }
+
+        const auto slot = _imp->FindSlot(evtID);
+        const auto evtPairs = slot != nullptr ? slot->Load() : nullptr;
+        const auto keyed = _imp->FindKeyed(evtID);
+        if (evtPairs == nullptr && keyed == nullptr)
         {
             return;
         }
 
-        DoCall(evtPairs->second, sender, args);
+        EventSystemImp::CallScope scope(*_imp);
+        DispatchBatch(*_imp, evtID, evtPairs, keyed, sender, batch, order);
+    }
+
+    FanOut EventSystem::CallAsync(int evtID, const void* sender, std::unique_ptr<FanOutPayload>&& payload)
+    {
+        if (!_imp->_threadSafe)
+        {
+            SetThreadSafe(true);
+        }
+
+        auto state = std::make_shared<FanOutState>();
+        EpochReclaimer::ReadGuard guard;
+        const EventSystemImp::FanOutOptions* fanOut = _imp->FindFanOut(evtID, CallMode::Parallel);
+        auto addLists = [&](const EventSystemImp::EvtCallBackInfo& evtPairs)
+            {
+                if (auto recvers = evtPairs.Find(sender); recvers != nullptr)
+                {
+                    state->AddChunks(*recvers->list.Load(), sender, fanOut->chunk);
+                }
+                if (auto recvers = evtPairs.Find(nullptr); sender != nullptr && recvers != nullptr)
+                {
+                    state->AddChunks(*recvers->list.Load(), nullptr, fanOut->chunk);
+                }
+            };
+        const auto slot = _imp->FindSlot(evtID);
+        if (const auto evtPairs = slot != nullptr ? slot->Load() : nullptr; evtPairs != nullptr)
+        {
+            addLists(*evtPairs);
+        }
+        if (const auto keyed = _imp->FindKeyed(evtID); keyed != nullptr)
+        {
+            ForEachKey(*_imp, *keyed, &payload->cbp, [&](int, const EventSystemImp::EvtCallBackInfo& keyPairs) { addLists(keyPairs); });
+        }
+
+        if (state->chunks.empty())
+        {
+            return FanOut(std::move(state));
+        }
+
+        state->payload = std::move(payload);
+        state->imp = _imp;
+        state->evt = evtID;
+        state->args = &state->payload->cbp;
+        state->pin.emplace();
+        FanOutState::Run(state, _imp->Pool(), false);
+        return FanOut(std::move(state));
+    }
+
+    void EventSystem::SetFanOut(int evt, uint32_t threshold, uint32_t chunk)
+    {
+        if (!_imp->_threadSafe)
+        {
+            SetThreadSafe(true);
+        }
+
+        std::lock_guard lock(_imp->_writeLock);
+        const FlatMap<int, EventSystemImp::FanOutOptions>* options = _imp->_fanOut.Load();
+        auto next = options != nullptr ? new FlatMap<int, EventSystemImp::FanOutOptions>(*options) : new FlatMap<int, EventSystemImp::FanOutOptions>;
+        if (threshold == 0)
+        {
+            next->Erase(evt);
+        }
+        else
+        {
+            (*next)[evt] = EventSystemImp::FanOutOptions{ threshold, chunk == 0 ? 1 : chunk };
+        }
+        _imp->_fanOut.Store(next);
+        _imp->_anyFanOut.store(!next->Empty(), std::memory_order_relaxed);
+        _imp->Retire(const_cast<FlatMap<int, EventSystemImp::FanOutOptions>*>(options));
+    }
+
+    void EventSystem::SetDispatchCacheLimit(size_t pairs)
+    {
+        auto lock = _imp->LockWriter();
+        _imp->_mergedLimit = pairs;
+        if (_imp->_mergedCount > pairs)
+        {
+            _imp->ForEachSlot([this](EventSystemImp::EventSlot& slot)
+                {
+                    if (EventSystemImp::EvtCallBackInfo* senders = slot.Load(); senders != nullptr)
+                    {
+                        _imp->Invalidate(*senders, nullptr);
+                    }
+                });
+        }
+    }
+
+    bool EventSystem::AnyListener(int evt, const void* sender) const
+    {
+        if (_imp->_threadSafe)
+        {
+            EpochReclaimer::ReadGuard guard;
+            return _imp->Listened(evt, sender);
+        }
+        return _imp->Listened(evt, sender);
+    }
+
+    bool EventSystem::SetMemoryResource(std::pmr::memory_resource* resource)
+    {
+        auto lock = _imp->LockWriter();
+        if (_imp->HasListeners())
+        {
+            return false;
+        }
+        _imp->SetResource(resource, nullptr);
+        return true;
+    }
 
-        //sender is not null, send to both null listeners and obj listeners
-        if (sender != nullptr)
+    bool EventSystem::SetPooledMemory(const std::pmr::pool_options& options)
+    {
+        auto lock = _imp->LockWriter();
+        if (_imp->HasListeners())
         {
-            DoCall(evtPairs->second, nullptr, args);
+            return false;
         }
+        PooledMemory* pooled = new PooledMemory(options);
+        _imp->SetResource(pooled, pooled);
+        return true;
+    }
+
+    MemorySnapshot EventSystem::MemoryStats() const
+    {
+        auto lock = _imp->LockWriter();
+        return _imp->Memory();
+    }
+
+    const EventMemory* MemorySnapshot::Find(int evt) const
+    {
+        auto it = std::lower_bound(events.begin(), events.end(), evt, [](const EventMemory& m, int e) { return m.evt < e; });
+        return it != events.end() && it->evt == evt ? &*it : nullptr;
+    }
+
+    void EventSystem::SetWorkerCount(size_t workers)
+    {
+        std::lock_guard lock(_imp->_poolLock);
+        _imp->_poolSize = workers;
+        _imp->_poolPtr.store(nullptr, std::memory_order_release);
+        _imp->_pool.reset();
     }
-}
\ No newline at end of file
+}
@@ -2,8 +2,32 @@
 //all rights reserved
 #pragma once
 #include <tuple>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
 #include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "Delegate.hpp"
+#include "EventLog.hpp"
+#include "EventQueue.hpp"
+#include "FlatMap.hpp"
+#include "Mailbox.hpp"
+#include "Metrics.hpp"
+#include "SharedRing.hpp"
 
 namespace es
 {
@@ -13,33 +37,63 @@ namespace es
         using TupleType = std::tuple<std::add_lvalue_reference_t<std::add_const_t<std::decay_t<Args>>>...>;
     };
 
+    //bytes of the decayed arguments, the stride of a batch of one argument
     template <typename ...Args>
     struct ArgumentStatistic
     {
-        static constexpr uint32_t size = (uint32_t)(... + sizeof(std::decay_t<Args>));
-        static constexpr uint32_t pointerCount = (uint32_t)(... + std::is_pointer_v<std::decay_t<Args>>);
-        static constexpr uint32_t classCount = (uint32_t)(... + std::is_class_v<std::decay_t<Args>>);
+        static constexpr uint32_t size = (uint32_t)(0 + ... + sizeof(std::decay_t<Args>));
     };
 
-    template <>
-    struct ArgumentStatistic<>
+    /// <summary>
+    /// 64 bit FNV-1a of the name the compiler gives this instantiation, which spells out Args. two lists of types
+    /// get the same value only if they are the same types, or by a hash collision. types of anonymous namespaces
+    /// in different files may share a name and so a fingerprint. the name is the compiler's own, so the value is only
+    /// compared inside one process, logs and shared rings carry LogSignature and check ToolchainSignature instead
+    /// </summary>
+    template <typename ...Args>
+    constexpr uint64_t Fingerprint()
     {
-        static constexpr uint32_t size = 0;
-        static constexpr uint32_t pointerCount = 0;
-        static constexpr uint32_t classCount = 0;
-    };
+#if defined(_MSC_VER) && !defined(__clang__)
+        constexpr std::string_view name = __FUNCSIG__;
+#else
+        constexpr std::string_view name = __PRETTY_FUNCTION__;
+#endif
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (const char c : name)
+        {
+            hash = (hash ^ (uint8_t)c) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    //what a send and the listeners it reaches must agree on, see EventSystem::CallBackParam::signature
+    template <typename ...Args>
+    constexpr uint64_t signatureOf = Fingerprint<std::decay_t<Args>...>();
 
     template<typename T>
     struct FunctionTraits;
 
+    //bit i set when argument i may be moved from by the listener called last
+    template <bool... Movable>
+    constexpr uint32_t MoveMask()
+    {
+        uint32_t mask = 0;
+        uint32_t bit = 1;
+        ((mask |= Movable ? bit : 0, bit <<= 1), ...);
+        return mask;
+    }
+
+    //a non const rvalue, the sender gives it away
+    template <typename T>
+    constexpr bool rvalueArg = !std::is_lvalue_reference_v<T> && !std::is_const_v<std::remove_reference_t<T>>;
+
     template<typename ReturnType, typename... Args>
     struct FunctionTraits<ReturnType(Args...)>
     {
         using TupleType = typename TupleTypeFromArgs<Args...>::TupleType;
-        static constexpr uint32_t size = ArgumentStatistic<Args...>::size;
-        static constexpr uint32_t pointerCount = ArgumentStatistic<Args...>::pointerCount;
-        static constexpr uint32_t classCount = ArgumentStatistic<Args...>::classCount;
+        using ParamTypes = std::tuple<Args...>;     //as declared, only a type list
         static constexpr uint32_t count = sizeof...(Args);
+        static constexpr uint64_t signature = signatureOf<Args...>;
     };
 
     template<typename ReturnType, typename... Args>
@@ -61,156 +115,1831 @@ struct FunctionTraits<ReturnType(ClassType::*)(Args...) __VA_ARGS__> : FunctionT
 
     template<typename Callable>
     struct FunctionTraits : FunctionTraits<decltype(&Callable::operator())> {};
+
+    /// <summary>
+    /// signature of a typed event, declared once by specializing on the event id:
+    /// template <> struct es::EventSignature<EventID::NewJob> { using Type = void(int, const std::string&); };
+    /// Send/Post/Register given the event id as template argument are then checked against it at compile time
+    /// </summary>
+    template <auto EventID>
+    struct EventSignature;
+
+    template <auto EventID>
+    concept TypedEvent = requires { typename EventSignature<EventID>::Type; };
+
+    template <typename Signature>
+    struct EventArgs;
+
+    template <bool Optional, typename... Args>
+    class NextEvent;
+
+    template <typename... Events>
+    class StaticEventBus;
+
+    template <typename ReturnType, typename... Args>
+    struct EventArgs<ReturnType(Args...)>
+    {
+        using TupleType = typename TupleTypeFromArgs<Args...>::TupleType;
+        using ValueType = std::tuple<std::decay_t<Args>...>;
+        using ParamTypes = std::tuple<Args...>;
+        static constexpr uint64_t signature = signatureOf<Args...>;
+
+        template <bool Optional>
+        using Awaiter = NextEvent<Optional, std::decay_t<Args>...>;
+
+        //the arguments of a send convert to the parameters the same way a function call would
+        template <typename... Ts>
+        static constexpr bool sendable = std::is_invocable_v<void (*)(const std::decay_t<Args>&...), Ts...>;
+
+        //Obj is the recver pointer passed first, for recver listeners. by value and rvalue parameters are passed an rvalue
+        template <typename F, typename... Obj>
+        static constexpr bool listenable = std::is_invocable_v<const F&, Obj...
+            , std::conditional_t<std::is_lvalue_reference_v<Args>, const std::decay_t<Args>&, std::decay_t<Args>>...>;
+
+        //a converted argument is a temporary bound to a reference to const, it is never moved from
+        template <typename... Ts>
+        static constexpr uint32_t movable = MoveMask<(rvalueArg<Ts> && std::is_same_v<std::decay_t<Ts>, std::decay_t<Args>>)...>();
+    };
     
 
+    /// <summary>
+    /// completion handle of EventSystem::SendAsync
+    /// </summary>
+    class FanOut
+    {
+    public:
+        FanOut() = default;
+
+        /// <summary>
+        /// true once every listener has run
+        /// </summary>
+        [[nodiscard]] bool Done() const;
+
+        /// <summary>
+        /// block until every listener has run, rethrows the first exception a listener threw
+        /// </summary>
+        void Wait() const;
+
+    private:
+        friend class EventSystem;
+        explicit FanOut(std::shared_ptr<struct FanOutState> state) : _state(std::move(state)) {}
+        std::shared_ptr<struct FanOutState> _state;
+    };
+
+    /// <summary>
+    /// delivery order of EventSystem::SendBatch
+    /// </summary>
+    enum class BatchOrder
+    {
+        EventMajor,     //every listener gets a payload before the next payload, like Send in a loop
+        ListenerMajor,  //each listener gets the whole batch before the next listener, one call per listener
+    };
+
+    /// <summary>
+    /// what the listeners of one event hold, see EventSystem::MemoryStats. keyed listeners count for their event
+    /// </summary>
+    struct EventMemory
+    {
+        int evt = 0;
+        size_t listeners = 0;       //registrations alive or waiting for a send to return, dead ones not compacted yet are not counted
+        size_t senders = 0;         //senders with a list of their own, the wildcard one included
+        size_t blocks = 0;          //allocations: the sender table, listener lists, merged lists and callables too big for a listener
+        size_t bytes = 0;
+    };
+
+    struct MemorySnapshot
+    {
+        std::vector<EventMemory> events;    //events with listeners, by id
+        size_t tableBytes = 0;              //handles, the index by object and the event tables, shared by all events
+        size_t totalBytes = 0;              //tableBytes and the bytes of all events
+
+        [[nodiscard]] const EventMemory* Find(int evt) const;
+    };
+
+    /// <summary>
+    /// the part of a co_await EventSystem::Next that does not depend on the payload.
+    /// a listener, a timeout and a stop request race for it through state, the winner resumes the coroutine
+    /// </summary>
+    struct EventWait
+    {
+        enum State : uint32_t
+        {
+            Arming,     //being registered, nothing may resume it yet
+            Waiting,
+            Fired,      //a send won, its listener resumes the coroutine
+            Expiring,   //a timeout or stop won, the resume is queued on the bus
+            Done,
+        };
+
+        std::atomic<uint32_t> state{ Arming };
+        uint64_t handle = 0;
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+        void (*expire)(EventWait* wait) = nullptr;
+        //links of the timeout list of the bus, guarded by its timer lock
+        EventWait* prev = nullptr;
+        EventWait* next = nullptr;
+        bool linked = false;
+    };
+
     class EventSystem
     {
     public:
-        using CallBackHandle = uint32_t;
+        //slot index in the low half, generation in the high half, so a stale handle never hits a newer registration
+        using CallBackHandle = uint64_t;
         struct CallBackParam
         {
             const void* p = nullptr;
-            //ruff runtime checks
-            uint32_t paramCount = 0;
+            //signatureOf the arguments. a listener is only called by sends of its own signature,
+            //so listeners of one event may take different arguments
+            uint64_t signature = 0;
             uint32_t paramSize = 0;
-            uint32_t pointerParamCount = 0;
-            uint32_t classCount = 0;
+            //0 for a single event. otherwise p points to batchSize payloads of one argument, paramSize apart
+            uint32_t batchSize = 0;
+            //bit i set when the listener called last may move argument i out, see SendMove
+            uint32_t movable = 0;
 
-            bool IsTypeValid(uint32_t count, uint32_t size, uint32_t pointer, uint32_t klass) const
+            bool IsTypeValid(uint64_t expected) const
             {
-                return paramCount == count && paramSize == size && pointerParamCount == pointer && classCount == klass;
+                return signature == expected;
             }
         };
 
     public:
-        static inline [[nodiscard]]EventSystem& Inst()
+        /// <summary>
+        /// an independent bus, its listener table, Post queue and worker pool are its own
+        /// </summary>
+        EventSystem();
+
+        /// <summary>
+        /// a bus owned by one thread, see SetOwnerThread
+        /// </summary>
+        explicit EventSystem(std::thread::id owner);
+        ~EventSystem();
+
+        /// <summary>
+        /// the process wide bus
+        /// </summary>
+        [[nodiscard]] static inline EventSystem& Inst()
         {
             static EventSystem es;
             return es;
         }
 
+        /// <summary>
+        /// the bus of the calling thread, created on first use and destroyed when the thread exits.
+        /// it is owned by the thread, so it runs without locks and other threads Send to it through its Post queue
+        /// </summary>
+        [[nodiscard]] static inline EventSystem& Local()
+        {
+            thread_local EventSystem es(std::this_thread::get_id());
+            return es;
+        }
+
+        /// <summary>
+        /// bind the bus to owner. Send, SendAll, SendMove, SendBatch, SendParallel and typed Send from any other thread
+        /// are then forwarded to the Post queue and delivered when the owner runs Pump, so arguments are copied and
+        /// pointers must stay valid until then. SendAsync is not forwarded. Register and Unregister stay on the owner
+        /// thread unless thread safe. a default id unbinds, set it before other threads start using the bus
+        /// </summary>
+        void SetOwnerThread(std::thread::id owner = std::this_thread::get_id());
+
+        /// <summary>
+        /// call the listeners of evtID from sender and the ones registered without sender. the arguments are not copied,
+        /// listeners read them through references to const, a listener taking one by value or by rvalue reference gets a copy
+        /// </summary>
         template <typename EventType, typename ...Args>
-        void Send(EventType evtID, const void* sender, Args... args) const
+        void Send(EventType evtID, const void* sender, Args&&... args) const
         {
             static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
-            const typename TupleTypeFromArgs<Args...>::TupleType evt(std::forward<Args>(args)...);
-            const EventSystem::CallBackParam cbp{ .p = &evt, 
-                .paramCount = sizeof...(Args), 
-                .paramSize = ArgumentStatistic<Args...>::size, 
-                .pointerParamCount = ArgumentStatistic<Args...>::pointerCount,
-                .classCount = ArgumentStatistic<Args...>::classCount
-            };
-            Call((int)evtID, sender, &cbp);
+            if (Forwarded())
+            {
+                PushCall((int)evtID, sender, std::forward<Args>(args)...);
+                return;
+            }
+            if constexpr (coalescable<std::decay_t<Args>...>)
+            {
+                if (_coalescing.load(std::memory_order_relaxed) && Coalesce<std::decay_t<Args>...>((int)evtID, sender, args...))
+                {
+                    return;
+                }
+            }
+            CallWith<std::decay_t<Args>...>((int)evtID, sender, 0, args...);
         }
 
         template <typename EventType, typename ...Args>
-        void SendAll(EventType evtID, Args... args) const
+        void SendAll(EventType evtID, Args&&... args) const
         {
-            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
-            const typename TupleTypeFromArgs<Args...>::TupleType evt(std::forward<Args>(args)...);
-            const EventSystem::CallBackParam cbp{ .p = &evt,
-                .paramCount = sizeof...(Args),
-                .paramSize = ArgumentStatistic<Args...>::size,
-                .pointerParamCount = ArgumentStatistic<Args...>::pointerCount,
-                .classCount = ArgumentStatistic<Args...>::classCount
-            };
-            Call((int)evtID, nullptr, &cbp);
+            Send(evtID, nullptr, std::forward<Args>(args)...);
         }
 
         /// <summary>
-        /// listen to object sender's sent event only
+        /// Send that hands the rvalue arguments to the listener called last: a by value or rvalue reference parameter
+        /// of it takes them by move, the listeners before it get copies. that is how move only payloads such as
+        /// std::unique_ptr reach a listener. an argument is only moved from when that listener asks for it.
+        /// a listener before it with a move only parameter is skipped and counted, see RejectedMoves.
+        /// fan out does not apply, and arguments that can not be copied are never coalesced
         /// </summary>
-        /// <typeparam name="EventType">any enum</typeparam>
-        /// <typeparam name="F">any callerable</typeparam>
-        /// <param name="evtID">event id</param>
-        /// <param name="sender">the target object to listen to. pass nullptr is any object's event is wanted</param>
-        /// <param name="f">any non member function, callables</param>
-        /// <returns>the id of the registration</returns>
-        template <typename EventType, typename F>
-        CallBackHandle Register(EventType evtID, const void* sender, F&& f)
+        template <typename EventType, typename ...Args>
+        void SendMove(EventType evtID, const void* sender, Args&&... args) const
         {
             static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
-            FnCallBack callBack = MakeCBStorage(std::forward<F>(f));
-            return Reg((int)evtID, sender, nullptr, std::move(callBack));
+            if (Forwarded())
+            {
+                PushCall((int)evtID, sender, std::forward<Args>(args)...);
+                return;
+            }
+            if constexpr (coalescable<std::decay_t<Args>...>)
+            {
+                if (_coalescing.load(std::memory_order_relaxed) && Coalesce<std::decay_t<Args>...>((int)evtID, sender, args...))
+                {
+                    return;
+                }
+            }
+            CallWith<std::decay_t<Args>...>((int)evtID, sender, MoveMask<rvalueArg<Args>...>(), args...);
         }
 
         /// <summary>
-        /// listen to object sent event, with member function as callback
+        /// true if a send of evtID from sender would call a listener now, nullptr asks for the listeners without sender.
+        /// keyed listeners of evtID count whatever their key. on the sending thread, or any thread in thread safe mode
         /// </summary>
-        template <typename EventType, typename RC, typename F>
-        CallBackHandle Register(EventType evtID, const void* sender, const RC* recver, F&& f)
+        template <typename EventType>
+        [[nodiscard]] bool HasListeners(EventType evtID, const void* sender = nullptr) const
         {
             static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
-            static_assert(std::is_class_v<RC>);
-            FnCallBack cb = MakeCBStorage(recver, std::forward<F>(f));
-            return Reg((int)evtID, sender, recver, std::move(cb));
+            return _filter.MayListen((int)evtID, sender) && AnyListener((int)evtID, sender);
         }
 
         /// <summary>
-        /// unregister any event with sender or recver that is obj
+        /// SendMove of the payload factory() returns, made only when a listener would get it. a recorder or another
+        /// process subscribed to the bus gets every send, so it is made for them too
         /// </summary>
-        void Unregister(const void* ob);
+        template <typename EventType, typename Factory>
+        void SendLazy(EventType evtID, const void* sender, Factory&& factory) const
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            static_assert(std::is_invocable_v<Factory&>, "factory takes no arguments and returns the payload");
+            if (Unheard((int)evtID, sender) || (!Forwarded() && !Observed() && !AnyListener((int)evtID, sender)))
+            {
+                return;
+            }
+            SendMove(evtID, sender, factory());
+        }
 
         /// <summary>
-        /// unregister any event with id which is return by Register
+        /// send every payload of a contiguous range, with the listeners looked up once for the whole batch.
+        /// listeners take the payload as their only argument, span listeners from RegisterBatch get the whole batch in one call
         /// </summary>
-        /// <param name="id"></param>
-        void Unregister(CallBackHandle id);
-        void Clear();
-
-    private:
-        EventSystem();
+        template <typename EventType, std::ranges::contiguous_range Range>
+        void SendBatch(EventType evtID, const void* sender, const Range& payloads, BatchOrder order = BatchOrder::EventMajor) const
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            using T = std::ranges::range_value_t<Range>;
+            if (std::ranges::empty(payloads))
+            {
+                return;
+            }
 
-        using FnCallBack = std::function<void(const CallBackParam*)>;
+            if (Forwarded())
+            {
+                _queue->Push([this, evt = (int)evtID, sender, batch = std::vector<T>(std::ranges::begin(payloads), std::ranges::end(payloads)), order]()
+                    {
+                        CallBatchWith(evt, sender, batch, order);
+                    });
+                return;
+            }
+            CallBatchWith((int)evtID, sender, payloads, order);
+        }
 
-        CallBackHandle Reg(int evt, const void* sd, const void* rc, FnCallBack&& cb);
-        void Call(int evt, const void* sd, const EventSystem::CallBackParam* args) const;
+        template <typename EventType, std::ranges::contiguous_range Range>
+        void SendAllBatch(EventType evtID, const Range& payloads, BatchOrder order = BatchOrder::EventMajor) const
+        {
+            SendBatch(evtID, nullptr, payloads, order);
+        }
 
-        template <typename F>
-        static auto MakeCBStorage(F&& f)
+        /// <summary>
+        /// typed send, EventID must have an EventSignature. a mismatch with it is a compile error,
+        /// and listeners registered with the typed Register run with no runtime type check
+        /// </summary>
+        template <auto EventID, typename ...Ts>
+        void Send(const void* sender, Ts&&... args) const
         {
-            return [f = std::forward<F>(f)](const CallBackParam* p)
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            using Signature = typename EventSignature<EventID>::Type;
+            static_assert(EventArgs<Signature>::template sendable<Ts...>, "arguments do not match the EventSignature of EventID");
+            if (Forwarded())
+            {
+                PushTyped<EventID>(sender, std::forward<Ts>(args)...);
+                return;
+            }
+            if constexpr (coalescable<typename EventArgs<Signature>::ValueType>)
+            {
+                if (_coalescing.load(std::memory_order_relaxed) && CoalesceTyped((int)EventID, sender, std::type_identity<Signature>(), std::forward<Ts>(args)...))
                 {
-                    using TupleType = typename FunctionTraits<F>::TupleType;
-                    const TupleType* eventBody = reinterpret_cast<const TupleType*>(p->p);
-                    const uint32_t paramCount = FunctionTraits<F>::count;
-                    const uint32_t paramSize = FunctionTraits<F>::size;
-                    const uint32_t pointerParamCount = FunctionTraits<F>::pointerCount;
-                    const uint32_t classParamCount = FunctionTraits<F>::classCount;
+                    return;
+                }
+            }
+            //before the arguments convert to the signature
+            if (Unheard((int)EventID, sender))
+            {
+                return;
+            }
+            CallTyped((int)EventID, sender, std::type_identity<Signature>(), 0, std::forward<Ts>(args)...);
+        }
 
-                    assert(p->IsTypeValid(paramCount, paramSize, pointerParamCount, classParamCount));
-                    std::apply(f, *eventBody);
-                };
+        template <auto EventID, typename ...Ts>
+        void SendAll(Ts&&... args) const
+        {
+            Send<EventID>(nullptr, std::forward<Ts>(args)...);
         }
 
-        template <typename OBJ, typename F>
-        static auto MakeCBStorage(const OBJ* obj, F&& f)
+        /// <summary>
+        /// listener calls skipped since the process started, on any bus, because the listener takes a move only argument
+        /// by value or rvalue reference and the send did not hand that argument to it: a plain Send, or a SendMove
+        /// to a listener that was not called last. such a call would have to steal the payload from the one called last
+        /// </summary>
+        [[nodiscard]] static uint64_t RejectedMoves()
         {
-            return [f = std::forward<F>(f), obj = const_cast<OBJ*>(obj)](const CallBackParam* p)
+            return _rejectedMoves.load(std::memory_order_relaxed);
+        }
+
+        /// <summary>
+        /// typed SendMove, rvalue arguments of exactly the EventSignature parameter types are handed to the last listener
+        /// </summary>
+        template <auto EventID, typename ...Ts>
+        void SendMove(const void* sender, Ts&&... args) const
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            using Signature = typename EventSignature<EventID>::Type;
+            static_assert(EventArgs<Signature>::template sendable<Ts...>, "arguments do not match the EventSignature of EventID");
+            if (Forwarded())
+            {
+                PushTyped<EventID>(sender, std::forward<Ts>(args)...);
+                return;
+            }
+            if constexpr (coalescable<typename EventArgs<Signature>::ValueType>)
+            {
+                if (_coalescing.load(std::memory_order_relaxed) && CoalesceTyped((int)EventID, sender, std::type_identity<Signature>(), std::forward<Ts>(args)...))
                 {
-                    using TupleType = typename FunctionTraits<F>::TupleType;
-                    const TupleType* eventBody = reinterpret_cast<const TupleType*>(p->p);
+                    return;
+                }
+            }
+            if (Unheard((int)EventID, sender))
+            {
+                return;
+            }
+            CallTyped((int)EventID, sender, std::type_identity<Signature>(), EventArgs<Signature>::template movable<Ts...>, std::forward<Ts>(args)...);
+        }
+
+        /// <summary>
+        /// typed SendLazy, factory returns the argument of an event with one parameter, a std::tuple of them otherwise
+        /// </summary>
+        template <auto EventID, typename Factory>
+        void SendLazy(const void* sender, Factory&& factory) const
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            static_assert(std::is_invocable_v<Factory&>, "factory takes no arguments and returns the payload");
+            if (Unheard((int)EventID, sender) || (!Forwarded() && !Observed() && !AnyListener((int)EventID, sender)))
+            {
+                return;
+            }
+            if constexpr (FunctionTraits<typename EventSignature<EventID>::Type>::count == 1)
+            {
+                SendMove<EventID>(sender, factory());
+            }
+            else
+            {
+                std::apply([&](auto&&... args) { SendMove<EventID>(sender, std::forward<decltype(args)>(args)...); }, factory());
+            }
+        }
 
-                    const uint32_t paramCount = FunctionTraits<F>::count;
-                    const uint32_t paramSize = FunctionTraits<F>::size;
-                    const uint32_t pointerParamCount = FunctionTraits<F>::pointerCount;
-                    const uint32_t classParamCount = FunctionTraits<F>::classCount;
+        /// <summary>
+        /// queue the event instead of calling listeners now, they are called later on the thread that runs Pump,
+        /// or on the dispatcher thread. arguments are copied or moved into a preallocated queue slot,
+        /// so they may refer to temporaries of the caller. the queue owns them, so the last listener may move them out like SendMove
+        /// </summary>
+        /// <returns>false if the queue is full and its policy is QueueFullPolicy::Drop</returns>
+        template <typename EventType, typename ...Args>
+        bool Post(EventType evtID, const void* sender, Args&&... args)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            return PushCall((int)evtID, sender, std::forward<Args>(args)...);
+        }
 
-                    assert(p->IsTypeValid(paramCount, paramSize, pointerParamCount, classParamCount));
-                    std::apply(std::bind_front(f, obj), *eventBody);
-                };
+        template <typename EventType, typename ...Args>
+        bool PostAll(EventType evtID, Args&&... args)
+        {
+            return Post(evtID, nullptr, std::forward<Args>(args)...);
         }
 
-    private:
-        friend struct EventSystemImp;
-        EventSystem(const EventSystem&) = delete;
-        void operator=(const EventSystem&) = delete;
-        struct EventSystemImp* _imp;
-    };
+        /// <summary>
+        /// typed Post, the arguments are converted to the EventSignature parameters when queued
+        /// </summary>
+        template <auto EventID, typename ...Ts>
+        bool Post(const void* sender, Ts&&... args)
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            using Signature = typename EventSignature<EventID>::Type;
+            static_assert(EventArgs<Signature>::template sendable<Ts...>, "arguments do not match the EventSignature of EventID");
+            return PushTyped<EventID>(sender, std::forward<Ts>(args)...);
+        }
 
-    static inline [[nodiscard]] EventSystem& ESI()
-    {
-        return EventSystem::Inst();
+        template <auto EventID, typename ...Ts>
+        bool PostAll(Ts&&... args)
+        {
+            return Post<EventID>(nullptr, std::forward<Ts>(args)...);
+        }
+
+        /// <summary>
+        /// deliver posted events on the calling thread
+        /// </summary>
+        /// <param name="maxEvents">stop after this many events</param>
+        /// <returns>number of events delivered</returns>
+        size_t Pump(size_t maxEvents = SIZE_MAX);
+
+        /// <summary>
+        /// size of the Post queue and what to do when it is full. pending events are dropped
+        /// </summary>
+        void SetPostQueue(size_t capacity, QueueFullPolicy policy);
+
+        /// <summary>
+        /// deliver posted events on a dedicated thread. listeners are then called concurrently with the
+        /// rest of the program, so this switches the system to thread safe mode
+        /// </summary>
+        void StartDispatcher();
+        void StopDispatcher();
+
+        static constexpr uint32_t defaultParallelThreshold = 256;
+        static constexpr uint32_t defaultParallelChunk = 64;
+
+        /// <summary>
+        /// fan every call of evtID out over the worker pool, once a listener list has at least threshold entries.
+        /// the list is split in chunks of chunk listeners, the sender runs chunks too and returns when all are done.
+        /// threshold 0 turns it off. listeners then run concurrently, so this switches the system to thread safe mode
+        /// </summary>
+        template <typename EventType>
+        void SetParallel(EventType evtID, uint32_t threshold = defaultParallelThreshold, uint32_t chunk = defaultParallelChunk)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            SetFanOut((int)evtID, threshold, chunk);
+        }
+
+        /// <summary>
+        /// number of pool workers used by parallel sends, set it before the first one.
+        /// default is one less than the hardware threads
+        /// </summary>
+        void SetWorkerCount(size_t workers);
+
+        /// <summary>
+        /// how many (event, sender) pairs keep a merged list of their own and wildcard listeners, built on the
+        /// first send of the pair and dropped when either list changes. pairs past the limit look up both lists
+        /// on every send. 0 keeps no merged lists, default 4096
+        /// </summary>
+        void SetDispatchCacheLimit(size_t pairs);
+
+        /// <summary>
+        /// allocate the listener lists of the bus from resource, nullptr for the global heap. lists of one event sit
+        /// together in the resource and freed ones are reused. only while the bus has no listeners, resource must outlive
+        /// the lists, in thread safe mode some are freed on other threads after the bus is gone, see EpochReclaimer::Collect
+        /// </summary>
+        /// <returns>false if the bus has listeners</returns>
+        bool SetMemoryResource(std::pmr::memory_resource* resource);
+
+        /// <summary>
+        /// SetMemoryResource with a pool of the bus: blocks of each size are carved from larger chunks and reused once
+        /// freed. the pool lives until the last list from it is freed
+        /// </summary>
+        bool SetPooledMemory(const std::pmr::pool_options& options = {});
+
+        /// <summary>
+        /// bytes and allocations held for the listeners of each event, to size pools and find registrations that were
+        /// never removed. walks every table, not meant for a hot path
+        /// </summary>
+        [[nodiscard]] MemorySnapshot MemoryStats() const;
+
+        /// <summary>
+        /// Send that fans out over the worker pool even if evtID is not SetParallel, with the default threshold
+        /// when it is not. only in thread safe mode, otherwise listeners run inline. forwarded like Send
+        /// from a thread that does not own the bus, the owner fans it out when it pumps
+        /// </summary>
+        template <typename EventType, typename ...Args>
+        void SendParallel(EventType evtID, const void* sender, Args&&... args) const
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            if (Forwarded())
+            {
+                _queue->Push([this, evt = (int)evtID, sender, payload = std::tuple<std::decay_t<Args>...>(std::forward<Args>(args)...)]()
+                    {
+                        std::apply([&](const auto&... a) { CallParallel<std::decay_t<Args>...>(evt, sender, a...); }, payload);
+                    });
+                return;
+            }
+            CallParallel<std::decay_t<Args>...>((int)evtID, sender, args...);
+        }
+
+        /// <summary>
+        /// run every listener on the worker pool and return at once. arguments are copied,
+        /// the listener snapshot stays alive until the handle reports Done. switches the system to thread safe mode.
+        /// not forwarded: on a bus bound by SetOwnerThread, call it from the owner only
+        /// </summary>
+        template <typename EventType, typename ...Args>
+        [[nodiscard]] FanOut SendAsync(EventType evtID, const void* sender, Args&&... args)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            assert(!Forwarded() && "SendAsync from a thread that does not own the bus");
+            return CallAsync((int)evtID, sender, std::make_unique<AsyncPayload<std::decay_t<Args>...>>(std::forward<Args>(args)...));
+        }
+
+        /// <summary>
+        /// coalesce evtID: Send and typed Send keep only the latest arguments per sender in a slot reused from send to send,
+        /// Flush delivers each pending (event, sender) once. with a window, a pending event is also delivered
+        /// window after its first send, queued like a Post so it runs from Pump or the dispatcher.
+        /// Post, SendBatch and the parallel sends are not coalesced
+        /// </summary>
+        template <typename EventType>
+        void SetCoalesce(EventType evtID, std::chrono::steady_clock::duration window = {})
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            SetCoalesce((int)evtID, window, CoalesceReduce(), nullptr);
+        }
+
+        /// <summary>
+        /// coalesce evtID and fold every send into the pending one with reduce(T& pending, const T& incoming).
+        /// T is the argument of a one argument event, otherwise std::tuple of the arguments
+        /// </summary>
+        template <typename EventType, typename Reduce>
+            requires (FunctionTraits<std::decay_t<Reduce>>::count == 2)
+        void SetCoalesce(EventType evtID, Reduce&& reduce, std::chrono::steady_clock::duration window = {})
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            using T = std::decay_t<std::tuple_element_t<0, typename FunctionTraits<std::decay_t<Reduce>>::TupleType>>;
+            SetCoalesce((int)evtID, window, MakeCoalesceReduce<T>(std::forward<Reduce>(reduce)), ReducedOps<T>::ops);
+        }
+
+        /// <summary>
+        /// stop coalescing evtID, its pending events are delivered first
+        /// </summary>
+        template <typename EventType>
+        void StopCoalesce(EventType evtID)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            StopCoalesce((int)evtID);
+        }
+
+        /// <summary>
+        /// deliver every pending coalesced event on the calling thread, in the order they first became pending
+        /// </summary>
+        /// <returns>number of events delivered</returns>
+        size_t Flush();
+
+        using TimerHandle = uint64_t;
+
+        /// <summary>
+        /// send evtID with args once delay has passed. the arguments are stored by value until then and the last listener
+        /// may move them out like SendMove. when due, the timer thread of the bus queues the send like a Post so it runs
+        /// from Pump or the dispatcher, unless SetManualTimers leaves it to Tick. scheduling and CancelTimer are O(1),
+        /// deadlines are rounded up to the timer resolution
+        /// </summary>
+        /// <returns>handle for CancelTimer</returns>
+        template <typename EventType, typename ...Args>
+        TimerHandle SendAfter(std::chrono::steady_clock::duration delay, EventType evtID, const void* sender, Args&&... args)
+        {
+            return SendAt(std::chrono::steady_clock::now() + delay, evtID, sender, std::forward<Args>(args)...);
+        }
+
+        template <typename EventType, typename ...Args>
+        TimerHandle SendAt(std::chrono::steady_clock::time_point at, EventType evtID, const void* sender, Args&&... args)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            return Schedule(at, {}, new TimedCall<std::tuple<std::decay_t<Args>...>>((int)evtID, sender, std::forward<Args>(args)...));
+        }
+
+        /// <summary>
+        /// send evtID with args every period, the first time one period from now. each send copies the stored arguments.
+        /// periods missed while nothing delivered timers are skipped, not sent in a burst
+        /// </summary>
+        template <typename EventType, typename ...Args>
+        TimerHandle SendEvery(std::chrono::steady_clock::duration period, EventType evtID, const void* sender, Args&&... args)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            static_assert((std::is_copy_constructible_v<std::decay_t<Args>> && ...), "a periodic send copies its arguments");
+            assert(period > std::chrono::steady_clock::duration::zero());
+            return Schedule(std::chrono::steady_clock::now() + period, period
+                , new TimedCall<std::tuple<std::decay_t<Args>...>>((int)evtID, sender, std::forward<Args>(args)...));
+        }
+
+        /// <summary>
+        /// typed SendAfter, the arguments are converted to the EventSignature parameters when scheduled
+        /// </summary>
+        template <auto EventID, typename ...Ts>
+        TimerHandle SendAfter(std::chrono::steady_clock::duration delay, const void* sender, Ts&&... args)
+        {
+            return SendAt<EventID>(std::chrono::steady_clock::now() + delay, sender, std::forward<Ts>(args)...);
+        }
+
+        template <auto EventID, typename ...Ts>
+        TimerHandle SendAt(std::chrono::steady_clock::time_point at, const void* sender, Ts&&... args)
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            using Signature = typename EventSignature<EventID>::Type;
+            static_assert(EventArgs<Signature>::template sendable<Ts...>, "arguments do not match the EventSignature of EventID");
+            return Schedule(at, {}, new TimedCall<typename EventArgs<Signature>::ValueType>((int)EventID, sender, std::forward<Ts>(args)...));
+        }
+
+        template <auto EventID, typename ...Ts>
+        TimerHandle SendEvery(std::chrono::steady_clock::duration period, const void* sender, Ts&&... args)
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            using Signature = typename EventSignature<EventID>::Type;
+            using ValueType = typename EventArgs<Signature>::ValueType;
+            static_assert(EventArgs<Signature>::template sendable<Ts...>, "arguments do not match the EventSignature of EventID");
+            static_assert(std::is_copy_constructible_v<ValueType>, "a periodic send copies its arguments");
+            assert(period > std::chrono::steady_clock::duration::zero());
+            return Schedule(std::chrono::steady_clock::now() + period, period, new TimedCall<ValueType>((int)EventID, sender, std::forward<Ts>(args)...));
+        }
+
+        /// <summary>
+        /// cancel a scheduled send. a periodic send cancelled from one of its own listeners is not sent again,
+        /// a send a running Tick already took is still delivered that once
+        /// </summary>
+        /// <returns>false if handle was delivered or cancelled already</returns>
+        bool CancelTimer(TimerHandle handle);
+
+        /// <summary>
+        /// deliver every scheduled send due by now on the calling thread, in deadline order
+        /// </summary>
+        /// <returns>number of sends delivered</returns>
+        size_t Tick(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+        /// <summary>
+        /// manual: only Tick delivers scheduled sends, for programs that drive time themselves
+        /// </summary>
+        void SetManualTimers(bool manual);
+
+        /// <summary>
+        /// the tick of the timing wheel, 1ms by default. only while nothing is scheduled
+        /// </summary>
+        /// <returns>false if sends are scheduled</returns>
+        bool SetTimerResolution(std::chrono::steady_clock::duration resolution);
+
+        /// <summary>
+        /// listen to object sender's sent event only
+        /// </summary>
+        /// <typeparam name="EventType">any enum</typeparam>
+        /// <typeparam name="F">any callerable</typeparam>
+        /// <param name="evtID">event id</param>
+        /// <param name="sender">the target object to listen to. pass nullptr is any object's event is wanted</param>
+        /// <param name="f">any non member function, callables</param>
+        /// <returns>the id of the registration</returns>
+        template <typename EventType, typename F>
+        CallBackHandle Register(EventType evtID, const void* sender, F&& f)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            FnCallBack callBack = MakeCBStorage(std::forward<F>(f));
+            return Reg((int)evtID, sender, nullptr, std::move(callBack), FunctionTraits<std::decay_t<F>>::signature);
+        }
+
+        /// <summary>
+        /// listen to object sent event, with member function as callback
+        /// </summary>
+        template <typename EventType, typename RC, typename F>
+        CallBackHandle Register(EventType evtID, const void* sender, const RC* recver, F&& f)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            static_assert(std::is_class_v<RC>);
+            FnCallBack cb = MakeCBStorage(recver, std::forward<F>(f));
+            return Reg((int)evtID, sender, recver, std::move(cb), FunctionTraits<std::decay_t<F>>::signature);
+        }
+
+        /// <summary>
+        /// keyed listener, only called for sends whose key is key. keyOf gets the first argument and returns its key,
+        /// like &Job::id or a lambda without captures. keyed listeners are indexed by key per event and keyOf,
+        /// a send reaches the ones of its key through one hash lookup and calls them after the ones without key
+        /// </summary>
+        template <typename EventType, typename KeyOf, typename Key, typename F>
+        CallBackHandle Register(EventType evtID, const void* sender, KeyOf keyOf, const Key& key, F&& f)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            using TupleType = typename FunctionTraits<std::decay_t<F>>::TupleType;
+            return RegKeyed<TupleType>((int)evtID, sender, nullptr, keyOf, key, MakeCBStorage(std::forward<F>(f)));
+        }
+
+        template <typename EventType, typename RC, typename KeyOf, typename Key, typename F>
+        CallBackHandle Register(EventType evtID, const void* sender, const RC* recver, KeyOf keyOf, const Key& key, F&& f)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            static_assert(std::is_class_v<RC>);
+            using TupleType = typename FunctionTraits<std::decay_t<F>>::TupleType;
+            return RegKeyed<TupleType>((int)evtID, sender, recver, keyOf, key, MakeCBStorage(recver, std::forward<F>(f)));
+        }
+
+        /// <summary>
+        /// span listener, f takes std::span of const T and gets a SendBatch in one call, a single Send as a span of one
+        /// </summary>
+        template <typename EventType, typename F>
+        CallBackHandle RegisterBatch(EventType evtID, const void* sender, F&& f)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            return Reg((int)evtID, sender, nullptr, MakeBatchCBStorage<F>([f = std::forward<F>(f)](auto span) { f(span); }), BatchSignature<F>(), true);
+        }
+
+        template <typename EventType, typename RC, typename F>
+        CallBackHandle RegisterBatch(EventType evtID, const void* sender, const RC* recver, F&& f)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            static_assert(std::is_class_v<RC>);
+            using Fn = std::decay_t<F>;
+            return Reg((int)evtID, sender, recver, MakeBatchCBStorage<F>([f = std::forward<F>(f), obj = const_cast<RC*>(recver)](auto span)
+                {
+                    if constexpr (std::is_member_function_pointer_v<Fn>)
+                    {
+                        (obj->*f)(span);
+                    }
+                    else
+                    {
+                        std::invoke(f, obj, span);
+                    }
+                }), BatchSignature<F>(), true);
+        }
+
+        /// <summary>
+        /// typed listener, f must be callable with the EventSignature parameters of EventID
+        /// </summary>
+        template <auto EventID, typename F>
+        CallBackHandle Register(const void* sender, F&& f)
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            using Signature = typename EventSignature<EventID>::Type;
+            static_assert(EventArgs<Signature>::template listenable<std::decay_t<F>>, "listener does not match the EventSignature of EventID");
+            return Reg((int)EventID, sender, nullptr, MakeTypedCBStorage<Signature>(std::forward<F>(f)), EventArgs<Signature>::signature);
+        }
+
+        /// <summary>
+        /// typed listener with recver, f is a member function of RC or a callable taking RC* first
+        /// </summary>
+        template <auto EventID, typename RC, typename F>
+        CallBackHandle Register(const void* sender, const RC* recver, F&& f)
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            static_assert(std::is_class_v<RC>);
+            using Signature = typename EventSignature<EventID>::Type;
+            static_assert(EventArgs<Signature>::template listenable<std::decay_t<F>, RC*>, "listener does not match the EventSignature of EventID");
+            return Reg((int)EventID, sender, recver, MakeTypedCBStorage<Signature>(recver, std::forward<F>(f)), EventArgs<Signature>::signature);
+        }
+
+        /// <summary>
+        /// typed keyed listener, keyOf gets the first EventSignature parameter of EventID
+        /// </summary>
+        template <auto EventID, typename KeyOf, typename Key, typename F>
+        CallBackHandle Register(const void* sender, KeyOf keyOf, const Key& key, F&& f)
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            using Signature = typename EventSignature<EventID>::Type;
+            static_assert(EventArgs<Signature>::template listenable<std::decay_t<F>>, "listener does not match the EventSignature of EventID");
+            return RegKeyed<typename EventArgs<Signature>::TupleType>((int)EventID, sender, nullptr, keyOf, key, MakeTypedCBStorage<Signature>(std::forward<F>(f)));
+        }
+
+        /// <summary>
+        /// listener with a thread affinity: a send on the thread that owns mailbox calls it inline, a send from any other
+        /// thread copies the arguments into mailbox and the owner calls it when it drains. recver is then only ever used
+        /// by its own thread, without locks. a listener unregistered before the owner drains is not called, nor one
+        /// whose mailbox was destroyed. switches the system to thread safe mode
+        /// </summary>
+        template <typename EventType, typename RC, typename F>
+        CallBackHandle RegisterOn(Mailbox& mailbox, EventType evtID, const void* sender, const RC* recver, F&& f)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            static_assert(std::is_class_v<RC>);
+            using TupleType = typename FunctionTraits<std::decay_t<F>>::TupleType;
+            return RegOn<TupleType>(mailbox, (int)evtID, sender, recver, MakeCBStorage(recver, std::forward<F>(f)));
+        }
+
+        template <typename EventType, typename F>
+        CallBackHandle RegisterOn(Mailbox& mailbox, EventType evtID, const void* sender, F&& f)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            using TupleType = typename FunctionTraits<std::decay_t<F>>::TupleType;
+            return RegOn<TupleType>(mailbox, (int)evtID, sender, nullptr, MakeCBStorage(std::forward<F>(f)));
+        }
+
+        /// <summary>
+        /// typed RegisterOn
+        /// </summary>
+        template <auto EventID, typename RC, typename F>
+        CallBackHandle RegisterOn(Mailbox& mailbox, const void* sender, const RC* recver, F&& f)
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            static_assert(std::is_class_v<RC>);
+            using Signature = typename EventSignature<EventID>::Type;
+            static_assert(EventArgs<Signature>::template listenable<std::decay_t<F>, RC*>, "listener does not match the EventSignature of EventID");
+            return RegOn<typename EventArgs<Signature>::TupleType>(mailbox, (int)EventID, sender, recver, MakeTypedCBStorage<Signature>(recver, std::forward<F>(f)));
+        }
+
+        template <auto EventID, typename F>
+        CallBackHandle RegisterOn(Mailbox& mailbox, const void* sender, F&& f)
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            using Signature = typename EventSignature<EventID>::Type;
+            static_assert(EventArgs<Signature>::template listenable<std::decay_t<F>>, "listener does not match the EventSignature of EventID");
+            return RegOn<typename EventArgs<Signature>::TupleType>(mailbox, (int)EventID, sender, nullptr, MakeTypedCBStorage<Signature>(std::forward<F>(f)));
+        }
+
+        /// <summary>
+        /// co_await the next evtID from sender, the coroutine resumes inside that send with its arguments as a tuple.
+        /// the wait lives in the coroutine frame, its listener is removed in O(1) when it resumes or the frame is destroyed
+        /// </summary>
+        template <typename ...Args, typename EventType>
+        NextEvent<false, std::decay_t<Args>...> Next(EventType evtID, const void* sender)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            return NextEvent<false, std::decay_t<Args>...>(*this, (int)evtID, sender, {}, {});
+        }
+
+        /// <summary>
+        /// co_await with a timeout and a stop token, resumes with std::nullopt when either comes before the event.
+        /// that resume is queued like a Post, so it runs from Pump or the dispatcher
+        /// </summary>
+        template <typename ...Args, typename EventType>
+        NextEvent<true, std::decay_t<Args>...> Next(EventType evtID, const void* sender, std::chrono::steady_clock::duration timeout, std::stop_token stop = {})
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            return NextEvent<true, std::decay_t<Args>...>(*this, (int)evtID, sender, Deadline(timeout), std::move(stop));
+        }
+
+        template <typename ...Args, typename EventType>
+        NextEvent<true, std::decay_t<Args>...> Next(EventType evtID, const void* sender, std::stop_token stop)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            return NextEvent<true, std::decay_t<Args>...>(*this, (int)evtID, sender, {}, std::move(stop));
+        }
+
+        /// <summary>
+        /// typed co_await, resumes with the EventSignature parameters of EventID
+        /// </summary>
+        template <auto EventID>
+        auto Next(const void* sender)
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            using Awaiter = typename EventArgs<typename EventSignature<EventID>::Type>::template Awaiter<false>;
+            return Awaiter(*this, (int)EventID, sender, {}, {});
+        }
+
+        template <auto EventID>
+        auto Next(const void* sender, std::chrono::steady_clock::duration timeout, std::stop_token stop = {})
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            using Awaiter = typename EventArgs<typename EventSignature<EventID>::Type>::template Awaiter<true>;
+            return Awaiter(*this, (int)EventID, sender, Deadline(timeout), std::move(stop));
+        }
+
+        template <auto EventID>
+        auto Next(const void* sender, std::stop_token stop)
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            using Awaiter = typename EventArgs<typename EventSignature<EventID>::Type>::template Awaiter<true>;
+            return Awaiter(*this, (int)EventID, sender, {}, std::move(stop));
+        }
+
+        /// <summary>
+        /// unregister any event with sender or recver that is obj, costs O(registrations of obj)
+        /// </summary>
+        void Unregister(const void* ob);
+
+        /// <summary>
+        /// unregister any event with id which is return by Register, O(1). a stale id is ignored
+        /// </summary>
+        /// <param name="id"></param>
+        void Unregister(CallBackHandle id);
+        void Clear();
+
+        /// <summary>
+        /// thread safe mode: Send/SendAll run lock free on an immutable snapshot of the listener table,
+        /// Register/Unregister/Clear are serialized, publish a new snapshot and reclaim the old one once no Send can see it.
+        /// switch it before other threads start using the system
+        /// </summary>
+        void SetThreadSafe(bool threadSafe);
+        [[nodiscard]] bool IsThreadSafe() const;
+
+        /// <summary>
+        /// sends and listener calls per event, call count and latency per listener, summed over all threads.
+        /// empty unless built with ES_METRICS=1
+        /// </summary>
+        [[nodiscard]] MetricsSnapshot Metrics() const;
+        void ResetMetrics();
+
+        /// <summary>
+        /// call callback on the sending thread whenever one listener call takes longer than budgetNs,
+        /// an empty callback turns it off. needs ES_METRICS=1
+        /// </summary>
+        void SetSlowListener(double budgetNs, SlowListenerCallback callback);
+
+        /// <summary>
+        /// record every event this bus calls listeners for into recorder, nullptr stops. sends are recorded when they
+        /// are delivered, so a Post when it is pumped and a coalesced event when it is flushed. sends with an argument
+        /// type that has no EventCodec are only counted. recorder must outlive its use by the bus
+        /// </summary>
+        void SetRecorder(EventRecorder* recorder)
+        {
+            _recorder.store(recorder, std::memory_order_release);
+        }
+
+    private:
+        template <bool Optional, typename... Args>
+        friend class NextEvent;
+
+        using FnCallBack = Delegate<void(const CallBackParam*)>;
+
+        enum class CallMode
+        {
+            Default,
+            Parallel,
+        };
+
+        //owns the arguments of a SendAsync until its listeners are done
+        struct FanOutPayload
+        {
+            virtual ~FanOutPayload() = default;
+            CallBackParam cbp;
+        };
+
+        template <typename ...Args>
+        struct AsyncPayload : FanOutPayload
+        {
+            using TupleType = typename TupleTypeFromArgs<Args...>::TupleType;
+
+            template <typename ...Ts>
+            explicit AsyncPayload(Ts&&... ts)
+                : values(std::forward<Ts>(ts)...)
+                , refs(std::apply([](const auto&... v) { return TupleType(v...); }, values))
+            {
+                cbp = MakeParam<Args...>(&refs);
+            }
+
+            std::tuple<Args...> values;
+            TupleType refs;
+        };
+
+        //owns the arguments of a scheduled send until it is delivered the last time or cancelled
+        struct TimedSend
+        {
+            virtual ~TimedSend() = default;
+            //last: the arguments are not sent again, the last listener may move them out
+            virtual void Deliver(const EventSystem& es, bool last) = 0;
+        };
+
+        template <typename ValueType>
+        struct TimedCall : TimedSend
+        {
+            template <typename ...Ts>
+            TimedCall(int evt, const void* sender, Ts&&... ts) : evt(evt), sender(sender), args(std::forward<Ts>(ts)...) {}
+
+            void Deliver(const EventSystem& es, bool last) override
+            {
+                std::apply([&](const auto&... a) { es.CallWith(evt, sender, last ? allMovable<std::decay_t<decltype(a)>...> : 0, a...); }, args);
+            }
+
+            int evt;
+            const void* sender;
+            ValueType args;
+        };
+
+        TimerHandle Schedule(std::chrono::steady_clock::time_point at, std::chrono::steady_clock::duration period, TimedSend* send);
+
+        CallBackHandle Reg(int evt, const void* sd, const void* rc, FnCallBack&& cb, uint64_t signature, bool batch = false);
+
+        //a RegisterOn listener. the calls waiting in its mailbox only hold it weakly, so a mailbox left with calls
+        //nobody drains does not keep it alive. live is cleared when it is unregistered
+        struct MailboxListener
+        {
+            MailboxListener(Mailbox::Ref mailbox, FnCallBack&& cb) : mailbox(std::move(mailbox)), cb(std::move(cb)) {}
+
+            Mailbox::Ref mailbox;
+            FnCallBack cb;
+            std::atomic<bool> live{ true };
+        };
+
+        template <typename TupleType>
+        CallBackHandle RegOn(Mailbox& mailbox, int evt, const void* sd, const void* rc, FnCallBack&& cb)
+        {
+            auto listener = std::make_shared<MailboxListener>(mailbox.Share(), std::move(cb));
+            FnCallBack wrapper = MakeMailboxCBStorage<TupleType>(listener);
+            return RegMailbox(evt, sd, rc, std::move(wrapper), SignatureOf((TupleType*)nullptr), std::move(listener));
+        }
+
+        CallBackHandle RegMailbox(int evt, const void* sd, const void* rc, FnCallBack&& cb, uint64_t signature, std::shared_ptr<MailboxListener>&& listener);
+
+        /// <summary>
+        /// how keyed listeners of one event find the key of a send: hash reads the first argument through keyOf,
+        /// a copy of the callable. equal extractors share one index
+        /// </summary>
+        struct KeyExtractor
+        {
+            //false when the send does not have the arguments the listeners take
+            bool (*hash)(const void* keyOf, const CallBackParam* p, uint64_t& key) = nullptr;
+            alignas(8) std::byte keyOf[16] = {};
+
+            bool operator==(const KeyExtractor& other) const
+            {
+                return hash == other.hash && std::memcmp(keyOf, other.keyOf, sizeof(keyOf)) == 0;
+            }
+        };
+
+        //strings are kept and compared by content, other keys as they are
+        template <typename K>
+        using KeyValue = std::conditional_t<std::is_convertible_v<const K&, std::string_view>, std::string, K>;
+
+        template <typename K>
+        static uint64_t KeyHash(const K& key)
+        {
+            if constexpr (std::is_convertible_v<const K&, std::string_view>)
+            {
+                return std::hash<std::string_view>()(std::string_view(key));
+            }
+            else if constexpr (std::is_integral_v<K> || std::is_enum_v<K>)
+            {
+                return (uint64_t)key;
+            }
+            else if constexpr (std::is_pointer_v<K>)
+            {
+                return (uint64_t)(uintptr_t)key;
+            }
+            else
+            {
+                return std::hash<K>()(key);
+            }
+        }
+
+        //the key of the arguments, a keyed listener always gets one payload of a batch at a time
+        template <typename TupleType, typename KeyOf>
+        static decltype(auto) KeyOfArgs(const KeyOf& keyOf, const CallBackParam* p)
+        {
+            using T = std::decay_t<std::tuple_element_t<0, TupleType>>;
+            if constexpr (std::tuple_size_v<TupleType> == 1)
+            {
+                if (p->batchSize > 0)
+                {
+                    return std::invoke(keyOf, *static_cast<const T*>(p->p));
+                }
+            }
+            return std::invoke(keyOf, std::get<0>(*static_cast<const TupleType*>(p->p)));
+        }
+
+        template <typename ...Ts>
+        static bool KeyArgsValid(const CallBackParam* p, std::type_identity<std::tuple<Ts...>>)
+        {
+            return p->IsTypeValid(signatureOf<Ts...>);
+        }
+
+        template <typename TupleType, typename KeyOf>
+        static bool HashKeyOf(const void* keyOf, const CallBackParam* p, uint64_t& key)
+        {
+            //a send of other arguments is for the other listeners of the event
+            if (!KeyArgsValid(p, std::type_identity<TupleType>()))
+            {
+                return false;
+            }
+            key = KeyHash(KeyOfArgs<TupleType>(*static_cast<const KeyOf*>(keyOf), p));
+            return true;
+        }
+
+        //the index only narrows down by hash, the listener compares the key itself
+        template <typename TupleType, typename KeyOf, typename Key, typename Call>
+        CallBackHandle RegKeyed(int evt, const void* sd, const void* rc, KeyOf keyOf, const Key& key, Call&& call)
+        {
+            static_assert(std::tuple_size_v<TupleType> > 0, "a keyed listener takes the key argument first");
+            static_assert(std::is_trivially_copyable_v<KeyOf> && sizeof(KeyOf) <= sizeof(KeyExtractor::keyOf) && alignof(KeyOf) <= 8,
+                "keyOf must be small and trivially copyable, like a member pointer or a lambda without captures");
+            using K = KeyValue<std::decay_t<decltype(KeyOfArgs<TupleType>(keyOf, nullptr))>>;
+
+            KeyExtractor extractor;
+            extractor.hash = &HashKeyOf<TupleType, KeyOf>;
+            if constexpr (!std::is_empty_v<KeyOf>)
+            {
+                std::memcpy(extractor.keyOf, &keyOf, sizeof(KeyOf));
+            }
+            K value(key);
+            const uint64_t hash = KeyHash(value);
+            FnCallBack cb = [keyOf, value = std::move(value), call = std::forward<Call>(call)](const CallBackParam* p)
+                {
+                    if (KeyOfArgs<TupleType>(keyOf, p) == value)
+                    {
+                        call(p);
+                    }
+                };
+            return RegKeyed(evt, sd, rc, std::move(cb), SignatureOf((TupleType*)nullptr), extractor, hash);
+        }
+
+        CallBackHandle RegKeyed(int evt, const void* sd, const void* rc, FnCallBack&& cb, uint64_t signature, const KeyExtractor& extractor, uint64_t key);
+        void Call(int evt, const void* sd, const EventSystem::CallBackParam* args, CallMode mode = CallMode::Default) const;
+        void CallBatch(int evt, const void* sd, const EventSystem::CallBackParam* batch, BatchOrder order) const;
+        FanOut CallAsync(int evt, const void* sd, std::unique_ptr<FanOutPayload>&& payload);
+        void SetFanOut(int evt, uint32_t threshold, uint32_t chunk);
+
+        //co_await Next support: the timeout list, and queuing the resume of a wait that timed out or was stopped
+        void ArmWait(EventWait& wait);
+        void DisarmWait(EventWait& wait);
+        void ExpireWait(EventWait& wait);
+
+        static std::chrono::steady_clock::time_point Deadline(std::chrono::steady_clock::duration timeout)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            return timeout < std::chrono::steady_clock::time_point::max() - now ? now + timeout : std::chrono::steady_clock::time_point::max();
+        }
+
+        template <typename ...Args>
+        static CallBackParam MakeParam(const typename TupleTypeFromArgs<Args...>::TupleType* evt)
+        {
+            return CallBackParam{ .p = evt, .signature = signatureOf<Args...>, .paramSize = ArgumentStatistic<Args...>::size };
+        }
+
+        //true when the bus is owned by another thread, sends then go through the Post queue
+        [[nodiscard]] bool Forwarded() const
+        {
+            return _owner != std::thread::id() && _owner != std::this_thread::get_id();
+        }
+
+        /// <summary>
+        /// events and senders that have listeners, so a send nobody listens to returns in a few loads.
+        /// a clear bit is exact, a set one may be shared with other ids or senders. ids past the dense ones share
+        /// the last event bit, senders are hashed onto senderBits. kept by registration, under the write lock
+        /// </summary>
+        struct ListenerFilter
+        {
+            static constexpr int denseEvents = 1024;
+            static constexpr uint32_t senderBits = 4096;
+
+            static uint32_t EventBit(int evt)
+            {
+                return (unsigned)evt < (unsigned)denseEvents ? (uint32_t)evt : (uint32_t)denseEvents;
+            }
+
+            static uint32_t SenderBit(const void* sender)
+            {
+                return (uint32_t)MixHash((uint64_t)(uintptr_t)sender) & (senderBits - 1);
+            }
+
+            static bool Test(const std::atomic<uint64_t>* bits, uint32_t i)
+            {
+                return (bits[i / 64].load(std::memory_order_relaxed) >> (i % 64) & 1) != 0;
+            }
+
+            //false when no listener of evt takes a send from sender, nullptr only reaches the ones without sender
+            [[nodiscard]] bool MayListen(int evt, const void* sender) const
+            {
+                const uint32_t e = EventBit(evt);
+                return Test(events, e) && (Test(wildcards, e) || (sender != nullptr && Test(senders, SenderBit(sender))));
+            }
+
+            std::atomic<uint64_t> events[denseEvents / 64 + 1] = {};
+            std::atomic<uint64_t> wildcards[denseEvents / 64 + 1] = {};     //events with listeners without sender
+            std::atomic<uint64_t> senders[senderBits / 64] = {};
+        };
+
+        //a recorder or another process gets every send
+        [[nodiscard]] bool Observed() const
+        {
+            return _recorder.load(std::memory_order_relaxed) != nullptr || _sharedRing.load(std::memory_order_relaxed) != nullptr;
+        }
+
+        //nothing would see the send, with metrics on every send is counted
+        [[nodiscard]] bool Unheard(int evtID, const void* sender) const
+        {
+            return !ES_METRICS && !_filter.MayListen(evtID, sender) && !Observed();
+        }
+
+        //the exact check behind the filter
+        bool AnyListener(int evt, const void* sender) const;
+
+        //a coalescing slot is copied into and over, other arguments skip coalescing
+        template <typename ...Args>
+        static constexpr bool coalescable = ((std::is_copy_constructible_v<Args> && std::is_copy_assignable_v<Args>) && ...);
+
+        //every argument, for payloads the bus owns
+        template <typename ...Args>
+        static constexpr uint32_t allMovable = MoveMask<(sizeof(Args) > 0)...>();
+
+        //the queued call runs CallWith, not Send, so the thread that pumps never forwards it again
+        template <typename ...Args>
+        bool PushCall(int evtID, const void* sender, Args&&... args) const
+        {
+            return _queue->Push([this, evtID, sender, payload = std::tuple<std::decay_t<Args>...>(std::forward<Args>(args)...)]()
+                {
+                    std::apply([&](const auto&... a) { CallWith(evtID, sender, allMovable<std::decay_t<Args>...>, a...); }, payload);
+                });
+        }
+
+        template <auto EventID, typename ...Ts>
+        bool PushTyped(const void* sender, Ts&&... args) const
+        {
+            using Signature = typename EventSignature<EventID>::Type;
+            using ValueType = typename EventArgs<Signature>::ValueType;
+            return _queue->Push([this, sender, payload = ValueType(std::forward<Ts>(args)...)]()
+                {
+                    std::apply([&](const auto&... a) { CallTyped((int)EventID, sender, std::type_identity<Signature>(), allMovable<std::decay_t<decltype(a)>...>, a...); }, payload);
+                });
+        }
+
+        template <std::ranges::contiguous_range Range>
+        void CallBatchWith(int evtID, const void* sender, const Range& payloads, BatchOrder order) const
+        {
+            if (Unheard(evtID, sender))
+            {
+                return;
+            }
+            if (EventRecorder* recorder = _recorder.load(std::memory_order_acquire); recorder != nullptr) [[unlikely]]
+            {
+                for (const auto& payload : payloads)
+                {
+                    recorder->Record(evtID, sender, payload);
+                }
+            }
+            if (SharedRing* ring = _sharedRing.load(std::memory_order_acquire); ring != nullptr) [[unlikely]]
+            {
+                for (const auto& payload : payloads)
+                {
+                    ring->Publish(evtID, sender, payload);
+                }
+            }
+            CallBackParam cbp = MakeParam<std::ranges::range_value_t<Range>>(nullptr);
+            cbp.p = std::ranges::data(payloads);
+            cbp.batchSize = (uint32_t)std::ranges::size(payloads);
+            CallBatch(evtID, sender, &cbp, order);
+        }
+
+        //Args are the decayed argument types, so an array or a function converts at the call and the payload refers to no temporary it made.
+        //movable comes from SendMove, or from a payload the bus owns
+        template <typename ...Args>
+        void CallWith(int evtID, const void* sender, uint32_t movable, const Args&... args) const
+        {
+            if (Unheard(evtID, sender))
+            {
+                return;
+            }
+            if (EventRecorder* recorder = _recorder.load(std::memory_order_acquire); recorder != nullptr) [[unlikely]]
+            {
+                recorder->Record(evtID, sender, args...);
+            }
+            if (SharedRing* ring = _sharedRing.load(std::memory_order_acquire); ring != nullptr) [[unlikely]]
+            {
+                ring->Publish(evtID, sender, args...);
+            }
+            const typename TupleTypeFromArgs<Args...>::TupleType evt(args...);
+            EventSystem::CallBackParam cbp = MakeParam<Args...>(&evt);
+            cbp.movable = movable;
+            Call(evtID, sender, &cbp);
+        }
+
+        template <typename ...Args>
+        void CallParallel(int evtID, const void* sender, const Args&... args) const
+        {
+            if (Unheard(evtID, sender))
+            {
+                return;
+            }
+            if (EventRecorder* recorder = _recorder.load(std::memory_order_acquire); recorder != nullptr) [[unlikely]]
+            {
+                recorder->Record(evtID, sender, args...);
+            }
+            if (SharedRing* ring = _sharedRing.load(std::memory_order_acquire); ring != nullptr) [[unlikely]]
+            {
+                ring->Publish(evtID, sender, args...);
+            }
+            const typename TupleTypeFromArgs<Args...>::TupleType evt(args...);
+            const CallBackParam cbp = MakeParam<Args...>(&evt);
+            Call(evtID, sender, &cbp, CallMode::Parallel);
+        }
+
+        //the tag fixes Args, so the arguments convert at the call and temporaries outlive the listeners
+        template <typename ReturnType, typename ...Args>
+        void CallTyped(int evtID, const void* sender, std::type_identity<ReturnType(Args...)>, uint32_t movable, const std::decay_t<Args>&... args) const
+        {
+            CallWith<std::decay_t<Args>...>(evtID, sender, movable, args...);
+        }
+
+        //how a coalescing slot stores, overwrites and delivers the arguments of one event type.
+        //args is the TupleType of the send, slot a std::tuple of the decayed arguments
+        struct CoalesceOps
+        {
+            size_t size;
+            size_t align;
+            void (*construct)(void* slot, const void* args);
+            void (*assign)(void* slot, const void* args);
+            void (*destroy)(void* slot);
+            //moves the arguments out of the slot, releases lock and calls the listeners
+            void (*deliver)(const EventSystem& es, int evt, const void* sender, void* slot, std::unique_lock<std::mutex>& lock);
+        };
+
+        template <typename ...Args>
+        static constexpr CoalesceOps coalesceOps = {
+            sizeof(std::tuple<Args...>),
+            alignof(std::tuple<Args...>),
+            [](void* slot, const void* args) { new (slot) std::tuple<Args...>(*static_cast<const typename TupleTypeFromArgs<Args...>::TupleType*>(args)); },
+            [](void* slot, const void* args) { *static_cast<std::tuple<Args...>*>(slot) = *static_cast<const typename TupleTypeFromArgs<Args...>::TupleType*>(args); },
+            [](void* slot) { static_cast<std::tuple<Args...>*>(slot)->~tuple(); },
+            [](const EventSystem& es, int evt, const void* sender, void* slot, std::unique_lock<std::mutex>& lock)
+            {
+                std::tuple<Args...> args(std::move(*static_cast<std::tuple<Args...>*>(slot)));
+                if (lock.owns_lock())
+                {
+                    lock.unlock();
+                }
+                std::apply([&](const Args&... a) { es.CallWith(evt, sender, allMovable<Args...>, a...); }, args);
+            },
+        };
+
+        //the slot type a reducer of T works on, the tuple elements when T is a tuple
+        template <typename T>
+        struct ReducedOps
+        {
+            static constexpr bool tuple = false;
+            static constexpr const CoalesceOps* ops = &coalesceOps<T>;
+        };
+
+        template <typename ...Args>
+        struct ReducedOps<std::tuple<Args...>>
+        {
+            static constexpr bool tuple = true;
+            static constexpr const CoalesceOps* ops = &coalesceOps<Args...>;
+            using Refs = typename TupleTypeFromArgs<Args...>::TupleType;
+        };
+
+        using CoalesceReduce = Delegate<void(void* slot, const void* args)>;
+
+        template <typename T, typename Reduce>
+        static CoalesceReduce MakeCoalesceReduce(Reduce&& reduce)
+        {
+            return [reduce = std::forward<Reduce>(reduce)](void* slot, const void* args)
+                {
+                    if constexpr (ReducedOps<T>::tuple)
+                    {
+                        reduce(*static_cast<T*>(slot), T(*static_cast<const typename ReducedOps<T>::Refs*>(args)));
+                    }
+                    else
+                    {
+                        reduce(std::get<0>(*static_cast<std::tuple<T>*>(slot)), std::get<0>(*static_cast<const std::tuple<const T&>*>(args)));
+                    }
+                };
+        }
+
+        template <typename ...Args>
+        bool Coalesce(int evtID, const void* sender, const Args&... args) const
+        {
+            const typename TupleTypeFromArgs<Args...>::TupleType refs(args...);
+            return StoreCoalesced(evtID, sender, &refs, coalesceOps<std::decay_t<Args>...>);
+        }
+
+        template <typename ReturnType, typename ...Args>
+        bool CoalesceTyped(int evtID, const void* sender, std::type_identity<ReturnType(Args...)>, const std::decay_t<Args>&... args) const
+        {
+            return Coalesce<std::decay_t<Args>...>(evtID, sender, args...);
+        }
+
+        void SetCoalesce(int evt, std::chrono::steady_clock::duration window, CoalesceReduce&& reduce, const CoalesceOps* ops);
+        void StopCoalesce(int evt);
+        bool StoreCoalesced(int evt, const void* sender, const void* args, const CoalesceOps& ops) const;
+        /// <summary>
+        /// call f with the event body, or once per payload when p carries a batch
+        /// </summary>
+        template <typename TupleType, typename F>
+        static void ApplyBody(const CallBackParam* p, F&& f)
+        {
+            if constexpr (std::tuple_size_v<TupleType> == 1)
+            {
+                if (p->batchSize > 0)
+                {
+                    using T = std::decay_t<std::tuple_element_t<0, TupleType>>;
+                    const T* payloads = static_cast<const T*>(p->p);
+                    for (uint32_t i = 0; i < p->batchSize; ++i)
+                    {
+                        f(payloads[i]);
+                    }
+                    return;
+                }
+            }
+            std::apply(f, *static_cast<const TupleType*>(p->p));
+        }
+
+        /// <summary>
+        /// one argument as listener parameter P takes it: a reference to const reads the payload, a by value or
+        /// rvalue reference parameter gets the payload moved out when it was handed over, a copy otherwise.
+        /// a move only argument that was not handed over never gets here, see MoveOnly
+        /// </summary>
+        template <typename P, typename T>
+        static decltype(auto) PassParam(const T& arg, bool move)
+        {
+            if constexpr (std::is_lvalue_reference_v<P>)
+            {
+                return (arg);
+            }
+            else
+            {
+                if constexpr (std::is_copy_constructible_v<T>)
+                {
+                    if (!move)
+                    {
+                        return T(arg);
+                    }
+                }
+                assert(move);
+                //payloads are never const objects, Send binds them to references to const
+                return T(std::move(const_cast<T&>(arg)));
+            }
+        }
+
+        //bit i set when parameter i of Params can only take argument i of TupleType by moving it out
+        template <typename TupleType, typename Params>
+        static constexpr uint32_t MoveOnly()
+        {
+            return []<size_t... I>(std::index_sequence<I...>)
+            {
+                return MoveMask<(!std::is_lvalue_reference_v<std::tuple_element_t<I, Params>>
+                    && !std::is_copy_constructible_v<std::decay_t<std::tuple_element_t<I, TupleType>>>)...>();
+            }(std::make_index_sequence<std::tuple_size_v<TupleType>>());
+        }
+
+        //a call that would take a move only argument the send did not hand over is skipped, in every build
+        template <uint32_t moveOnly>
+        static bool Rejected(uint32_t movable)
+        {
+            if constexpr (moveOnly != 0)
+            {
+                if ((moveOnly & ~movable) != 0)
+                {
+                    _rejectedMoves.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /// <summary>
+        /// ApplyBody for a listener declared with Params
+        /// </summary>
+        template <typename TupleType, typename Params, typename F>
+        static void ApplyParams(const CallBackParam* p, F&& f)
+        {
+            if (Rejected<MoveOnly<TupleType, Params>()>(p->movable))
+            {
+                return;
+            }
+            ApplyBody<TupleType>(p, [&](const auto&... args)
+                {
+                    [&]<size_t... I>(std::index_sequence<I...>)
+                    {
+                        f(PassParam<std::tuple_element_t<I, Params>>(args, (p->movable >> I & 1) != 0)...);
+                    }(std::index_sequence_for<decltype(args)...>());
+                });
+        }
+
+        template <typename F>
+        static auto MakeCBStorage(F&& f)
+        {
+            using Fn = std::decay_t<F>;
+            return [f = std::forward<F>(f)](const CallBackParam* p)
+                {
+                    using TupleType = typename FunctionTraits<Fn>::TupleType;
+                    assert(p->IsTypeValid(FunctionTraits<Fn>::signature));
+                    ApplyParams<TupleType, typename FunctionTraits<Fn>::ParamTypes>(p, f);
+                };
+        }
+
+        /// <summary>
+        /// member function listener, keeps only the member pointer and the receiver
+        /// so it fits the inline storage of FnCallBack, and calls through the member pointer directly
+        /// </summary>
+        template <typename OBJ, typename F>
+        static auto MakeCBStorage(const OBJ* obj, F&& f)
+        {
+            using Fn = std::decay_t<F>;
+            return [f = std::forward<F>(f), obj = const_cast<OBJ*>(obj)](const CallBackParam* p)
+                {
+                    using TupleType = typename FunctionTraits<Fn>::TupleType;
+                    assert(p->IsTypeValid(FunctionTraits<Fn>::signature));
+                    ApplyParams<TupleType, typename FunctionTraits<Fn>::ParamTypes>(p, [&](auto&&... args)
+                        {
+                            if constexpr (std::is_member_function_pointer_v<Fn>)
+                            {
+                                (obj->*f)(std::forward<decltype(args)>(args)...);
+                            }
+                            else
+                            {
+                                std::invoke(f, obj, std::forward<decltype(args)>(args)...);
+                            }
+                        });
+                };
+        }
+
+        /// <summary>
+        /// typed listeners are only ever called with the tuple their EventSignature describes,
+        /// so the event body is used as is, without the runtime type check
+        /// </summary>
+        template <typename Signature, typename F>
+        static auto MakeTypedCBStorage(F&& f)
+        {
+            using TupleType = typename EventArgs<Signature>::TupleType;
+            return [f = std::forward<F>(f)](const CallBackParam* p)
+                {
+                    ApplyParams<TupleType, typename EventArgs<Signature>::ParamTypes>(p, f);
+                };
+        }
+
+        template <typename Signature, typename OBJ, typename F>
+        static auto MakeTypedCBStorage(const OBJ* obj, F&& f)
+        {
+            using Fn = std::decay_t<F>;
+            using TupleType = typename EventArgs<Signature>::TupleType;
+            return [f = std::forward<F>(f), obj = const_cast<OBJ*>(obj)](const CallBackParam* p)
+                {
+                    ApplyParams<TupleType, typename EventArgs<Signature>::ParamTypes>(p, [&](auto&&... args)
+                        {
+                            if constexpr (std::is_member_function_pointer_v<Fn>)
+                            {
+                                (obj->*f)(std::forward<decltype(args)>(args)...);
+                            }
+                            else
+                            {
+                                std::invoke(f, obj, std::forward<decltype(args)>(args)...);
+                            }
+                        });
+                };
+        }
+
+        //the signature of a listener whose event body is TupleType
+        template <typename ...Ts>
+        static constexpr uint64_t SignatureOf(std::tuple<Ts...>*)
+        {
+            return signatureOf<Ts...>;
+        }
+
+        /// <summary>
+        /// RegisterOn storage: on the owner thread the listener is called in place. elsewhere the arguments are copied,
+        /// or moved when handed over, once per payload of a batch, and the owner calls the listener with them.
+        /// once the mailbox is destroyed the owner is gone, and its id may already be another thread's
+        /// </summary>
+        template <typename TupleType>
+        static auto MakeMailboxCBStorage(std::shared_ptr<MailboxListener> listener)
+        {
+            return [listener = std::move(listener)](const CallBackParam* p)
+                {
+                    if (listener->mailbox.Closed())
+                    {
+                        return;
+                    }
+                    if (listener->mailbox.OnOwner())
+                    {
+                        listener->cb(p);
+                        return;
+                    }
+
+                    assert(p->IsTypeValid(SignatureOf((TupleType*)nullptr)));
+                    ApplyBody<TupleType>(p, [&](const auto&... args) { PostToMailbox(listener, p->movable, args...); });
+                };
+        }
+
+        template <typename ...Args, size_t... I>
+        static std::tuple<Args...> TakeArgs(std::index_sequence<I...>, uint32_t movable, const Args&... args)
+        {
+            return std::tuple<Args...>(PassParam<Args>(args, (movable >> I & 1) != 0)...);
+        }
+
+        //the owner calls the listener with the mailbox's own copy, so it may move the arguments out
+        template <typename ...Args>
+        static void PostToMailbox(const std::shared_ptr<MailboxListener>& listener, uint32_t movable, const Args&... args)
+        {
+            if (Rejected<MoveOnly<std::tuple<const Args&...>, std::tuple<Args...>>()>(movable))
+            {
+                return;
+            }
+            listener->mailbox.Push([weak = std::weak_ptr<MailboxListener>(listener), values = TakeArgs<Args...>(std::index_sequence_for<Args...>(), movable, args...)]()
+                {
+                    const std::shared_ptr<MailboxListener> listener = weak.lock();
+                    if (listener == nullptr || !listener->live.load(std::memory_order_acquire))
+                    {
+                        return;
+                    }
+                    const typename TupleTypeFromArgs<Args...>::TupleType refs = std::apply([](const Args&... a) { return typename TupleTypeFromArgs<Args...>::TupleType(a...); }, values);
+                    CallBackParam cbp = MakeParam<Args...>(&refs);
+                    cbp.movable = allMovable<Args...>;
+                    listener->cb(&cbp);
+                });
+        }
+
+        template <typename T>
+        struct SpanElement;
+
+        template <typename T, size_t N>
+        struct SpanElement<std::span<T, N>>
+        {
+            using Type = std::remove_const_t<T>;
+        };
+
+        //the payload type of a span listener F. the span is the last parameter, a callable with recver takes the recver first
+        template <typename F>
+        struct BatchOf
+        {
+            using TupleType = typename FunctionTraits<std::decay_t<F>>::TupleType;
+            using Type = typename SpanElement<std::decay_t<std::tuple_element_t<std::tuple_size_v<TupleType> - 1, TupleType>>>::Type;
+        };
+
+        template <typename F>
+        static constexpr uint64_t BatchSignature()
+        {
+            return signatureOf<typename BatchOf<F>::Type>;
+        }
+
+        /// <summary>
+        /// span listener storage, F is the user callable whose only parameter is a std::span.
+        /// invoke calls it with the batch, or with the single payload of a Send
+        /// </summary>
+        template <typename F, typename Invoke>
+        static auto MakeBatchCBStorage(Invoke&& invoke)
+        {
+            using T = typename BatchOf<F>::Type;
+            return [invoke = std::forward<Invoke>(invoke)](const CallBackParam* p)
+                {
+                    assert(p->IsTypeValid(signatureOf<T>));
+                    if (p->batchSize > 0)
+                    {
+                        invoke(std::span<const T>(static_cast<const T*>(p->p), p->batchSize));
+                    }
+                    else
+                    {
+                        invoke(std::span<const T>(&std::get<0>(*static_cast<const std::tuple<const T&>*>(p->p)), 1));
+                    }
+                };
+        }
+
+    private:
+        friend struct EventSystemImp;
+        friend struct FanOutState;
+        friend class ShmTransport;
+        template <typename... Events>
+        friend class StaticEventBus;
+        EventSystem(const EventSystem&) = delete;
+        void operator=(const EventSystem&) = delete;
+        struct EventSystemImp* _imp;
+        EventQueue* _queue;
+        std::thread::id _owner;
+        std::atomic<bool> _coalescing{ false };     //set after the event is in the coalesced table
+        std::atomic<EventRecorder*> _recorder{ nullptr };
+        std::atomic<SharedRing*> _sharedRing{ nullptr };    //set by ShmTransport
+        inline static std::atomic<uint64_t> _rejectedMoves{ 0 };
+        ListenerFilter _filter;
+    };
+
+    [[nodiscard]] inline EventSystem& ESI()
+    {
+        return EventSystem::Inst();
+    }
+
+    /// <summary>
+    /// awaiter of EventSystem::Next. its listener captures only this, so it fits the inline storage of the listener
+    /// and the wait allocates nothing. it must be awaited on the thread that may register on the bus
+    /// </summary>
+    template <bool Optional, typename... Args>
+    class [[nodiscard]] NextEvent : EventWait
+    {
+    public:
+        using Tuple = std::tuple<Args...>;
+        using Result = std::conditional_t<Optional, std::optional<Tuple>, Tuple>;
+
+        NextEvent(EventSystem& es, int evt, const void* sender, std::chrono::steady_clock::time_point until, std::stop_token stop)
+            : _es(es)
+            , _evt(evt)
+            , _sender(sender)
+            , _stop(std::move(stop))
+        {
+            if (until != std::chrono::steady_clock::time_point())
+            {
+                deadline = until;
+            }
+            expire = &Expire;
+        }
+
+        NextEvent(const NextEvent&) = delete;
+        void operator=(const NextEvent&) = delete;
+
+        ~NextEvent()
+        {
+            _onStop.reset();
+            const uint32_t last = state.exchange(Done, std::memory_order_acq_rel);
+            if (last == Waiting || last == Expiring)
+            {
+                _es.Unregister(handle);
+                _es.DisarmWait(*this);
+            }
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> coroutine)
+        {
+            if (_stop.stop_requested())
+            {
+                state.store(Done, std::memory_order_relaxed);
+                return false;
+            }
+
+            _coroutine = coroutine;
+            handle = _es.Reg(_evt, _sender, nullptr, [this](const EventSystem::CallBackParam* p) { OnEvent(p); }, signatureOf<Args...>);
+            if (deadline != std::chrono::steady_clock::time_point::max())
+            {
+                _es.ArmWait(*this);
+            }
+            if (_stop.stop_possible())
+            {
+                _onStop.emplace(_stop, OnStop{ this });
+            }
+
+            //once Waiting another thread may resume and destroy the frame, keep what is still needed on the stack
+            const std::stop_token stop = _stop;
+            EventSystem& es = _es;
+            state.store(Waiting, std::memory_order_release);
+            uint32_t expected = Waiting;
+            if (stop.stop_requested() && state.compare_exchange_strong(expected, Done, std::memory_order_acq_rel))
+            {
+                es.Unregister(handle);
+                es.DisarmWait(*this);
+                return false;
+            }
+            return true;
+        }
+
+        Result await_resume()
+        {
+            if constexpr (Optional)
+            {
+                return std::move(_value);
+            }
+            else
+            {
+                return std::move(*_value);
+            }
+        }
+
+    private:
+        struct OnStop
+        {
+            void operator()() const noexcept
+            {
+                uint32_t expected = Waiting;
+                if (self->state.compare_exchange_strong(expected, Expiring, std::memory_order_acq_rel))
+                {
+                    self->_es.ExpireWait(*self);
+                }
+            }
+
+            NextEvent* self;
+        };
+
+        void OnEvent(const EventSystem::CallBackParam* p)
+        {
+            assert(p->IsTypeValid(signatureOf<Args...>));
+            uint32_t expected = Waiting;
+            if (!state.compare_exchange_strong(expected, Fired, std::memory_order_acq_rel))
+            {
+                return;
+            }
+
+            //a batch resumes with its first payload
+            EventSystem::ApplyBody<typename TupleTypeFromArgs<Args...>::TupleType>(p, [this](const auto&... args)
+                {
+                    if (!_value)
+                    {
+                        _value.emplace(args...);
+                    }
+                });
+            _es.Unregister(handle);
+            _es.DisarmWait(*this);
+            _coroutine.resume();
+        }
+
+        static void Expire(EventWait* wait)
+        {
+            NextEvent& self = static_cast<NextEvent&>(*wait);
+            self._es.Unregister(self.handle);
+            self._es.DisarmWait(self);
+            self.state.store(Done, std::memory_order_relaxed);
+            self._coroutine.resume();
+        }
+
+        EventSystem& _es;
+        int _evt;
+        const void* _sender;
+        std::stop_token _stop;
+        std::optional<std::stop_callback<OnStop>> _onStop;
+        std::coroutine_handle<> _coroutine;
+        std::optional<Tuple> _value;
+    };
+
+    /// <summary>
+    /// the bus of the calling thread
+    /// </summary>
+    [[nodiscard]] inline EventSystem& ESL()
+    {
+        return EventSystem::Local();
     }
 }
 
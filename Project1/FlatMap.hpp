@@ -0,0 +1,233 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+namespace es
+{
+    /// <summary>
+    /// 64 bit finalizer of murmur3, spreads pointer and small integer keys over all bits
+    /// </summary>
+    inline uint64_t MixHash(uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ull;
+        x ^= x >> 33;
+        return x;
+    }
+
+    /// <summary>
+    /// open addressing hash map with linear probing, for pointer or integral keys.
+    /// keys are kept in their own array so a probe only touches key memory,
+    /// erase uses backward shift so there are no tombstones to skip
+    /// </summary>
+    /// <typeparam name="Key">pointer or integral type</typeparam>
+    /// <typeparam name="Value">default constructible and movable</typeparam>
+    template <typename Key, typename Value>
+    class FlatMap
+    {
+        static_assert(std::is_pointer_v<Key> || std::is_integral_v<Key>);
+
+        struct KeySlot
+        {
+            Key key{};
+            bool used = false;
+        };
+
+    public:
+        FlatMap() = default;
+
+        [[nodiscard]] size_t Size() const { return _size; }
+        [[nodiscard]] bool Empty() const { return _size == 0; }
+
+        //heap bytes of the key and value arrays
+        [[nodiscard]] size_t Bytes() const { return _keys.capacity() * sizeof(KeySlot) + _values.capacity() * sizeof(Value); }
+
+        [[nodiscard]] Value* Find(Key key)
+        {
+            const size_t idx = Locate(key);
+            return idx == npos ? nullptr : &_values[idx];
+        }
+
+        [[nodiscard]] const Value* Find(Key key) const
+        {
+            const size_t idx = Locate(key);
+            return idx == npos ? nullptr : &_values[idx];
+        }
+
+        /// <summary>
+        /// find the value of key, default construct one if absent
+        /// </summary>
+        Value& operator[](Key key)
+        {
+            if ((_size + 1) * 2 > _keys.size())
+            {
+                Rehash(_keys.empty() ? 8 : _keys.size() * 2);
+            }
+
+            size_t idx = Bucket(key);
+            while (_keys[idx].used)
+            {
+                if (_keys[idx].key == key)
+                {
+                    return _values[idx];
+                }
+                idx = (idx + 1) & Mask();
+            }
+
+            _keys[idx].key = key;
+            _keys[idx].used = true;
+            ++_size;
+            return _values[idx];
+        }
+
+        bool Erase(Key key)
+        {
+            size_t idx = Locate(key);
+            if (idx == npos)
+            {
+                return false;
+            }
+
+            //backward shift, move following entries of the same cluster back into the hole
+            size_t next = (idx + 1) & Mask();
+            while (_keys[next].used)
+            {
+                const size_t home = Bucket(_keys[next].key);
+                if (((next - home) & Mask()) >= ((next - idx) & Mask()))
+                {
+                    _keys[idx] = _keys[next];
+                    _values[idx] = std::move(_values[next]);
+                    idx = next;
+                }
+                next = (next + 1) & Mask();
+            }
+
+            _keys[idx] = KeySlot{};
+            _values[idx] = Value{};
+            --_size;
+            return true;
+        }
+
+        /// <summary>
+        /// erase all entries that fn(key, value) returns true
+        /// </summary>
+        template <typename Pred>
+        size_t EraseIf(Pred&& pred)
+        {
+            std::vector<Key> victims;
+            ForEach([&](Key key, Value& value)
+                {
+                    if (pred(key, value))
+                    {
+                        victims.push_back(key);
+                    }
+                });
+
+            for (Key key : victims)
+            {
+                Erase(key);
+            }
+            return victims.size();
+        }
+
+        template <typename Fn>
+        void ForEach(Fn&& fn)
+        {
+            for (size_t i = 0; i < _keys.size(); ++i)
+            {
+                if (_keys[i].used)
+                {
+                    fn(_keys[i].key, _values[i]);
+                }
+            }
+        }
+
+        template <typename Fn>
+        void ForEach(Fn&& fn) const
+        {
+            for (size_t i = 0; i < _keys.size(); ++i)
+            {
+                if (_keys[i].used)
+                {
+                    fn(_keys[i].key, _values[i]);
+                }
+            }
+        }
+
+        void Clear()
+        {
+            _keys.clear();
+            _values.clear();
+            _size = 0;
+        }
+
+    private:
+        static constexpr size_t npos = ~size_t(0);
+
+        size_t Mask() const { return _keys.size() - 1; }
+
+        size_t Bucket(Key key) const
+        {
+            if constexpr (std::is_pointer_v<Key>)
+            {
+                return (size_t)MixHash((uint64_t)(uintptr_t)key) & Mask();
+            }
+            else
+            {
+                return (size_t)MixHash((uint64_t)key) & Mask();
+            }
+        }
+
+        size_t Locate(Key key) const
+        {
+            if (_size == 0)
+            {
+                return npos;
+            }
+
+            size_t idx = Bucket(key);
+            while (_keys[idx].used)
+            {
+                if (_keys[idx].key == key)
+                {
+                    return idx;
+                }
+                idx = (idx + 1) & Mask();
+            }
+            return npos;
+        }
+
+        void Rehash(size_t capacity)
+        {
+            std::vector<KeySlot> keys(capacity);
+            std::vector<Value> values(capacity);
+            keys.swap(_keys);
+            values.swap(_values);
+
+            for (size_t i = 0; i < keys.size(); ++i)
+            {
+                if (keys[i].used)
+                {
+                    size_t idx = Bucket(keys[i].key);
+                    while (_keys[idx].used)
+                    {
+                        idx = (idx + 1) & Mask();
+                    }
+                    _keys[idx] = keys[i];
+                    _values[idx] = std::move(values[i]);
+                }
+            }
+        }
+
+        std::vector<KeySlot> _keys;
+        std::vector<Value> _values;
+        size_t _size = 0;
+    };
+}
@@ -0,0 +1,13 @@
+//(C) benyuan 2024
+//all rights reserved
+#include "Mailbox.hpp"
+
+namespace es
+{
+    //out of line, gcc 12 cannot write a thread_local of this type in an inline function to a module interface
+    Mailbox& Mailbox::Local()
+    {
+        thread_local Mailbox box;
+        return box;
+    }
+}
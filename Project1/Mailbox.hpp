@@ -0,0 +1,123 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include "EventQueue.hpp"
+
+namespace es
+{
+    /// <summary>
+    /// the calls waiting for one thread, see EventSystem::RegisterOn. other threads push into a lock free EventQueue,
+    /// the owner runs them in batches with Drain. a thread that waits on nothing else can block in Wait.
+    /// registrations share the queue, so a mailbox may be destroyed before them, Local() is when its thread exits.
+    /// its listeners are then no longer called and sends to them are dropped
+    /// </summary>
+    class Mailbox
+    {
+        struct State
+        {
+            State(std::thread::id owner, size_t capacity, QueueFullPolicy policy) : queue(capacity, policy), owner(owner) {}
+
+            EventQueue queue;
+            std::thread::id owner;
+            std::atomic<bool> closed{ false };
+        };
+
+    public:
+        /// <summary>
+        /// what a registration keeps of a mailbox, valid after the mailbox is destroyed
+        /// </summary>
+        class Ref
+        {
+        public:
+            //true once the mailbox is destroyed, nothing drains it any more
+            [[nodiscard]] bool Closed() const { return _state->closed.load(std::memory_order_acquire); }
+
+            [[nodiscard]] bool OnOwner() const { return _state->owner == std::this_thread::get_id(); }
+
+            template <typename F>
+            bool Push(F&& job)
+            {
+                return _state->queue.Push(std::forward<F>(job));
+            }
+
+        private:
+            friend class Mailbox;
+            explicit Ref(std::shared_ptr<State> state) : _state(std::move(state)) {}
+            std::shared_ptr<State> _state;
+        };
+
+        explicit Mailbox(std::thread::id owner = std::this_thread::get_id(), size_t capacity = 1024, QueueFullPolicy policy = QueueFullPolicy::Grow)
+            : _state(std::make_shared<State>(owner, capacity, policy))
+        {
+        }
+
+        ~Mailbox()
+        {
+            _state->closed.store(true, std::memory_order_release);
+        }
+
+        Mailbox(const Mailbox&) = delete;
+        void operator=(const Mailbox&) = delete;
+
+        /// <summary>
+        /// the mailbox of the calling thread, created on first use and destroyed when the thread exits
+        /// </summary>
+        [[nodiscard]] static Mailbox& Local();
+
+        [[nodiscard]] std::thread::id Owner() const { return _state->owner; }
+
+        /// <summary>
+        /// hand the mailbox to another thread, before senders start using it
+        /// </summary>
+        void SetOwner(std::thread::id owner = std::this_thread::get_id()) { _state->owner = owner; }
+
+        [[nodiscard]] bool OnOwner() const { return _state->owner == std::this_thread::get_id(); }
+
+        [[nodiscard]] Ref Share() const { return Ref(_state); }
+
+        /// <summary>
+        /// queue job, a callable taking no argument, for the owner
+        /// </summary>
+        /// <returns>false if the mailbox is full and its policy is QueueFullPolicy::Drop</returns>
+        template <typename F>
+        bool Push(F&& job)
+        {
+            return _state->queue.Push(std::forward<F>(job));
+        }
+
+        /// <summary>
+        /// run queued calls on the owner thread, in the order each sender pushed them
+        /// </summary>
+        /// <param name="maxCalls">stop after this many calls</param>
+        /// <returns>number of calls run</returns>
+        size_t Drain(size_t maxCalls = SIZE_MAX)
+        {
+            return _state->queue.Pump(maxCalls);
+        }
+
+        /// <summary>
+        /// block until a call is queued, or Notify is called and stop() holds
+        /// </summary>
+        template <typename Stop>
+        void Wait(Stop&& stop)
+        {
+            _state->queue.Wait(std::forward<Stop>(stop));
+        }
+
+        void Notify()
+        {
+            _state->queue.Notify();
+        }
+
+        [[nodiscard]] bool Empty() const { return _state->queue.Empty(); }
+
+    private:
+        std::shared_ptr<State> _state;
+    };
+}
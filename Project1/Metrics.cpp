@@ -0,0 +1,256 @@
+//(C) benyuan 2024
+//all rights reserved
+#include "Metrics.hpp"
+#include "FlatMap.hpp"
+#include <algorithm>
+#include <array>
+
+namespace es
+{
+    std::vector<ListenerMetrics> MetricsSnapshot::Slowest(size_t n) const
+    {
+        std::vector<ListenerMetrics> slowest = listeners;
+        std::sort(slowest.begin(), slowest.end(), [](const ListenerMetrics& a, const ListenerMetrics& b) { return a.p99Ns > b.p99Ns; });
+        if (slowest.size() > n)
+        {
+            slowest.resize(n);
+        }
+        return slowest;
+    }
+
+    void MetricsRecorder::ListenerStats::Reset(int e, const void* sd, const void* rc, uint64_t h)
+    {
+        evt.store(e, std::memory_order_relaxed);
+        sender.store(sd, std::memory_order_relaxed);
+        recver.store(rc, std::memory_order_relaxed);
+        calls.store(0, std::memory_order_relaxed);
+        ticks.store(0, std::memory_order_relaxed);
+        maxTicks.store(0, std::memory_order_relaxed);
+        for (auto& bucket : histogram)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        handle.store(h, std::memory_order_release);
+    }
+
+    void MetricsRecorder::ThreadMetrics::Clear()
+    {
+        for (auto& e : events)
+        {
+            e.sends.store(0, std::memory_order_relaxed);
+            e.invocations.store(0, std::memory_order_relaxed);
+        }
+        otherEvents.sends.store(0, std::memory_order_relaxed);
+        otherEvents.invocations.store(0, std::memory_order_relaxed);
+
+        for (auto& c : chunks)
+        {
+            if (ListenerStats* stats = c.load(std::memory_order_relaxed); stats != nullptr)
+            {
+                for (uint32_t i = 0; i < chunkSize; ++i)
+                {
+                    stats[i].handle.store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    MetricsRecorder::MetricsRecorder()
+        : _startTicks(Now())
+        , _start(std::chrono::steady_clock::now())
+    {
+    }
+
+    MetricsRecorder::~MetricsRecorder() = default;
+
+    /// <summary>
+    /// the counters of the calling thread after Local switched recorders. a thread sending on several buses in turn
+    /// finds each one here, Attach only locks the first time. ids are never reused, so entries of destroyed recorders
+    /// are never hit again, the map is dropped when it holds too many of them.
+    /// kept out of the header, a thread_local FlatMap in an inline function breaks the gcc 12 module build
+    /// </summary>
+    MetricsRecorder::ThreadMetrics& MetricsRecorder::Known()
+    {
+        thread_local FlatMap<uint64_t, ThreadMetrics*> known;
+        if (ThreadMetrics** found = known.Find(_id); found != nullptr)
+        {
+            return **found;
+        }
+
+        if (known.Size() >= maxKnownRecorders)
+        {
+            known.Clear();
+        }
+        ThreadMetrics& metrics = Attach();
+        known[_id] = &metrics;
+        return metrics;
+    }
+
+    MetricsRecorder::ThreadMetrics& MetricsRecorder::Attach()
+    {
+        std::lock_guard lock(_lock);
+        const std::thread::id self = std::this_thread::get_id();
+        for (auto& [id, metrics] : _threads)
+        {
+            if (id == self)
+            {
+                return *metrics;
+            }
+        }
+
+        _threads.emplace_back(self, std::make_unique<ThreadMetrics>());
+        ThreadMetrics& metrics = *_threads.back().second;
+        metrics.resetSeen.store(_resets.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return metrics;
+    }
+
+    //ticks are calibrated against steady_clock over the lifetime of the recorder
+    double MetricsRecorder::NsPerTick() const
+    {
+        auto elapsed = std::chrono::steady_clock::now() - _start;
+        uint64_t ticks = Now() - _startTicks;
+        while (elapsed < std::chrono::milliseconds(1) || ticks == 0)
+        {
+            std::this_thread::yield();
+            elapsed = std::chrono::steady_clock::now() - _start;
+            ticks = Now() - _startTicks;
+        }
+        return std::chrono::duration<double, std::nano>(elapsed).count() / (double)ticks;
+    }
+
+    ListenerMetrics MetricsRecorder::Summary(const ListenerStats& ls, double nsPerTick)
+    {
+        ListenerMetrics m;
+        m.evt = ls.evt.load(std::memory_order_relaxed);
+        m.sender = ls.sender.load(std::memory_order_relaxed);
+        m.recver = ls.recver.load(std::memory_order_relaxed);
+        m.handle = ls.handle.load(std::memory_order_relaxed);
+        m.calls = ls.calls.load(std::memory_order_relaxed);
+        m.totalNs = (double)ls.ticks.load(std::memory_order_relaxed) * nsPerTick;
+        m.maxNs = (double)ls.maxTicks.load(std::memory_order_relaxed) * nsPerTick;
+        return m;
+    }
+
+    MetricsSnapshot MetricsRecorder::Snapshot() const
+    {
+        MetricsSnapshot snapshot;
+#if ES_METRICS
+        struct Merged
+        {
+            ListenerMetrics metrics;
+            std::array<uint64_t, bucketCount> histogram{};
+        };
+
+        const double nsPerTick = NsPerTick();
+        const uint32_t resets = _resets.load(std::memory_order_relaxed);
+        std::vector<EventMetrics> events(denseEvents + 1);
+        std::vector<Merged> merged;
+        FlatMap<uint64_t, size_t> byHandle;
+
+        std::lock_guard lock(_lock);
+        for (const auto& [id, tm] : _threads)
+        {
+            //not cleared yet by its thread, counts as empty
+            if (tm->resetSeen.load(std::memory_order_acquire) != resets)
+            {
+                continue;
+            }
+
+            for (int e = 0; e <= denseEvents; ++e)
+            {
+                const EventStats& stats = e < denseEvents ? tm->events[e] : tm->otherEvents;
+                events[e].evt = e < denseEvents ? e : -1;
+                events[e].sends += stats.sends.load(std::memory_order_relaxed);
+                events[e].invocations += stats.invocations.load(std::memory_order_relaxed);
+            }
+
+            for (const auto& c : tm->chunks)
+            {
+                const ListenerStats* stats = c.load(std::memory_order_acquire);
+                if (stats == nullptr)
+                {
+                    continue;
+                }
+                for (uint32_t i = 0; i < chunkSize; ++i)
+                {
+                    const ListenerStats& ls = stats[i];
+                    const uint64_t handle = ls.handle.load(std::memory_order_acquire);
+                    if (handle == 0)
+                    {
+                        continue;
+                    }
+
+                    const ListenerMetrics m = Summary(ls, nsPerTick);
+                    size_t& index = byHandle[handle];
+                    if (index == 0)
+                    {
+                        merged.push_back(Merged{ m, {} });
+                        index = merged.size();
+                    }
+                    else
+                    {
+                        ListenerMetrics& into = merged[index - 1].metrics;
+                        into.calls += m.calls;
+                        into.totalNs += m.totalNs;
+                        into.maxNs = std::max(into.maxNs, m.maxNs);
+                    }
+
+                    auto& histogram = merged[index - 1].histogram;
+                    for (uint32_t b = 0; b < bucketCount; ++b)
+                    {
+                        histogram[b] += ls.histogram[b].load(std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+
+        for (const EventMetrics& e : events)
+        {
+            if (e.sends != 0 || e.invocations != 0)
+            {
+                snapshot.events.push_back(e);
+            }
+        }
+
+        for (Merged& m : merged)
+        {
+            m.metrics.p50Ns = MetricsRecorder::Percentile(m.histogram.data(), m.metrics.calls, 0.50) * nsPerTick;
+            m.metrics.p99Ns = MetricsRecorder::Percentile(m.histogram.data(), m.metrics.calls, 0.99) * nsPerTick;
+            snapshot.listeners.push_back(m.metrics);
+        }
+#endif
+        return snapshot;
+    }
+
+    void MetricsRecorder::Reset()
+    {
+        _resets.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void MetricsRecorder::SetSlowListener(double budgetNs, SlowListenerCallback callback)
+    {
+        std::lock_guard lock(_lock);
+        _budgetTicks.store(UINT64_MAX, std::memory_order_relaxed);
+        _slow = std::move(callback);
+        if (_slow && budgetNs >= 0)
+        {
+            _budgetTicks.store((uint64_t)(budgetNs / NsPerTick()), std::memory_order_relaxed);
+        }
+    }
+
+    void MetricsRecorder::ReportSlow(const ListenerStats& ls, uint64_t ticks)
+    {
+        SlowListenerCallback slow;
+        {
+            std::lock_guard lock(_lock);
+            slow = _slow;
+        }
+        if (!slow)
+        {
+            return;
+        }
+
+        const double nsPerTick = NsPerTick();
+        slow(Summary(ls, nsPerTick), (double)ticks * nsPerTick);
+    }
+}
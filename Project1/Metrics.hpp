@@ -0,0 +1,282 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//dispatch metrics, off unless the build defines ES_METRICS=1. when off, nothing is recorded
+//and the snapshot is empty, the API stays so callers need no #if
+#ifndef ES_METRICS
+#define ES_METRICS 0
+#endif
+
+namespace es
+{
+    struct EventMetrics
+    {
+        int evt = 0;
+        uint64_t sends = 0;
+        uint64_t invocations = 0;   //listener calls of all sends of evt
+    };
+
+    struct ListenerMetrics
+    {
+        int evt = 0;
+        const void* sender = nullptr;
+        const void* recver = nullptr;
+        uint64_t handle = 0;        //the EventSystem::CallBackHandle of the registration
+        uint64_t calls = 0;
+        double totalNs = 0;
+        double maxNs = 0;
+        double p50Ns = 0;
+        double p99Ns = 0;
+    };
+
+    struct MetricsSnapshot
+    {
+        std::vector<EventMetrics> events;
+        std::vector<ListenerMetrics> listeners;
+
+        /// <summary>
+        /// the n listeners with the highest p99 latency
+        /// </summary>
+        [[nodiscard]] std::vector<ListenerMetrics> Slowest(size_t n) const;
+    };
+
+    /// <summary>
+    /// called on the sending thread when one listener call takes longer than the budget
+    /// </summary>
+    using SlowListenerCallback = std::function<void(const ListenerMetrics& listener, double ns)>;
+
+    /// <summary>
+    /// per thread counters and log linear latency histograms. a thread only ever writes its own counters,
+    /// with plain relaxed loads and stores, a snapshot sums all threads
+    /// </summary>
+    class MetricsRecorder
+    {
+    public:
+        //histogram buckets: exact below 8 ticks, then 4 buckets per power of two
+        static constexpr uint32_t bucketCount = 160;
+        static constexpr int denseEvents = 1024;
+        static constexpr uint32_t chunkSize = 64;
+        static constexpr uint32_t maxChunks = 4096;    //slots past chunkSize * maxChunks share entries
+        static constexpr size_t maxKnownRecorders = 64;    //recorders a thread remembers, see Local
+
+        MetricsRecorder();
+        ~MetricsRecorder();
+        MetricsRecorder(const MetricsRecorder&) = delete;
+        void operator=(const MetricsRecorder&) = delete;
+
+        /// <summary>
+        /// timestamp in ticks, the cycle counter where there is one
+        /// </summary>
+        static uint64_t Now()
+        {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)) || defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+        }
+
+        static uint32_t Bucket(uint64_t ticks)
+        {
+            if (ticks < 8)
+            {
+                return (uint32_t)ticks;
+            }
+            const uint32_t msb = (uint32_t)std::bit_width(ticks) - 1;
+            const uint32_t bucket = (msb - 1) * 4 + (uint32_t)((ticks >> (msb - 2)) & 3);
+            return bucket < bucketCount ? bucket : bucketCount - 1;
+        }
+
+        //middle of a histogram bucket, the inverse of Bucket
+        static double BucketMid(uint32_t bucket)
+        {
+            if (bucket < 8)
+            {
+                return (double)bucket;
+            }
+            const uint32_t msb = bucket / 4 + 1;
+            const uint64_t lower = (uint64_t)(4 + bucket % 4) << (msb - 2);
+            const uint64_t width = 1ull << (msb - 2);
+            return (double)lower + (double)width / 2;
+        }
+
+        //value at quantile q of a histogram of bucketCount buckets holding count samples
+        static double Percentile(const uint64_t* histogram, uint64_t count, double q)
+        {
+            if (count == 0)
+            {
+                return 0;
+            }
+            const uint64_t rank = (uint64_t)(q * (double)count);
+            uint64_t seen = 0;
+            for (uint32_t b = 0; b < bucketCount; ++b)
+            {
+                seen += histogram[b];
+                if (seen > rank)
+                {
+                    return BucketMid(b);
+                }
+            }
+            return BucketMid(bucketCount - 1);
+        }
+
+        void RecordSend(int evt)
+        {
+            Increment(Local().Event(evt).sends);
+        }
+
+        /// <summary>
+        /// returns true when the call was over budget and the slow listener callback ran
+        /// </summary>
+        bool RecordCall(int evt, const void* sender, const void* recver, uint64_t handle, uint64_t ticks)
+        {
+            ThreadMetrics& tm = Local();
+            Increment(tm.Event(evt).invocations);
+
+            ListenerStats& ls = tm.Listener((uint32_t)handle);
+            if (ls.handle.load(std::memory_order_relaxed) != handle)
+            {
+                ls.Reset(evt, sender, recver, handle);
+            }
+            Increment(ls.calls);
+            ls.ticks.store(ls.ticks.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+            if (ticks > ls.maxTicks.load(std::memory_order_relaxed))
+            {
+                ls.maxTicks.store(ticks, std::memory_order_relaxed);
+            }
+            Increment(ls.histogram[Bucket(ticks)]);
+
+            if (ticks > _budgetTicks.load(std::memory_order_relaxed))
+            {
+                ReportSlow(ls, ticks);
+                return true;
+            }
+            return false;
+        }
+
+        [[nodiscard]] MetricsSnapshot Snapshot() const;
+        void Reset();
+        void SetSlowListener(double budgetNs, SlowListenerCallback callback);
+
+    private:
+        struct EventStats
+        {
+            std::atomic<uint64_t> sends{ 0 };
+            std::atomic<uint64_t> invocations{ 0 };
+        };
+
+        struct ListenerStats
+        {
+            void Reset(int e, const void* sd, const void* rc, uint64_t h);
+
+            std::atomic<uint64_t> handle{ 0 };
+            std::atomic<int> evt{ 0 };
+            std::atomic<const void*> sender{ nullptr };
+            std::atomic<const void*> recver{ nullptr };
+            std::atomic<uint64_t> calls{ 0 };
+            std::atomic<uint64_t> ticks{ 0 };
+            std::atomic<uint64_t> maxTicks{ 0 };
+            std::atomic<uint32_t> histogram[bucketCount] = {};
+        };
+
+        struct ThreadMetrics
+        {
+            EventStats& Event(int evt)
+            {
+                return (unsigned)evt < (unsigned)denseEvents ? events[evt] : otherEvents;
+            }
+
+            //listeners are indexed by the slot half of their handle, chunks are allocated on first use
+            ListenerStats& Listener(uint32_t slot)
+            {
+                std::atomic<ListenerStats*>& chunk = chunks[(slot / chunkSize) % maxChunks];
+                ListenerStats* stats = chunk.load(std::memory_order_relaxed);
+                if (stats == nullptr)
+                {
+                    stats = new ListenerStats[chunkSize];
+                    chunk.store(stats, std::memory_order_release);
+                }
+                return stats[slot % chunkSize];
+            }
+
+            void Clear();
+
+            ~ThreadMetrics()
+            {
+                for (auto& c : chunks)
+                {
+                    delete[] c.load(std::memory_order_relaxed);
+                }
+            }
+
+            EventStats events[denseEvents];
+            EventStats otherEvents;    //ids out of the dense range are summed under -1
+            std::atomic<ListenerStats*> chunks[maxChunks] = {};
+            std::atomic<uint32_t> resetSeen{ 0 };
+        };
+
+        template <typename T>
+        static void Increment(std::atomic<T>& counter)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        ThreadMetrics& Local()
+        {
+            //keyed by id, not address, a new recorder may reuse the address of a destroyed one
+            struct Cache
+            {
+                uint64_t owner = 0;
+                ThreadMetrics* metrics = nullptr;
+            };
+            thread_local Cache cache;
+            if (cache.owner != _id)
+            {
+                cache.metrics = &Known();
+                cache.owner = _id;
+            }
+
+            const uint32_t resets = _resets.load(std::memory_order_relaxed);
+            if (cache.metrics->resetSeen.load(std::memory_order_relaxed) != resets)
+            {
+                cache.metrics->Clear();
+                cache.metrics->resetSeen.store(resets, std::memory_order_release);
+            }
+            return *cache.metrics;
+        }
+
+        ThreadMetrics& Known();
+        ThreadMetrics& Attach();
+        double NsPerTick() const;
+        void ReportSlow(const ListenerStats& ls, uint64_t ticks);
+        static ListenerMetrics Summary(const ListenerStats& ls, double nsPerTick);
+
+        //a thread keeps its counters after it exits, so short lived threads still show up
+        inline static std::atomic<uint64_t> _nextId{ 1 };
+        const uint64_t _id = _nextId.fetch_add(1, std::memory_order_relaxed);
+        mutable std::mutex _lock;
+        std::vector<std::pair<std::thread::id, std::unique_ptr<ThreadMetrics>>> _threads;
+        std::atomic<uint32_t> _resets{ 0 };
+        std::atomic<uint64_t> _budgetTicks{ UINT64_MAX };
+        SlowListenerCallback _slow;
+        uint64_t _startTicks = 0;
+        std::chrono::steady_clock::time_point _start;
+    };
+}
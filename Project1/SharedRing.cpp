@@ -0,0 +1,392 @@
+//(C) benyuan 2024
+//all rights reserved
+#include "SharedRing.hpp"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace es
+{
+    namespace
+    {
+        constexpr uint32_t subWords = SharedRing::denseEvents / 64 + 1;
+    }
+
+    //the start of the region, zero filled when created, so every atomic starts at 0
+    struct SharedRing::Header
+    {
+        static constexpr uint64_t magic = 0x31474e4952534545ull;    //"EESRING1"
+        static constexpr uint32_t version = 2;
+
+        std::atomic<uint64_t> ready;        //magic once the creator has set the sizes
+        uint32_t ringVersion;
+        uint32_t slots;
+        uint32_t slotBytes;
+        uint32_t reserved;
+        uint64_t toolchain;                 //ToolchainSignature of the creator
+        alignas(64) std::atomic<uint64_t> tail;                 //next sequence to claim
+        alignas(64) std::atomic<int32_t> members[maxMembers];   //pid using the member slot, 0 free, -1 being released
+        std::atomic<uint64_t> memberSubs[maxMembers][subWords]; //what each member subscribed, to release a dead one
+        alignas(64) std::atomic<uint32_t> counts[denseEvents + 1];
+    };
+
+    namespace
+    {
+        static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free, "shared memory needs address free atomics");
+
+        //seq is 2s+1 while sequence s is written, 2s+2 once it is published
+        struct SlotHeader
+        {
+            std::atomic<uint64_t> seq;
+            int32_t evt;
+            uint32_t size;
+            uint64_t sender;
+            uint64_t signature;
+            uint32_t origin;        //member that published it
+            uint32_t reserved;
+        };
+
+        constexpr uint32_t payloadOffset = 48;
+        static_assert(sizeof(SlotHeader) <= payloadOffset);
+
+        std::string ShmName(const std::string& name)
+        {
+            return name.starts_with('/') ? name : "/" + name;
+        }
+    }
+
+    SharedRing::~SharedRing()
+    {
+        Detach();
+        delete _names.load(std::memory_order_relaxed);
+    }
+
+    bool SharedRing::Unlink(const std::string& name)
+    {
+#ifdef _WIN32
+        (void)name;
+        return false;
+#else
+        return ::shm_unlink(ShmName(name).c_str()) == 0;
+#endif
+    }
+
+    bool SharedRing::Attach(const std::string& name, const SharedRingOptions& options)
+    {
+        Detach();
+#ifdef _WIN32
+        (void)name;
+        (void)options;
+        return false;
+#else
+        const std::string shm = ShmName(name);
+        const size_t regionStart = (sizeof(Header) + 63) & ~size_t(63);
+        int fd = ::shm_open(shm.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        const bool creator = fd >= 0;
+        if (!creator)
+        {
+            if (errno != EEXIST || (fd = ::shm_open(shm.c_str(), O_RDWR, 0)) < 0)
+            {
+                return false;
+            }
+        }
+
+        uint32_t slots = 0;
+        uint32_t slotBytes = 0;
+        if (creator)
+        {
+            slots = std::bit_ceil(std::max<uint32_t>(options.slots, 64));
+            slotBytes = std::clamp<uint32_t>((options.slotBytes + 63) & ~63u, 64, SharedEvent::maxPayload);
+            if (::ftruncate(fd, (off_t)(regionStart + (size_t)slots * slotBytes)) != 0)
+            {
+                ::close(fd);
+                ::shm_unlink(shm.c_str());
+                return false;
+            }
+        }
+
+        //another process is creating it, wait for its sizes
+        struct stat st{};
+        const auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (::fstat(fd, &st) == 0 && (size_t)st.st_size < regionStart && std::chrono::steady_clock::now() < giveUp)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if ((size_t)st.st_size < regionStart)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        void* p = ::mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+        {
+            return false;
+        }
+        Header* header = static_cast<Header*>(p);
+        if (creator)
+        {
+            header->ringVersion = Header::version;
+            header->slots = slots;
+            header->slotBytes = slotBytes;
+            header->toolchain = ToolchainSignature();
+            header->ready.store(Header::magic, std::memory_order_release);
+        }
+        while (header->ready.load(std::memory_order_acquire) != Header::magic && std::chrono::steady_clock::now() < giveUp)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (header->ready.load(std::memory_order_acquire) != Header::magic || header->ringVersion != Header::version
+            || header->toolchain != ToolchainSignature()
+            || (size_t)st.st_size != regionStart + (size_t)header->slots * header->slotBytes)
+        {
+            ::munmap(p, (size_t)st.st_size);
+            return false;
+        }
+
+        //free the slots of processes that exited without detaching
+        const int32_t pid = (int32_t)::getpid();
+        for (uint32_t i = 0; i < maxMembers; ++i)
+        {
+            int32_t owner = header->members[i].load(std::memory_order_acquire);
+            if (owner > 0 && owner != pid && ::kill(owner, 0) != 0 && errno == ESRCH
+                && header->members[i].compare_exchange_strong(owner, -1, std::memory_order_acq_rel))
+            {
+                for (uint32_t w = 0; w < subWords; ++w)
+                {
+                    for (uint64_t bits = header->memberSubs[i][w].exchange(0, std::memory_order_acq_rel); bits != 0; bits &= bits - 1)
+                    {
+                        header->counts[w * 64 + (uint32_t)std::countr_zero(bits)].fetch_sub(1, std::memory_order_relaxed);
+                    }
+                }
+                header->members[i].store(0, std::memory_order_release);
+            }
+        }
+
+        uint32_t member = maxMembers;
+        for (uint32_t i = 0; i < maxMembers && member == maxMembers; ++i)
+        {
+            int32_t expected = 0;
+            if (header->members[i].compare_exchange_strong(expected, pid, std::memory_order_acq_rel))
+            {
+                member = i;
+            }
+        }
+        if (member == maxMembers)
+        {
+            ::munmap(p, (size_t)st.st_size);
+            return false;
+        }
+
+        auto* m = new Mapping;
+        m->header = header;
+        m->counts = header->counts;
+        m->slots = static_cast<std::byte*>(p) + regionStart;
+        m->bytes = (size_t)st.st_size;
+        m->mask = header->slots - 1;
+        m->slotBytes = header->slotBytes;
+        m->member = member;
+
+        std::lock_guard lock(_lock);
+        for (uint32_t w = 0; w < subWords; ++w)
+        {
+            const uint64_t mine = _mine[w].load(std::memory_order_relaxed);
+            header->memberSubs[member][w].store(mine, std::memory_order_relaxed);
+            for (uint64_t bits = mine; bits != 0; bits &= bits - 1)
+            {
+                header->counts[w * 64 + (uint32_t)std::countr_zero(bits)].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        //a new member reads from now on
+        _cursor = header->tail.load(std::memory_order_acquire);
+        _map.store(m, std::memory_order_release);
+        return true;
+#endif
+    }
+
+    void SharedRing::Detach()
+    {
+        std::lock_guard lock(_lock);
+        Mapping* m = _map.exchange(nullptr, std::memory_order_acq_rel);
+        if (m == nullptr)
+        {
+            return;
+        }
+
+        //subscriptions stay in _mine, a later Attach takes them again
+        for (uint32_t w = 0; w < subWords; ++w)
+        {
+            for (uint64_t bits = m->header->memberSubs[m->member][w].exchange(0, std::memory_order_acq_rel); bits != 0; bits &= bits - 1)
+            {
+                m->counts[w * 64 + (uint32_t)std::countr_zero(bits)].fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        m->header->members[m->member].store(0, std::memory_order_release);
+        EpochReclaimer::Retire(m, &Unmap);
+        EpochReclaimer::Collect();
+    }
+
+    void SharedRing::Unmap(void* p)
+    {
+        Mapping* m = static_cast<Mapping*>(p);
+#ifndef _WIN32
+        ::munmap(m->header, m->bytes);
+#endif
+        delete m;
+    }
+
+    void SharedRing::NameSender(const void* sender, uint64_t id)
+    {
+        std::lock_guard lock(_lock);
+        const FlatMap<const void*, uint64_t>* old = _names.load(std::memory_order_relaxed);
+        auto* names = old != nullptr ? new FlatMap<const void*, uint64_t>(*old) : new FlatMap<const void*, uint64_t>;
+        (*names)[sender] = id;
+        _names.store(names, std::memory_order_release);
+        EpochReclaimer::Retire(const_cast<FlatMap<const void*, uint64_t>*>(old));
+    }
+
+    void SharedRing::Subscribe(int evt)
+    {
+        std::lock_guard lock(_lock);
+        const uint32_t index = (unsigned)evt < (unsigned)denseEvents ? (uint32_t)evt : denseEvents;
+        const uint64_t bit = 1ull << (index % 64);
+        if ((_mine[index / 64].fetch_or(bit, std::memory_order_relaxed) & bit) != 0)
+        {
+            return;
+        }
+        if (Mapping* m = _map.load(std::memory_order_relaxed); m != nullptr)
+        {
+            m->header->memberSubs[m->member][index / 64].fetch_or(bit, std::memory_order_relaxed);
+            m->counts[index].fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    void SharedRing::Unsubscribe(int evt)
+    {
+        std::lock_guard lock(_lock);
+        const uint32_t index = (unsigned)evt < (unsigned)denseEvents ? (uint32_t)evt : denseEvents;
+        const uint64_t bit = 1ull << (index % 64);
+        if ((_mine[index / 64].fetch_and(~bit, std::memory_order_relaxed) & bit) == 0)
+        {
+            return;
+        }
+        if (Mapping* m = _map.load(std::memory_order_relaxed); m != nullptr)
+        {
+            m->header->memberSubs[m->member][index / 64].fetch_and(~bit, std::memory_order_relaxed);
+            m->counts[index].fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    std::byte* SharedRing::Claim(const Mapping& m, int evt, const void* sender, uint64_t signature, uint32_t size, uint64_t& seq)
+    {
+        if (size > m.slotBytes - payloadOffset)
+        {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        uint64_t id = 0;
+        if (const FlatMap<const void*, uint64_t>* names = _names.load(std::memory_order_acquire); names != nullptr && sender != nullptr)
+        {
+            const uint64_t* found = names->Find(sender);
+            id = found != nullptr ? *found : 0;
+        }
+
+        seq = m.header->tail.fetch_add(1, std::memory_order_relaxed);
+        std::byte* at = m.slots + (seq & m.mask) * m.slotBytes;
+        auto* slot = reinterpret_cast<SlotHeader*>(at);
+        slot->seq.store(2 * seq + 1, std::memory_order_relaxed);
+        //the writing mark is visible before any byte of the new content
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->evt = evt;
+        slot->size = size;
+        slot->sender = id;
+        slot->signature = signature;
+        slot->origin = m.member;
+        return at + payloadOffset;
+    }
+
+    void SharedRing::Seal(const Mapping& m, uint64_t seq)
+    {
+        auto* slot = reinterpret_cast<SlotHeader*>(m.slots + (seq & m.mask) * m.slotBytes);
+        slot->seq.store(2 * seq + 2, std::memory_order_release);
+        _published.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool SharedRing::Receive(SharedEvent& e)
+    {
+        EpochReclaimer::ReadGuard guard;
+        const Mapping* m = _map.load(std::memory_order_acquire);
+        if (m == nullptr)
+        {
+            return false;
+        }
+
+        for (;;)
+        {
+            const std::byte* at = m->slots + (_cursor & m->mask) * m->slotBytes;
+            const auto* slot = reinterpret_cast<const SlotHeader*>(at);
+            const uint64_t published = 2 * _cursor + 2;
+            const uint64_t seq = slot->seq.load(std::memory_order_acquire);
+            if (seq == published)
+            {
+                e.evt = slot->evt;
+                e.size = std::min(slot->size, m->slotBytes - payloadOffset);
+                e.sender = slot->sender;
+                e.signature = slot->signature;
+                const uint32_t origin = slot->origin;
+                std::memcpy(e.payload, at + payloadOffset, e.size);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot->seq.load(std::memory_order_relaxed) == published)
+                {
+                    ++_cursor;
+                    if (origin == m->member)
+                    {
+                        continue;
+                    }
+                    _received.store(_received.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            else if (seq < published && m->header->tail.load(std::memory_order_acquire) - _cursor <= m->mask / 2)
+            {
+                //not published yet
+                return false;
+            }
+            else if (seq < published)
+            {
+                //half a ring was published after it and it is still not done, its publisher is gone
+                _lost.store(_lost.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                ++_cursor;
+                continue;
+            }
+
+            //overwritten by a later lap, go on from the oldest sequence still in the ring
+            const uint64_t tail = m->header->tail.load(std::memory_order_acquire);
+            const uint64_t oldest = std::max(_cursor + 1, tail > m->mask ? tail - m->mask : 0);
+            _lost.store(_lost.load(std::memory_order_relaxed) + (oldest - _cursor), std::memory_order_relaxed);
+            _cursor = oldest;
+        }
+    }
+
+    SharedRingStats SharedRing::Stats() const
+    {
+        SharedRingStats stats;
+        stats.published = _published.load(std::memory_order_relaxed);
+        stats.received = _received.load(std::memory_order_relaxed);
+        stats.lost = _lost.load(std::memory_order_relaxed);
+        stats.dropped = _dropped.load(std::memory_order_relaxed);
+        return stats;
+    }
+}
@@ -0,0 +1,186 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include "EpochReclaimer.hpp"
+#include "EventLog.hpp"
+#include "FlatMap.hpp"
+
+namespace es
+{
+    //arguments a shared ring carries, copied as bytes into another process
+    template <typename T>
+    concept SharedArg = std::is_trivially_copyable_v<T> && !std::is_pointer_v<T> && !std::is_member_pointer_v<T> && alignof(T) <= 16;
+
+    /// <summary>
+    /// the arguments packed one after the other, each at its own alignment
+    /// </summary>
+    template <typename ...Args>
+    struct SharedLayout
+    {
+        static constexpr std::array<uint32_t, sizeof...(Args)> offsets = []()
+            {
+                std::array<uint32_t, sizeof...(Args)> at{};
+                uint32_t size = 0;
+                [[maybe_unused]] size_t i = 0;
+                ((size = (size + (uint32_t)alignof(Args) - 1) & ~((uint32_t)alignof(Args) - 1), at[i++] = size, size += (uint32_t)sizeof(Args)), ...);
+                return at;
+            }();
+        static constexpr uint32_t size = []()
+            {
+                uint32_t size = 0;
+                ((size = (size + (uint32_t)alignof(Args) - 1) & ~((uint32_t)alignof(Args) - 1), size += (uint32_t)sizeof(Args)), ...);
+                return size;
+            }();
+    };
+
+    struct SharedRingOptions
+    {
+        uint32_t slots = 1u << 16;      //rounded up to a power of two
+        uint32_t slotBytes = 128;       //header included, a multiple of 64
+    };
+
+    struct SharedRingStats
+    {
+        uint64_t published = 0;
+        uint64_t received = 0;
+        uint64_t lost = 0;          //overwritten before this process read them
+        uint64_t dropped = 0;       //arguments larger than a slot
+        uint64_t unbound = 0;       //received events with no Subscribe, or with other argument types
+    };
+
+    /// <summary>
+    /// one event read from a shared ring, its arguments copied out of the slot
+    /// </summary>
+    struct SharedEvent
+    {
+        static constexpr uint32_t maxPayload = 4096;
+
+        int evt = 0;
+        uint32_t size = 0;
+        uint64_t sender = 0;        //id given to NameSender by the publisher, 0 for an unnamed sender
+        uint64_t signature = 0;     //LogSignature of the arguments
+        alignas(16) std::byte payload[maxPayload];
+    };
+
+    /// <summary>
+    /// a broadcast ring of fixed size slots in named shared memory, for processes on one host.
+    /// a publisher claims a slot with one atomic add and writes it seqlock style, every attached process reads
+    /// all slots with a cursor of its own. publishers never wait: a reader that falls a whole ring behind
+    /// loses what was overwritten and counts it. only events some other process subscribed to are published.
+    /// POSIX shared memory, Attach fails elsewhere
+    /// </summary>
+    class SharedRing
+    {
+    public:
+        static constexpr uint32_t maxMembers = 64;
+        static constexpr int denseEvents = 1024;    //ids past it share one subscription count
+
+        SharedRing() = default;
+        ~SharedRing();
+        SharedRing(const SharedRing&) = delete;
+        void operator=(const SharedRing&) = delete;
+
+        /// <summary>
+        /// attach to the region called name, created with options if it does not exist yet.
+        /// otherwise the options of its creator apply
+        /// </summary>
+        /// <returns>false if the region could not be created or mapped, was created by a build of another toolchain,
+        /// see ToolchainSignature, or has no free member slot</returns>
+        bool Attach(const std::string& name, const SharedRingOptions& options = {});
+        void Detach();
+        [[nodiscard]] bool IsAttached() const { return _map.load(std::memory_order_relaxed) != nullptr; }
+
+        /// <summary>
+        /// remove the region name, processes attached keep using it until they detach
+        /// </summary>
+        static bool Unlink(const std::string& name);
+
+        /// <summary>
+        /// publish sends from sender as id, other processes map it to an object of theirs. unnamed senders publish as 0
+        /// </summary>
+        void NameSender(const void* sender, uint64_t id);
+
+        /// <summary>
+        /// take evt from other processes, they publish it from now on
+        /// </summary>
+        void Subscribe(int evt);
+        void Unsubscribe(int evt);
+
+        template <typename ...Args>
+        void Publish(int evt, const void* sender, const Args&... args)
+        {
+            if constexpr ((SharedArg<Args> && ...))
+            {
+                EpochReclaimer::ReadGuard guard;
+                const Mapping* m = _map.load(std::memory_order_acquire);
+                if (m == nullptr || !Wanted(*m, evt))
+                {
+                    return;
+                }
+                using Layout = SharedLayout<Args...>;
+                uint64_t seq = 0;
+                std::byte* out = Claim(*m, evt, sender, LogSignature<Args...>(), Layout::size, seq);
+                if (out != nullptr)
+                {
+                    [[maybe_unused]] size_t i = 0;
+                    ((std::memcpy(out + Layout::offsets[i++], &args, sizeof(Args))), ...);
+                    Seal(*m, seq);
+                }
+            }
+        }
+
+        /// <summary>
+        /// copy the next event of another process into e
+        /// </summary>
+        /// <returns>false when there is none yet</returns>
+        bool Receive(SharedEvent& e);
+
+        [[nodiscard]] SharedRingStats Stats() const;
+
+    private:
+        struct Header;
+
+        //the region as this process mapped it, retired on Detach so a publisher never sees it unmapped
+        struct Mapping
+        {
+            Header* header = nullptr;
+            std::atomic<uint32_t>* counts = nullptr;    //subscriptions per event of all processes
+            std::byte* slots = nullptr;
+            size_t bytes = 0;
+            uint64_t mask = 0;
+            uint32_t slotBytes = 0;
+            uint32_t member = 0;
+        };
+
+        //an event another process subscribed to
+        bool Wanted(const Mapping& m, int evt) const
+        {
+            const int index = (unsigned)evt < (unsigned)denseEvents ? evt : denseEvents;
+            const uint32_t count = m.counts[index].load(std::memory_order_relaxed);
+            return count > (_mine[index / 64].load(std::memory_order_relaxed) >> (index % 64) & 1);
+        }
+
+        std::byte* Claim(const Mapping& m, int evt, const void* sender, uint64_t signature, uint32_t size, uint64_t& seq);
+        void Seal(const Mapping& m, uint64_t seq);
+        static void Unmap(void* p);
+
+        std::atomic<Mapping*> _map{ nullptr };
+        uint64_t _cursor = 0;
+        std::atomic<uint64_t> _mine[denseEvents / 64 + 1] = {};
+
+        std::mutex _lock;   //names and subscriptions
+        std::atomic<const FlatMap<const void*, uint64_t>*> _names{ nullptr };
+        std::atomic<uint64_t> _published{ 0 };
+        std::atomic<uint64_t> _dropped{ 0 };
+        std::atomic<uint64_t> _received{ 0 };
+        std::atomic<uint64_t> _lost{ 0 };
+    };
+}
@@ -0,0 +1,258 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include "EventSystem.hpp"
+#include "FlatMap.hpp"
+#include "SharedRing.hpp"
+
+namespace es
+{
+    /// <summary>
+    /// carries the events of a bus to the buses of other processes on the host through a SharedRing.
+    /// once attached, the bus publishes every event it sends that another process subscribed to, arguments must be
+    /// trivially copyable. events of other processes are received with Poll on the thread that sends on the bus,
+    /// or on a receiver thread of the transport in thread safe mode, and reach the listeners of this bus.
+    /// the argument types of an event are not in the ring, each event to receive is bound to them with Subscribe
+    /// and checked against the signature of every event received
+    /// </summary>
+    class ShmTransport
+    {
+    public:
+        explicit ShmTransport(EventSystem& es = ESI()) : _es(es) {}
+        ~ShmTransport()
+        {
+            Detach();
+            delete _routes.load(std::memory_order_relaxed);
+        }
+        ShmTransport(const ShmTransport&) = delete;
+        void operator=(const ShmTransport&) = delete;
+
+        /// <summary>
+        /// attach to the region called name, see SharedRing::Attach, and publish the sends of the bus to it
+        /// </summary>
+        bool Attach(const std::string& name, const SharedRingOptions& options = {})
+        {
+            Detach();
+            if (!_ring.Attach(name, options))
+            {
+                return false;
+            }
+            _es._sharedRing.store(&_ring, std::memory_order_release);
+            return true;
+        }
+
+        /// <summary>
+        /// stop the receiver, stop publishing and leave the region
+        /// </summary>
+        void Detach()
+        {
+            StopReceiver();
+            SharedRing* expected = &_ring;
+            _es._sharedRing.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+            _ring.Detach();
+        }
+
+        [[nodiscard]] bool IsAttached() const { return _ring.IsAttached(); }
+
+        /// <summary>
+        /// receive evt from other processes with the argument types Args, a Subscribe before Attach applies once attached
+        /// </summary>
+        template <typename ...Args, typename EventType>
+        void Subscribe(EventType evtID)
+        {
+            static_assert(std::is_convertible_v<EventType, int> || std::is_enum_v<EventType>);
+            static_assert((SharedArg<std::decay_t<Args>> && ...), "shared events take trivially copyable arguments");
+            Bind<std::decay_t<Args>...>((int)evtID, Binding{ LogSignature<std::decay_t<Args>...>(), &Deliver<std::decay_t<Args>...> });
+        }
+
+        /// <summary>
+        /// subscribe a typed event with its EventSignature
+        /// </summary>
+        template <auto EventID>
+        void Subscribe()
+        {
+            static_assert(TypedEvent<EventID>, "EventID has no EventSignature");
+            SubscribeTyped<EventID>(std::type_identity<typename EventSignature<EventID>::Type>());
+        }
+
+        template <typename EventType>
+        void Unsubscribe(EventType evtID)
+        {
+            std::lock_guard lock(_lock);
+            _ring.Unsubscribe((int)evtID);
+            Routes* routes = Copy();
+            routes->bindings.Erase((int)evtID);
+            Publish(routes);
+        }
+
+        /// <summary>
+        /// publish the sends of sender as id, see SharedRing::NameSender
+        /// </summary>
+        void NameSender(const void* sender, uint64_t id)
+        {
+            _ring.NameSender(sender, id);
+        }
+
+        /// <summary>
+        /// deliver the events other processes sent as id as sent by sender. unmapped ones are sent with nullptr
+        /// </summary>
+        void MapSender(uint64_t id, const void* sender)
+        {
+            std::lock_guard lock(_lock);
+            Routes* routes = Copy();
+            routes->senders[id] = sender;
+            Publish(routes);
+        }
+
+        /// <summary>
+        /// deliver up to max events of other processes on the calling thread. not while the receiver runs
+        /// </summary>
+        /// <returns>the events received</returns>
+        size_t Poll(size_t max = ~size_t(0))
+        {
+            size_t n = 0;
+            while (n < max && _ring.Receive(*_event))
+            {
+                DeliverReceived(*_event);
+                ++n;
+            }
+            return n;
+        }
+
+        /// <summary>
+        /// deliver events of other processes on a thread of the transport, switches the bus to thread safe mode
+        /// </summary>
+        void StartReceiver()
+        {
+            if (_receiver.joinable())
+            {
+                return;
+            }
+            _es.SetThreadSafe(true);
+            _receiver = std::jthread([this](std::stop_token stop)
+                {
+                    uint32_t idle = 0;
+                    while (!stop.stop_requested())
+                    {
+                        if (Poll(256) > 0)
+                        {
+                            idle = 0;
+                        }
+                        else if (++idle < 256)
+                        {
+                            std::this_thread::yield();
+                        }
+                        else
+                        {
+                            std::this_thread::sleep_for(std::chrono::microseconds(50));
+                        }
+                    }
+                });
+        }
+
+        void StopReceiver()
+        {
+            if (_receiver.joinable())
+            {
+                _receiver.request_stop();
+                _receiver.join();
+            }
+        }
+
+        [[nodiscard]] SharedRingStats Stats() const
+        {
+            SharedRingStats stats = _ring.Stats();
+            stats.unbound = _unbound.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+    private:
+        using DeliverFn = void (*)(EventSystem& es, int evt, const void* sender, const std::byte* payload);
+
+        struct Binding
+        {
+            uint64_t signature = 0;
+            DeliverFn deliver = nullptr;
+            uint32_t size = 0;
+        };
+
+        //copied on write, the receiver reads them without the lock
+        struct Routes
+        {
+            FlatMap<int, Binding> bindings;
+            FlatMap<uint64_t, const void*> senders;
+        };
+
+        //the arguments are read in place, the event buffer outlives the listeners
+        template <typename ...Args>
+        static void Deliver(EventSystem& es, int evt, const void* sender, const std::byte* payload)
+        {
+            using Layout = SharedLayout<Args...>;
+            [&]<size_t... I>(std::index_sequence<I...>)
+            {
+                const typename TupleTypeFromArgs<Args...>::TupleType refs{ *reinterpret_cast<const Args*>(payload + Layout::offsets[I])... };
+                const EventSystem::CallBackParam cbp = EventSystem::MakeParam<Args...>(&refs);
+                es.Call(evt, sender, &cbp);
+            }(std::index_sequence_for<Args...>());
+        }
+
+        template <auto EventID, typename ReturnType, typename ...Args>
+        void SubscribeTyped(std::type_identity<ReturnType(Args...)>)
+        {
+            static_assert((SharedArg<std::decay_t<Args>> && ...), "shared events take trivially copyable arguments");
+            Bind<std::decay_t<Args>...>((int)EventID, Binding{ LogSignature<std::decay_t<Args>...>(), &Deliver<std::decay_t<Args>...> });
+        }
+
+        template <typename ...Args>
+        void Bind(int evt, Binding binding)
+        {
+            binding.size = SharedLayout<Args...>::size;
+            std::lock_guard lock(_lock);
+            Routes* routes = Copy();
+            routes->bindings[evt] = binding;
+            Publish(routes);
+            _ring.Subscribe(evt);
+        }
+
+        void DeliverReceived(const SharedEvent& e)
+        {
+            EpochReclaimer::ReadGuard guard;
+            const Routes* routes = _routes.load(std::memory_order_acquire);
+            const Binding* binding = routes != nullptr ? routes->bindings.Find(e.evt) : nullptr;
+            if (binding == nullptr || binding->signature != e.signature || binding->size != e.size)
+            {
+                _unbound.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            const void* const* sender = e.sender != 0 ? routes->senders.Find(e.sender) : nullptr;
+            binding->deliver(_es, e.evt, sender != nullptr ? *sender : nullptr, e.payload);
+        }
+
+        Routes* Copy() const
+        {
+            const Routes* routes = _routes.load(std::memory_order_relaxed);
+            return routes != nullptr ? new Routes(*routes) : new Routes;
+        }
+
+        void Publish(Routes* routes)
+        {
+            EpochReclaimer::Retire(const_cast<Routes*>(_routes.exchange(routes, std::memory_order_acq_rel)));
+        }
+
+        EventSystem& _es;
+        SharedRing _ring;
+        std::unique_ptr<SharedEvent> _event = std::make_unique<SharedEvent>();
+        std::mutex _lock;   //bindings and senders
+        std::atomic<const Routes*> _routes{ nullptr };
+        std::atomic<uint64_t> _unbound{ 0 };
+        std::jthread _receiver;
+    };
+}
@@ -0,0 +1,210 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "EventSystem.hpp"
+
+namespace es
+{
+    /// <summary>
+    /// one event of a StaticEventBus and the types of its handlers, called in the order given
+    /// </summary>
+    template <auto EventID, typename... Handlers>
+    struct StaticEvent
+    {
+        static constexpr auto id = EventID;
+        using HandlerTypes = std::tuple<Handlers...>;
+    };
+
+    /// <summary>
+    /// an event bus whose events and handlers are all known at compile time, for inner loops that cannot afford the
+    /// lookup and type erasure of EventSystem. Send calls the handlers of the event one after the other and the compiler
+    /// inlines them like hand written calls, nothing is looked up or allocated at runtime.
+    /// a handler is a class with one operator() taking the parameters of the event, checked with FunctionTraits, or
+    /// against the EventSignature of a typed event, at compile time. the bus owns one instance of each handler type,
+    /// shared by the events that list it: given to the constructor, replaced by Register, value initialized otherwise.
+    /// sender is taken so calls read the same as on EventSystem, every handler gets every send
+    /// </summary>
+    template <typename... Events>
+    class StaticEventBus
+    {
+        template <typename List, typename... Ts>
+        struct Unique
+        {
+            using Type = List;
+        };
+
+        template <typename... Us, typename T, typename... Ts>
+        struct Unique<std::tuple<Us...>, T, Ts...>
+            : Unique<std::conditional_t<(std::is_same_v<T, Us> || ...), std::tuple<Us...>, std::tuple<Us..., T>>, Ts...>
+        {
+        };
+
+        template <typename... Hs>
+        static auto UniqueOf(std::tuple<Hs...>*) -> typename Unique<std::tuple<>, Hs...>::Type;
+
+        using HandlerTuple = decltype(UniqueOf((decltype(std::tuple_cat(std::declval<typename Events::HandlerTypes>()...))*)nullptr));
+
+        template <typename H>
+        static constexpr bool isHandler = []<typename... Us>(std::tuple<Us...>*) { return (std::is_same_v<H, Us> || ...); }((HandlerTuple*)nullptr);
+
+        //ids of different enums are different events
+        template <auto A, auto B>
+        static constexpr bool SameEvent()
+        {
+            if constexpr (std::is_same_v<decltype(A), decltype(B)>)
+            {
+                return A == B;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        //the handlers of every entry for EventID, in order
+        template <auto EventID>
+        using HandlersOf = decltype(std::tuple_cat(std::declval<
+            std::conditional_t<SameEvent<EventID, Events::id>(), typename Events::HandlerTypes, std::tuple<>>>()...));
+
+    public:
+        template <typename... Hs>
+            requires (isHandler<std::decay_t<Hs>> && ...)
+        explicit StaticEventBus(Hs&&... handlers) : _handlers(Make((HandlerTuple*)nullptr, std::forward<Hs>(handlers)...))
+        {
+        }
+
+        /// <summary>
+        /// replace the instance of a handler type, the events that list it call the new one from the next Send
+        /// </summary>
+        template <typename H>
+        void Register(H&& handler)
+        {
+            static_assert(isHandler<std::decay_t<H>>, "not a handler type of the bus");
+            static_assert(std::is_assignable_v<std::decay_t<H>&, H&&>, "handler cannot be replaced, pass it to the constructor");
+            std::get<std::decay_t<H>>(_handlers) = std::forward<H>(handler);
+        }
+
+        template <typename H>
+        [[nodiscard]] H& Handler()
+        {
+            static_assert(isHandler<H>, "not a handler type of the bus");
+            return std::get<H>(_handlers);
+        }
+
+        template <typename H>
+        [[nodiscard]] const H& Handler() const
+        {
+            static_assert(isHandler<H>, "not a handler type of the bus");
+            return std::get<H>(_handlers);
+        }
+
+        /// <summary>
+        /// call the handlers of EventID with args. for a typed event the arguments convert to its EventSignature
+        /// as for EventSystem::Send, otherwise every handler takes exactly the decayed argument types.
+        /// an event the bus has no handlers for is sent to nobody
+        /// </summary>
+        template <auto EventID, typename... Ts>
+        void Send(const void* sender, Ts&&... args)
+        {
+            (void)sender;
+            if constexpr (TypedEvent<EventID>)
+            {
+                using Signature = typename EventSignature<EventID>::Type;
+                static_assert(EventArgs<Signature>::template sendable<Ts...>, "arguments do not match the EventSignature of EventID");
+                CallTyped<EventID>(std::type_identity<Signature>(), 0, std::forward<Ts>(args)...);
+            }
+            else
+            {
+                Call<EventID, std::decay_t<Ts>...>(0, args...);
+            }
+        }
+
+        template <auto EventID, typename... Ts>
+        void SendAll(Ts&&... args)
+        {
+            Send<EventID>(nullptr, std::forward<Ts>(args)...);
+        }
+
+        /// <summary>
+        /// Send that hands rvalue arguments to the last handler, see EventSystem::SendMove
+        /// </summary>
+        template <auto EventID, typename... Ts>
+        void SendMove(const void* sender, Ts&&... args)
+        {
+            (void)sender;
+            if constexpr (TypedEvent<EventID>)
+            {
+                using Signature = typename EventSignature<EventID>::Type;
+                static_assert(EventArgs<Signature>::template sendable<Ts...>, "arguments do not match the EventSignature of EventID");
+                CallTyped<EventID>(std::type_identity<Signature>(), EventArgs<Signature>::template movable<Ts...>, std::forward<Ts>(args)...);
+            }
+            else
+            {
+                Call<EventID, std::decay_t<Ts>...>(MoveMask<rvalueArg<Ts>...>(), args...);
+            }
+        }
+
+    private:
+        template <typename U, typename H, typename... Hs>
+        static U Pick(H&& handler, Hs&&... rest)
+        {
+            if constexpr (std::is_same_v<std::decay_t<H>, U>)
+            {
+                return U(std::forward<H>(handler));
+            }
+            else
+            {
+                return Pick<U>(std::forward<Hs>(rest)...);
+            }
+        }
+
+        template <typename U>
+        static U Pick()
+        {
+            return U{};
+        }
+
+        //each handler type takes the constructor argument of its type, every argument is used once
+        template <typename... Us, typename... Hs>
+        static HandlerTuple Make(std::tuple<Us...>*, Hs&&... handlers)
+        {
+            return HandlerTuple(Pick<Us>(std::forward<Hs>(handlers)...)...);
+        }
+
+        template <auto EventID, typename ReturnType, typename... Args>
+        void CallTyped(std::type_identity<ReturnType(Args...)>, uint32_t movable, const std::decay_t<Args>&... args)
+        {
+            Call<EventID, std::decay_t<Args>...>(movable, args...);
+        }
+
+        template <auto EventID, typename... Args>
+        void Call(uint32_t movable, const Args&... args)
+        {
+            using Handlers = HandlersOf<EventID>;
+            [&]<size_t... I>(std::index_sequence<I...>)
+            {
+                (Invoke<std::tuple_element_t<I, Handlers>>(I + 1 == sizeof...(I) ? movable : 0, args...), ...);
+            }(std::make_index_sequence<std::tuple_size_v<Handlers>>());
+        }
+
+        template <typename H, typename... Args>
+        void Invoke(uint32_t movable, const Args&... args)
+        {
+            using Traits = FunctionTraits<H>;
+            static_assert(std::is_same_v<typename Traits::TupleType, typename TupleTypeFromArgs<Args...>::TupleType>,
+                "handler parameters do not match the arguments of the event");
+            H& handler = std::get<H>(_handlers);
+            [&]<size_t... I>(std::index_sequence<I...>)
+            {
+                handler(EventSystem::PassParam<std::tuple_element_t<I, typename Traits::ParamTypes>>(args, (movable >> I & 1) != 0)...);
+            }(std::index_sequence_for<Args...>());
+        }
+
+        HandlerTuple _handlers;
+    };
+}
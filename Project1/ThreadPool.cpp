@@ -0,0 +1,124 @@
+//(C) benyuan 2024
+//all rights reserved
+#include "ThreadPool.hpp"
+
+namespace es
+{
+    namespace
+    {
+        //which pool and worker the current thread belongs to, so Submit from a worker stays local
+        thread_local const ThreadPool* currentPool = nullptr;
+        thread_local size_t currentWorker = 0;
+    }
+
+    ThreadPool::ThreadPool(size_t threads)
+    {
+        if (threads == 0)
+        {
+            threads = 1;
+        }
+
+        for (size_t i = 0; i < threads; ++i)
+        {
+            _workers.push_back(std::make_unique<Worker>());
+        }
+
+        for (size_t i = 0; i < threads; ++i)
+        {
+            _threads.emplace_back([this, i]() { Run(i); });
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        _stop.store(true, std::memory_order_release);
+        _signal.fetch_add(1, std::memory_order_release);
+        _signal.notify_all();
+        for (auto& t : _threads)
+        {
+            t.join();
+        }
+    }
+
+    size_t ThreadPool::DefaultSize()
+    {
+        const size_t hw = std::thread::hardware_concurrency();
+        return hw > 1 ? hw - 1 : 1;
+    }
+
+    void ThreadPool::Submit(Task&& task)
+    {
+        const size_t index = currentPool == this ? currentWorker : _nextWorker.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+        {
+            std::lock_guard lock(_workers[index]->lock);
+            _workers[index]->tasks.push_back(std::move(task));
+        }
+        _queued.fetch_add(1, std::memory_order_seq_cst);
+        _signal.fetch_add(1, std::memory_order_release);
+        _signal.notify_one();
+    }
+
+    bool ThreadPool::TryPop(size_t index, Task& task)
+    {
+        Worker& w = *_workers[index];
+        std::lock_guard lock(w.lock);
+        if (w.tasks.empty())
+        {
+            return false;
+        }
+        task = std::move(w.tasks.back());
+        w.tasks.pop_back();
+        return true;
+    }
+
+    bool ThreadPool::TrySteal(size_t index, Task& task)
+    {
+        for (size_t i = 1; i < _workers.size(); ++i)
+        {
+            Worker& w = *_workers[(index + i) % _workers.size()];
+            std::unique_lock lock(w.lock, std::try_to_lock);
+            if (!lock.owns_lock() || w.tasks.empty())
+            {
+                continue;
+            }
+            task = std::move(w.tasks.front());
+            w.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void ThreadPool::Run(size_t index)
+    {
+        currentPool = this;
+        currentWorker = index;
+
+        Task task;
+        while (true)
+        {
+            const uint32_t signal = _signal.load(std::memory_order_acquire);
+            if (TryPop(index, task) || TrySteal(index, task))
+            {
+                _queued.fetch_sub(1, std::memory_order_relaxed);
+                task();
+                task.Reset();
+                continue;
+            }
+
+            if (_stop.load(std::memory_order_acquire))
+            {
+                break;
+            }
+
+            //a steal may have missed a locked deque, only sleep when nothing is queued anywhere
+            if (_queued.load(std::memory_order_seq_cst) == 0)
+            {
+                _signal.wait(signal, std::memory_order_acquire);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
@@ -0,0 +1,58 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Delegate.hpp"
+
+namespace es
+{
+    /// <summary>
+    /// work stealing thread pool. every worker owns a deque, it pops its own work from the back
+    /// and steals from the front of the others when it runs dry. tasks submitted from a worker stay on that worker
+    /// </summary>
+    class ThreadPool
+    {
+    public:
+        using Task = Delegate<void()>;
+
+        explicit ThreadPool(size_t threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        void operator=(const ThreadPool&) = delete;
+
+        void Submit(Task&& task);
+
+        [[nodiscard]] size_t Size() const { return _workers.size(); }
+
+        /// <summary>
+        /// default worker count, one less than the hardware threads since the sender works too
+        /// </summary>
+        static size_t DefaultSize();
+
+    private:
+        struct alignas(64) Worker
+        {
+            std::mutex lock;
+            std::deque<Task> tasks;
+        };
+
+        void Run(size_t index);
+        bool TryPop(size_t index, Task& task);
+        bool TrySteal(size_t index, Task& task);
+
+        std::vector<std::unique_ptr<Worker>> _workers;
+        std::vector<std::thread> _threads;
+        std::atomic<size_t> _nextWorker{ 0 };
+        std::atomic<size_t> _queued{ 0 };
+        std::atomic<uint32_t> _signal{ 0 };
+        std::atomic<bool> _stop{ false };
+    };
+}
@@ -0,0 +1,246 @@
+//(C) benyuan 2024
+//all rights reserved
+#include "TimingWheel.hpp"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+namespace es
+{
+    TimingWheel::TimingWheel(Clock::duration resolution, Clock::time_point start) : _resolution(resolution), _start(start)
+    {
+        assert(resolution > Clock::duration::zero());
+        std::fill(std::begin(_heads), std::end(_heads), noNode);
+        std::fill(std::begin(_tails), std::end(_tails), noNode);
+    }
+
+    TimingWheel::Handle TimingWheel::Schedule(Clock::time_point due, Clock::duration period, void* data)
+    {
+        uint32_t index = _free;
+        if (index != noNode)
+        {
+            _free = _nodes[index].next;
+        }
+        else
+        {
+            index = (uint32_t)_nodes.size();
+            _nodes.emplace_back();
+        }
+        Node& n = _nodes[index];
+        n.deadline = ToTick(due, true);
+        n.period = period > Clock::duration::zero() ? std::max<uint64_t>(1, ToTick(_start + period, true)) : 0;
+        n.data = data;
+        n.state = State::Linked;
+        ++_size;
+        Insert(index);
+        return (Handle)n.generation << 32 | index;
+    }
+
+    bool TimingWheel::Cancel(Handle handle, void*& data)
+    {
+        Node* n = Find(handle);
+        data = nullptr;
+        if (n == nullptr || n->state == State::Cancelled)
+        {
+            return false;
+        }
+        if (n->state == State::Firing)
+        {
+            n->state = State::Cancelled;
+            return true;
+        }
+        data = n->data;
+        const uint32_t index = (uint32_t)handle;
+        Unlink(index);
+        Free(index);
+        return true;
+    }
+
+    void TimingWheel::Advance(Clock::time_point now, std::vector<Expired>& expired)
+    {
+        const uint64_t target = ToTick(now, false);
+        Fire(dueList, expired);
+        for (uint64_t t = NextTick(); t <= target; t = NextTick())
+        {
+            //an upper slot comes up when the ticks below it wrap, its entries move down before the tick fires
+            _now = t;
+            for (uint32_t level = levels - 1; level > 0; --level)
+            {
+                const uint32_t shift = level * slotBits;
+                if ((t & ((1ull << shift) - 1)) != 0)
+                {
+                    continue;
+                }
+                const uint32_t list = level * slots + (uint32_t)(t >> shift & (slots - 1));
+                uint32_t index = _heads[list];
+                _heads[list] = _tails[list] = noNode;
+                _occupied[level] &= ~(1ull << (list & (slots - 1)));
+                while (index != noNode)
+                {
+                    const uint32_t next = _nodes[index].next;
+                    Insert(index);
+                    index = next;
+                }
+            }
+            Fire((uint32_t)(t & (slots - 1)), expired);
+            Fire(dueList, expired);
+        }
+        _now = std::max(_now, target);
+    }
+
+    void* TimingWheel::Rearm(Handle handle)
+    {
+        Node* n = Find(handle);
+        if (n == nullptr || n->state == State::Linked)
+        {
+            return nullptr;
+        }
+        const uint32_t index = (uint32_t)handle;
+        if (n->state == State::Cancelled)
+        {
+            void* data = n->data;
+            Free(index);
+            return data;
+        }
+        n->deadline += n->period;
+        if (n->deadline <= _now)
+        {
+            n->deadline += ((_now - n->deadline) / n->period + 1) * n->period;
+        }
+        n->state = State::Linked;
+        Insert(index);
+        return nullptr;
+    }
+
+    TimingWheel::Clock::time_point TimingWheel::NextDue() const
+    {
+        const uint64_t t = NextTick();
+        return t == UINT64_MAX ? Clock::time_point::max() : _start + (int64_t)t * _resolution;
+    }
+
+    uint64_t TimingWheel::ToTick(Clock::time_point t, bool roundUp) const
+    {
+        if (t <= _start)
+        {
+            return 0;
+        }
+        const Clock::duration d = t - _start;
+        return (uint64_t)(d / _resolution) + (roundUp && d % _resolution != Clock::duration::zero() ? 1 : 0);
+    }
+
+    TimingWheel::Node* TimingWheel::Find(Handle handle)
+    {
+        const uint32_t index = (uint32_t)handle;
+        if (index >= _nodes.size())
+        {
+            return nullptr;
+        }
+        Node& n = _nodes[index];
+        return n.generation == (uint32_t)(handle >> 32) && n.state != State::Free ? &n : nullptr;
+    }
+
+    //level L takes what is due in less than 64^(L+1) ticks, in the slot of the deadline at that level
+    void TimingWheel::Insert(uint32_t index)
+    {
+        const uint64_t deadline = _nodes[index].deadline;
+        if (deadline <= _now)
+        {
+            Link(dueList, index);
+            return;
+        }
+        const uint32_t level = std::min<uint32_t>((uint32_t)(std::bit_width(deadline - _now) - 1) / slotBits, levels - 1);
+        Link(level * slots + (uint32_t)(deadline >> (level * slotBits) & (slots - 1)), index);
+    }
+
+    void TimingWheel::Link(uint32_t list, uint32_t index)
+    {
+        Node& n = _nodes[index];
+        n.list = list;
+        n.next = noNode;
+        n.prev = _tails[list];
+        if (n.prev != noNode)
+        {
+            _nodes[n.prev].next = index;
+        }
+        else
+        {
+            _heads[list] = index;
+        }
+        _tails[list] = index;
+        if (list < dueList)
+        {
+            _occupied[list / slots] |= 1ull << (list & (slots - 1));
+        }
+    }
+
+    void TimingWheel::Unlink(uint32_t index)
+    {
+        const Node& n = _nodes[index];
+        (n.prev != noNode ? _nodes[n.prev].next : _heads[n.list]) = n.next;
+        (n.next != noNode ? _nodes[n.next].prev : _tails[n.list]) = n.prev;
+        if (_heads[n.list] == noNode && n.list < dueList)
+        {
+            _occupied[n.list / slots] &= ~(1ull << (n.list & (slots - 1)));
+        }
+    }
+
+    void TimingWheel::Free(uint32_t index)
+    {
+        Node& n = _nodes[index];
+        n.data = nullptr;
+        n.state = State::Free;
+        n.generation = n.generation + 1 != 0 ? n.generation + 1 : 1;
+        n.next = _free;
+        _free = index;
+        --_size;
+    }
+
+    void TimingWheel::Fire(uint32_t list, std::vector<Expired>& expired)
+    {
+        uint32_t index = _heads[list];
+        _heads[list] = _tails[list] = noNode;
+        if (list < dueList)
+        {
+            _occupied[list / slots] &= ~(1ull << (list & (slots - 1)));
+        }
+        while (index != noNode)
+        {
+            Node& n = _nodes[index];
+            const uint32_t next = n.next;
+            const Handle handle = (Handle)n.generation << 32 | index;
+            if (n.period != 0)
+            {
+                n.state = State::Firing;
+                expired.push_back({ handle, n.data, true });
+            }
+            else
+            {
+                expired.push_back({ handle, n.data, false });
+                Free(index);
+            }
+            index = next;
+        }
+    }
+
+    //the first tick after _now that fires a slot of level 0 or moves an upper slot down
+    uint64_t TimingWheel::NextTick() const
+    {
+        if (_heads[dueList] != noNode)
+        {
+            return _now;
+        }
+        uint64_t next = UINT64_MAX;
+        for (uint32_t level = 0; level < levels; ++level)
+        {
+            if (_occupied[level] == 0)
+            {
+                continue;
+            }
+            const uint32_t shift = level * slotBits;
+            const uint64_t block = (_now >> shift) + 1;
+            const uint64_t ahead = (uint64_t)std::countr_zero(std::rotr(_occupied[level], (int)(block & (slots - 1))));
+            next = std::min(next, (block + ahead) << shift);
+        }
+        return next;
+    }
+}
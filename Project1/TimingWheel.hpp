@@ -0,0 +1,128 @@
+//(C) benyuan 2024
+//all rights reserved
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace es
+{
+    /// <summary>
+    /// hierarchical timing wheel of 6 levels of 64 slots, level L holds what is due in less than 64^(L+1) ticks.
+    /// Schedule and Cancel link and unlink one node, O(1). Advance walks the ticks that fire or move something,
+    /// found from one occupancy word per level, and moves an entry down a level when its slot comes up.
+    /// deadlines are rounded up to the resolution, 2^36 ticks ahead at most. not thread safe
+    /// </summary>
+    class TimingWheel
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using Handle = uint64_t;    //node index in the low half, generation in the high half, 0 is never a handle
+
+        static constexpr uint32_t levels = 6;
+        static constexpr uint32_t slotBits = 6;
+        static constexpr uint32_t slots = 1u << slotBits;
+
+        struct Expired
+        {
+            Handle handle;
+            void* data;
+            bool periodic;      //still scheduled, Rearm it once delivered
+        };
+
+        explicit TimingWheel(Clock::duration resolution = std::chrono::milliseconds(1), Clock::time_point start = Clock::now());
+
+        /// <summary>
+        /// data is due at due, then every period when it is not zero
+        /// </summary>
+        Handle Schedule(Clock::time_point due, Clock::duration period, void* data);
+
+        /// <summary>
+        /// unschedule handle. its data is given back unless it was expired by Advance and not rearmed yet,
+        /// then the next Rearm drops it and gives the data back there
+        /// </summary>
+        /// <returns>false if handle is not scheduled</returns>
+        bool Cancel(Handle handle, void*& data);
+
+        /// <summary>
+        /// append everything due by now to expired, in deadline order. one shot entries leave the wheel,
+        /// periodic ones wait for Rearm. a period missed while nothing advanced the wheel is skipped
+        /// </summary>
+        void Advance(Clock::time_point now, std::vector<Expired>& expired);
+
+        /// <summary>
+        /// schedule a periodic entry that expired again, one period after its last deadline
+        /// </summary>
+        /// <returns>the data of an entry cancelled since it expired, it is gone now</returns>
+        void* Rearm(Handle handle);
+
+        /// <summary>
+        /// when Advance has something to do next, entries in the upper levels only move down then.
+        /// time_point::max() when the wheel is empty
+        /// </summary>
+        [[nodiscard]] Clock::time_point NextDue() const;
+
+        [[nodiscard]] size_t Size() const { return _size; }
+        [[nodiscard]] Clock::duration Resolution() const { return _resolution; }
+
+        /// <summary>
+        /// remove every entry, expired ones waiting for Rearm too, and give their data to fn
+        /// </summary>
+        template <typename Fn>
+        void Clear(Fn&& fn)
+        {
+            for (Node& n : _nodes)
+            {
+                if (n.state != State::Free)
+                {
+                    fn(n.data);
+                }
+            }
+            *this = TimingWheel(_resolution, Clock::now());
+        }
+
+    private:
+        static constexpr uint32_t noNode = UINT32_MAX;
+        static constexpr uint32_t dueList = levels * slots;     //entries due already, fired by the next Advance
+
+        enum class State : uint8_t
+        {
+            Free,
+            Linked,
+            Firing,         //expired and periodic, Rearm links it again
+            Cancelled,      //cancelled while firing, Rearm frees it
+        };
+
+        struct Node
+        {
+            uint64_t deadline = 0;      //in ticks
+            uint64_t period = 0;
+            void* data = nullptr;
+            uint32_t prev = noNode;
+            uint32_t next = noNode;
+            uint32_t generation = 1;
+            uint32_t list = 0;
+            State state = State::Free;
+        };
+
+        uint64_t ToTick(Clock::time_point t, bool roundUp) const;
+        Node* Find(Handle handle);
+        void Insert(uint32_t index);
+        void Link(uint32_t list, uint32_t index);
+        void Unlink(uint32_t index);
+        void Free(uint32_t index);
+        void Fire(uint32_t list, std::vector<Expired>& expired);
+        uint64_t NextTick() const;
+
+        Clock::duration _resolution;
+        Clock::time_point _start;
+        uint64_t _now = 0;                      //every tick up to it was advanced over
+        std::vector<Node> _nodes;
+        uint32_t _free = noNode;
+        size_t _size = 0;
+        uint32_t _heads[dueList + 1];
+        uint32_t _tails[dueList + 1];
+        uint64_t _occupied[levels] = {};        //bit s of level L: slot s has entries
+    };
+}
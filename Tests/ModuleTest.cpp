@@ -0,0 +1,69 @@
+//(C) benyuan 2024
+//all rights reserved
+//the engine reached through the EventSystem module instead of the header. the process exits with the number of
+//failed checks
+#include <cstdio>
+#include <vector>
+import EventSystem;
+
+namespace
+{
+    int failures = 0;
+
+#define CHECK(cond)\
+    do\
+    {\
+        if (!(cond))\
+        {\
+            std::printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);\
+            ++failures;\
+        }\
+    } while (0)
+
+    enum EventID
+    {
+        Tick = 1,
+    };
+
+    void SendThroughModule()
+    {
+        es::EventSystem bus;
+        std::vector<int> calls;
+        int sender = 0;
+        bus.Register(Tick, &sender, [&](int v) { calls.push_back(v); });
+        const auto handle = bus.Register(Tick, nullptr, [&](int v) { calls.push_back(v * 10); });
+        bus.Send(Tick, &sender, 1);
+        bus.Unregister(handle);
+        bus.Send(Tick, &sender, 2);
+        CHECK((calls == std::vector<int>{ 1, 10, 2 }));
+    }
+
+    //the types of the API are exported with it
+    void NameApiTypes()
+    {
+        es::EventSystem bus;
+        es::Mailbox mailbox;
+        std::vector<int> calls;
+        bus.SetPostQueue(64, es::QueueFullPolicy::Grow);
+        bus.RegisterOn(mailbox, Tick, nullptr, [&](int v) { calls.push_back(v); });
+        bus.SendBatch(Tick, nullptr, std::vector<int>{ 1, 2 }, es::BatchOrder::ListenerMajor);
+        const es::MemorySnapshot memory = bus.MemoryStats();
+        const es::EventMemory* tick = memory.Find(Tick);
+        CHECK(tick != nullptr && tick->listeners == 1);
+        CHECK((calls == std::vector<int>{ 1, 2 }));
+
+        es::EventRecorder recorder;
+        es::ShmTransport transport(bus);
+        const es::SharedRingOptions options;
+        (void)options;
+        CHECK(recorder.Stats().records == 0);
+    }
+}
+
+int main()
+{
+    SendThroughModule();
+    NameApiTypes();
+    std::printf("%s, %d failed checks\n", failures == 0 ? "passed" : "FAILED", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,385 @@
+//(C) benyuan 2024
+//all rights reserved
+//register and unregister from inside listeners, checked against a model of what each send must call.
+//the process exits with the number of failed checks
+#include "EventSystem.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    int failures = 0;
+
+#define CHECK(cond)\
+    do\
+    {\
+        if (!(cond))\
+        {\
+            std::printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);\
+            ++failures;\
+        }\
+    } while (0)
+
+    enum EventID
+    {
+        Tick = 1,
+        Other,
+        Shared,
+    };
+
+    //listeners are called newest first. one registered inside a send is called by neither that send nor the
+    //nested ones, only by sends that start after the outermost one returned
+    void RegisterDuringSend()
+    {
+        es::EventSystem bus;
+        std::vector<int> calls;
+        bool registered = false;
+        bus.Register(Tick, nullptr, [&](int depth)
+            {
+                calls.push_back(depth * 10 + 1);
+                if (!registered)
+                {
+                    registered = true;
+                    bus.Register(Tick, nullptr, [&](int d) { calls.push_back(d * 10 + 2); });
+                    bus.Register(Other, nullptr, [&](int d) { calls.push_back(d * 10 + 3); });
+                }
+                if (depth == 0)
+                {
+                    bus.SendAll(Tick, 1);
+                    bus.SendAll(Other, 1);
+                }
+            });
+
+        bus.SendAll(Tick, 0);
+        CHECK((calls == std::vector<int>{ 1, 11 }));
+
+        calls.clear();
+        bus.SendAll(Tick, 0);
+        CHECK((calls == std::vector<int>{ 2, 1, 12, 11, 13 }));
+    }
+
+    //an unregistered listener is not called again, not even by the send that is walking its list
+    void UnregisterDuringSend()
+    {
+        es::EventSystem bus;
+        std::vector<int> calls;
+        const es::EventSystem::CallBackHandle second = bus.Register(Tick, nullptr, [&](int depth) { calls.push_back(depth * 10 + 2); });
+        bus.Register(Tick, nullptr, [&](int depth) { calls.push_back(depth * 10 + 3); });
+        es::EventSystem::CallBackHandle self = 0;
+        self = bus.Register(Tick, nullptr, [&](int depth)
+            {
+                calls.push_back(depth * 10 + 1);
+                if (depth == 0)
+                {
+                    bus.Unregister(second);
+                    bus.Unregister(self);
+                    bus.SendAll(Tick, 1);
+                }
+            });
+
+        bus.SendAll(Tick, 0);
+        CHECK((calls == std::vector<int>{ 1, 13, 3 }));
+
+        calls.clear();
+        bus.SendAll(Tick, 0);
+        CHECK((calls == std::vector<int>{ 3 }));
+        CHECK(bus.MemoryStats().Find(Tick)->listeners == 1);
+    }
+
+    //registered and unregistered within one send, it never joins its list
+    void RegisterThenUnregisterDuringSend()
+    {
+        es::EventSystem bus;
+        int stray = 0;
+        bool done = false;
+        bus.Register(Tick, nullptr, [&](int)
+            {
+                if (!done)
+                {
+                    done = true;
+                    bus.Unregister(bus.Register(Tick, nullptr, [&](int) { ++stray; }));
+                }
+            });
+        bus.SendAll(Tick, 0);
+        bus.SendAll(Tick, 0);
+        CHECK(stray == 0);
+        CHECK(bus.MemoryStats().Find(Tick)->listeners == 1);
+    }
+
+    /// <summary>
+    /// random register, unregister and nested sends from inside the listeners of one event. every send is checked:
+    /// it calls each listener visible to it and not unregistered by its end exactly once, newest first,
+    /// and nothing else. in single thread mode a listener is visible to the sends that start after the outermost
+    /// send around its registration returned, in thread safe mode to the sends that start after its registration
+    /// </summary>
+    class ChurnModel
+    {
+    public:
+        ChurnModel(es::EventSystem& bus, int evt, uint32_t seed) : _bus(bus), _evt(evt), _rng(seed) {}
+
+        void Run(size_t sends)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                Add();
+            }
+            for (size_t i = 0; i < sends; ++i)
+            {
+                //removals may have emptied the list, keep some listeners to churn
+                while (_alive.size() < 8)
+                {
+                    Add();
+                }
+                Send();
+            }
+
+            //compaction after all that churn leaves exactly the live listeners, in order
+            const size_t live = _alive.size();
+            _quiet = true;
+            _calls = 0;
+            Send();
+            CHECK(_calls == live);
+            const es::MemorySnapshot stats = _bus.MemoryStats();
+            const es::EventMemory* memory = stats.Find(_evt);
+            CHECK(memory != nullptr && memory->listeners == live);
+            for (uint32_t id : _alive)
+            {
+                _bus.Unregister(_entries[id].handle);
+            }
+        }
+
+        size_t Calls() const { return _total; }
+
+    private:
+        struct Entry
+        {
+            es::EventSystem::CallBackHandle handle = 0;
+            uint64_t registeredAt = 0;      //sends started before the registration
+            bool dead = false;
+        };
+
+        struct ActiveSend
+        {
+            uint64_t start;
+            std::vector<uint32_t> called;
+            bool nested = false;
+        };
+
+        void Add()
+        {
+            const uint32_t id = (uint32_t)_entries.size();
+            _entries.push_back(Entry{ 0, _started, false });
+            _entries[id].handle = _bus.Register(_evt, nullptr, [this, id](uint32_t) { OnCall(id); });
+            _alive.push_back(id);
+        }
+
+        bool Visible(const Entry& e, uint64_t start) const
+        {
+            const uint64_t from = _bus.IsThreadSafe() ? start : _active.front().start;
+            return e.registeredAt < from;
+        }
+
+        void Send()
+        {
+            _active.push_back(ActiveSend{ ++_started, {}, false });
+            _bus.SendAll(_evt, (uint32_t)_active.size());
+
+            //every listener visible at the start and still registered at the end was called once, in order
+            const ActiveSend& send = _active.back();
+            std::vector<uint32_t> expected;
+            for (auto id = _alive.rbegin(); id != _alive.rend(); ++id)
+            {
+                if (Visible(_entries[*id], send.start))
+                {
+                    expected.push_back(*id);
+                }
+            }
+            std::vector<uint32_t> survivors;
+            for (uint32_t id : send.called)
+            {
+                if (!_entries[id].dead)
+                {
+                    survivors.push_back(id);
+                }
+            }
+            CHECK(survivors == expected);
+            _active.pop_back();
+        }
+
+        void OnCall(uint32_t id)
+        {
+            ++_calls;
+            ++_total;
+            ActiveSend& send = _active.back();
+            const Entry& e = _entries[id];
+            CHECK(!e.dead);
+            CHECK(Visible(e, send.start));
+            CHECK(send.called.empty() || send.called.back() > id);
+            send.called.push_back(id);
+            if (_quiet)
+            {
+                return;
+            }
+
+            switch (_rng() % 8)
+            {
+            case 0:
+            case 1:
+                if (_alive.size() < 64)
+                {
+                    Add();
+                }
+                break;
+            case 2:
+            case 3:
+                Remove(_rng() % _entries.size());
+                break;
+            case 4:
+                Remove(id);
+                break;
+            case 5:
+                //one nested send per send, up to three deep
+                if (!send.nested && _active.size() < 3)
+                {
+                    send.nested = true;
+                    Send();
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        void Remove(size_t id)
+        {
+            Entry& e = _entries[id];
+            if (!e.dead)
+            {
+                e.dead = true;
+                _alive.erase(std::find(_alive.begin(), _alive.end(), (uint32_t)id));
+                _bus.Unregister(e.handle);
+            }
+        }
+
+        es::EventSystem& _bus;
+        int _evt;
+        std::mt19937 _rng;
+        std::vector<Entry> _entries;
+        std::vector<uint32_t> _alive;       //ids of the registered listeners, oldest first
+        std::vector<ActiveSend> _active;
+        uint64_t _started = 0;
+        size_t _calls = 0;
+        size_t _total = 0;
+        bool _quiet = false;
+    };
+
+    void ChurnSingleThread()
+    {
+        es::EventSystem bus;
+        ChurnModel model(bus, Tick, 1);
+        model.Run(3000);
+        CHECK(model.Calls() > 100000);
+    }
+
+    void ChurnThreadSafe()
+    {
+        es::EventSystem bus;
+        bus.SetThreadSafe(true);
+        ChurnModel model(bus, Tick, 2);
+        model.Run(3000);
+        CHECK(model.Calls() > 100000);
+    }
+
+    /// <summary>
+    /// thread safe mode under load: each thread churns an event of its own against the model, while every thread
+    /// also sends an event whose listeners register and unregister each other from other threads
+    /// </summary>
+    void ChurnThreads()
+    {
+        es::EventSystem bus;
+        bus.SetThreadSafe(true);
+        constexpr int threads = 4;
+
+        std::atomic<uint64_t> sharedCalls{ 0 };
+        struct Rearm
+        {
+            std::atomic<es::EventSystem::CallBackHandle> handle{ 0 };
+        };
+        std::vector<Rearm> rearms(16);
+        std::function<void(size_t)> arm = [&](size_t i)
+            {
+                rearms[i].handle = bus.Register(Shared, nullptr, [&, i](int)
+                    {
+                        sharedCalls.fetch_add(1, std::memory_order_relaxed);
+                        if (const auto h = rearms[i].handle.exchange(0); h != 0)
+                        {
+                            bus.Unregister(h);
+                            arm(i);
+                        }
+                    });
+            };
+        for (size_t i = 0; i < rearms.size(); ++i)
+        {
+            arm(i);
+        }
+
+        std::vector<std::thread> workers;
+        std::vector<size_t> calls(threads);
+        for (int t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&, t]()
+                {
+                    std::atomic<bool> stop{ false };
+                    std::thread noise([&]()
+                        {
+                            while (!stop.load(std::memory_order_relaxed))
+                            {
+                                bus.SendAll(Shared, t);
+                                std::this_thread::yield();
+                            }
+                        });
+                    ChurnModel model(bus, Tick + 100 + t, 10 + t);
+                    model.Run(800);
+                    calls[t] = model.Calls();
+                    stop = true;
+                    noise.join();
+                });
+        }
+        for (auto& w : workers)
+        {
+            w.join();
+        }
+
+        for (int t = 0; t < threads; ++t)
+        {
+            CHECK(calls[t] > 50000);
+        }
+        CHECK(sharedCalls.load() > 0);
+
+        //only the call that won the exchange re-armed, whatever the order, so each listener is registered once
+        for (auto& r : rearms)
+        {
+            CHECK(r.handle.load() != 0);
+        }
+        sharedCalls = 0;
+        bus.SendAll(Shared, 0);
+        CHECK(sharedCalls.load() == rearms.size());
+    }
+}
+
+int main()
+{
+    RegisterDuringSend();
+    UnregisterDuringSend();
+    RegisterThenUnregisterDuringSend();
+    ChurnSingleThread();
+    ChurnThreadSafe();
+    ChurnThreads();
+    std::printf("%s, %d failed checks\n", failures == 0 ? "passed" : "FAILED", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+//(C) benyuan 2024
+//all rights reserved
+//move only arguments reach exactly one listener, the one called last that takes them, and are never taken from it.
+//the process exits with the number of failed checks
+#include "EventSystem.hpp"
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    int failures = 0;
+
+#define CHECK(cond)\
+    do\
+    {\
+        if (!(cond))\
+        {\
+            std::printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);\
+            ++failures;\
+        }\
+    } while (0)
+
+    enum EventID
+    {
+        Message = 1,
+        JobDone,
+    };
+
+    struct Job
+    {
+        int id = 0;
+        std::unique_ptr<int> data;
+    };
+
+    //listeners are called newest first, so the one registered first is last and takes the pointer
+    void SendMoveToLast()
+    {
+        es::EventSystem bus;
+        std::vector<int> calls;
+        bus.Register(Message, nullptr, [&](std::unique_ptr<int> p) { calls.push_back(p != nullptr ? *p : -1); });
+        bus.Register(Message, nullptr, [&](std::unique_ptr<int>&& p) { calls.push_back(p != nullptr ? *p : -1); });
+        bus.Register(Message, nullptr, [&](const std::unique_ptr<int>& p) { calls.push_back(p != nullptr ? *p * 10 : -1); });
+
+        const uint64_t rejected = es::EventSystem::RejectedMoves();
+        bus.SendMove(Message, nullptr, std::make_unique<int>(4));
+        CHECK((calls == std::vector<int>{ 40, 4 }));
+        CHECK(es::EventSystem::RejectedMoves() == rejected + 1);
+    }
+
+    //a plain send hands nothing over, even of an rvalue. a move only by value listener is skipped and the payload
+    //left with the caller
+    void SendKeepsPayload()
+    {
+        es::EventSystem bus;
+        int taken = 0;
+        int read = 0;
+        bus.Register(Message, nullptr, [&](std::unique_ptr<int>) { ++taken; });
+        bus.Register(Message, nullptr, [&](const std::unique_ptr<int>& p) { read += p != nullptr ? *p : -1; });
+
+        const uint64_t rejected = es::EventSystem::RejectedMoves();
+        auto payload = std::make_unique<int>(3);
+        bus.SendAll(Message, std::move(payload));
+        CHECK(taken == 0);
+        CHECK(read == 3);
+        CHECK(payload != nullptr && *payload == 3);
+        CHECK(es::EventSystem::RejectedMoves() == rejected + 1);
+    }
+
+    /// <summary>
+    /// keyed listeners are walked after the ones without key. a key group with listeners of other senders only
+    /// does not take the payload from the listener that gets the send
+    /// </summary>
+    void KeyedMoveGoesToAcceptingListener()
+    {
+        es::EventSystem bus;
+        int a = 0;
+        int b = 0;
+        std::vector<int> calls;
+        bus.Register(JobDone, &a, &Job::id, 7, [&](Job j) { calls.push_back(j.data != nullptr ? *j.data : -1); });
+        bus.Register(JobDone, nullptr, [&](Job j) { calls.push_back(j.data != nullptr ? *j.data * 10 : -1); });
+
+        const uint64_t rejected = es::EventSystem::RejectedMoves();
+        bus.SendMove(JobDone, &b, Job{ 7, std::make_unique<int>(5) });
+        CHECK((calls == std::vector<int>{ 50 }));
+        CHECK(es::EventSystem::RejectedMoves() == rejected);
+
+        //both take it, the keyed one is walked last
+        calls.clear();
+        bus.SendMove(JobDone, &a, Job{ 7, std::make_unique<int>(6) });
+        CHECK((calls == std::vector<int>{ 6 }));
+        CHECK(es::EventSystem::RejectedMoves() == rejected + 1);
+    }
+
+    //the mailbox copy of a call off the owner thread follows the same rule
+    void MailboxMove()
+    {
+        es::EventSystem bus;
+        es::Mailbox mailbox(std::thread::id{});
+        std::vector<int> calls;
+        bus.RegisterOn(mailbox, Message, nullptr, [&](std::unique_ptr<int> p) { calls.push_back(p != nullptr ? *p : -1); });
+        bus.RegisterOn(mailbox, Message, nullptr, [&](std::unique_ptr<int> p) { calls.push_back(p != nullptr ? *p * 10 : -1); });
+
+        const uint64_t rejected = es::EventSystem::RejectedMoves();
+        bus.SendMove(Message, nullptr, std::make_unique<int>(2));
+        mailbox.SetOwner();
+        mailbox.Drain();
+        CHECK((calls == std::vector<int>{ 2 }));
+        CHECK(es::EventSystem::RejectedMoves() == rejected + 1);
+    }
+}
+
+int main()
+{
+    SendMoveToLast();
+    SendKeepsPayload();
+    KeyedMoveGoesToAcceptingListener();
+    MailboxMove();
+    std::printf("%s, %d failed checks\n", failures == 0 ? "passed" : "FAILED", failures);
+    return failures == 0 ? 0 : 1;
+}
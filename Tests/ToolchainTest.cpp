@@ -0,0 +1,80 @@
+//(C) benyuan 2024
+//all rights reserved
+//a log is only replayed by a build of the toolchain that recorded it, its argument signatures are type names.
+//the process exits with the number of failed checks
+#include "EventReplay.hpp"
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+namespace
+{
+    int failures = 0;
+
+#define CHECK(cond)\
+    do\
+    {\
+        if (!(cond))\
+        {\
+            std::printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);\
+            ++failures;\
+        }\
+    } while (0)
+
+    enum EventID
+    {
+        Tick = 1,
+    };
+
+    std::string Record(const char* name)
+    {
+        const std::string path = std::string("es_toolchain_test_") + name;
+        es::EventSystem bus;
+        es::EventRecorder recorder;
+        CHECK(recorder.Open(path, 1 << 16));
+        bus.SetRecorder(&recorder);
+        bus.Send(Tick, nullptr, 7, std::string("seven"));
+        bus.SetRecorder(nullptr);
+        recorder.Close();
+        return path;
+    }
+
+    void SameToolchainReplays()
+    {
+        const std::string path = Record("same");
+        es::EventSystem bus;
+        int got = 0;
+        bus.Register(Tick, nullptr, [&](int t, const std::string& s) { got = s == "seven" ? t : -1; });
+        es::EventReplayer replayer(bus);
+        CHECK(replayer.Open(path));
+        replayer.Bind<int, std::string>(Tick);
+        const es::ReplayStats stats = replayer.Run(es::ReplayPacing::AsFastAsPossible);
+        CHECK(stats.events == 1 && stats.unbound == 0);
+        CHECK(got == 7);
+        std::remove((path + ".0").c_str());
+    }
+
+    //a log that claims another compiler or standard library is refused, not replayed with mismatched signatures
+    void OtherToolchainRefused()
+    {
+        const std::string path = Record("other");
+        {
+            std::fstream file(path + ".0", std::ios::in | std::ios::out | std::ios::binary);
+            const uint64_t other = es::ToolchainSignature() + 1;
+            file.seekp(offsetof(es::LogSegmentHeader, toolchain));
+            file.write(reinterpret_cast<const char*>(&other), sizeof(other));
+        }
+        es::EventReplayer replayer;
+        CHECK(!replayer.Open(path));
+        std::remove((path + ".0").c_str());
+    }
+}
+
+int main()
+{
+    SameToolchainReplays();
+    OtherToolchainRefused();
+    std::printf("%s, %d failed checks\n", failures == 0 ? "passed" : "FAILED", failures);
+    return failures == 0 ? 0 : 1;
+}